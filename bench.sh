@@ -1,10 +1,46 @@
 #!/bin/bash
 
-echo "" > "bench.dat"
-for i in `seq 1000 500 20000` ; do
-	output=`./bst_test -n $i`
-    dim=`echo $output | awk '{print $1}'` 
-    tr=`echo $output | awk '{print $3}'` 
-    tl=`echo $output | awk '{print $5}'`
-	echo "$dim $tr $tl" >> "bench.dat"
+# time every operation of every tree type over a range of sizes, loaded
+# in random and ascending order, and mixes of 95% searches and 5%
+# inserts, Zipf-skewed and in ascending order, into bench.csv (see
+# bst_bench.c for the columns) - build with the Makefile's -O2 CFLAGS
+# line first, as the numbers checked in were
+./bst_bench -n 1000 -r 1 -w 0 | head -1 > "bench.csv"
+for i in `seq 1000 1000 20000` ; do
+	./bst_bench -n $i -H >> "bench.csv"
+	./bst_bench -n $i -H -k sequential -r 3 >> "bench.csv"
+	./bst_bench -n $i -H -m 95:5:0 -q zipf:0.99 >> "bench.csv"
+	./bst_bench -n $i -H -m 95:5:0 -q zipf:1.2 >> "bench.csv"
+	./bst_bench -n $i -H -m 95:5:0 -q sequential >> "bench.csv"
 done
+
+# and the median times that plot.gnu draws into bench.dat, as before:
+# a line per tree size, the size first, then a column per series -
+# TYPE,WORKLOAD,OP of bench.csv - in this order
+series="PLAIN,uniform,insert PLAIN,sequential,insert
+	AVL,uniform,insert AVL,sequential,insert WIDE,uniform,insert
+	AVL,uniform,search_hit AVL,uniform,search_miss WIDE,uniform,search_hit
+	AVL,uniform/zipf:0.99,mix-95:5:0 WIDE,uniform/zipf:0.99,mix-95:5:0
+	SPLAY,uniform,search_hit SPLAY,uniform/zipf:0.99,mix-95:5:0
+	AVL,uniform/sequential,mix-95:5:0 SPLAY,uniform/sequential,mix-95:5:0
+	PLAIN,uniform/zipf:1.2,mix-95:5:0 AVL,uniform/zipf:1.2,mix-95:5:0
+	SPLAY,uniform/zipf:1.2,mix-95:5:0"
+awk -F, -v series="$series" '
+	NR > 1 {
+		if (! ($3 in seen)) { seen[$3] = 1; sizes[++nsizes] = $3 }
+		p50[$3 "," $1 "," $2 "," $4] = $8
+	}
+	END {
+		ncols = split(series, cols, /[ \t\n]+/)
+		printf "# n"
+		for (c = 1; c <= ncols; c++) printf " %s", cols[c]
+		printf "\n"
+		for (i = 1; i <= nsizes; i++) {
+			printf "%s", sizes[i]
+			for (c = 1; c <= ncols; c++) {
+				key = sizes[i] "," cols[c]
+				printf " %s", (key in p50) ? p50[key] : "NaN"
+			}
+			printf "\n"
+		}
+	}' bench.csv > "bench.dat"
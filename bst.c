@@ -1,7 +1,17 @@
+#define _GNU_SOURCE	// for pthread_rwlockattr_setkind_np()
+
 #include <stdio.h>
 #include <string.h>
 
 #include "bst.h"
+#include "bst_wide.h"
+#include "bst_bulk.h"
+
+/* lookups kept in flight at once by bst_search_batch() */
+#define BST_BATCH_LANES 16
+
+/* searches splay the splay trees - defined with the rotations */
+static void bst_splay(bst *my_tree, struct bstnode_s *node);
 
 
 /*
@@ -11,12 +21,57 @@
  ******************************************************************************
  */
 bst *bst_create() {
+	return bst_create_type(BST_PLAIN);
+}
+
+
+/*
+ ******************************************************************************
+ * Create a new binary search tree using the given balancing scheme,
+ * BST_PLAIN, BST_AVL, BST_WIDE or BST_SPLAY, optionally or'ed with
+ * BST_THREADSAFE.
+ * Return the new pointer, or NULL for an unknown type.
+ ******************************************************************************
+ */
+bst *bst_create_type(int type) {
 	bst *my_tree;
+	int flags = type & BST_THREADSAFE;
+
+	type &= ~BST_THREADSAFE;
+	if (type != BST_PLAIN && type != BST_AVL && type != BST_WIDE && type != BST_SPLAY) return NULL;
 
 	if (! (my_tree = (bst *)malloc(sizeof(bst)))) return NULL;
 
+	if (flags & BST_THREADSAFE) {
+		pthread_rwlockattr_t attr;
+		int err;
+
+		// many readers and few writers - don't let the writers starve
+		pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+		pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+		err = pthread_rwlock_init(&my_tree->lock, &attr);
+		pthread_rwlockattr_destroy(&attr);
+		if (err) {
+			free(my_tree);
+			return NULL;
+		}
+	}
+
 	my_tree->root = NULL;
 	my_tree->size = 0;
+	my_tree->type = type;
+	my_tree->flags = flags;
+#ifdef BST_STATS
+	memset(&my_tree->counters, 0, sizeof(my_tree->counters));
+#endif
+	if (type == BST_WIDE) {
+		bst_wide_init(my_tree);
+	} else {
+		my_tree->wroot = NULL;
+		bst_pool_init(&my_tree->pool, sizeof(struct bstnode_s));
+	}
 
 	return my_tree;
 }
@@ -24,521 +79,1980 @@ bst *bst_create() {
 
 /*
  * Helper function:
- * Destroy the nodes in the tree recursively.
+ * Link nodes[lo..hi) - which hold keys[lo..hi) - into a minimum-height
+ * subtree: the middle node is the root, and each half recursively forms
+ * one of its children. The recursion is only log2(n) deep. Only the top
+ * 'levels' levels are built (all of them if 'levels' is negative); the
+ * subtrees below are already built, and are just linked in - see
+ * bst_insert_bulk().
+ * Return the root of the subtree.
  */
-void bst_destroy_recursive(struct bstnode_s *node) {
-	if (node == NULL) {
-		// empty child - do nothing
-		return;
-	} else if (node->left == NULL && node->right == NULL) {
-		// no children, so free this child
-		free(node);
-		return;
-	} 
-
-
-	// ok, so we have some children, at least on one side, but possibly
-	// on both
+static struct bstnode_s *bst_build_balanced(struct bstnode_s *nodes, const bst_key *keys,
+		size_t lo, size_t hi, struct bstnode_s *parent, int levels) {
+	struct bstnode_s *node;
+	size_t mid;
+	int hl, hr;
 
-	if (node->left) {
-		// children on one side - free them
-		bst_destroy_recursive(node->left);
+	if (lo == hi) {
+		return NULL;
 	}
 
-	if (node->right) {
-		// children on one side - free them
-		bst_destroy_recursive(node->right);
+	mid = lo + (hi - lo) / 2;
+	node = &nodes[mid];
+	node->parent = parent;
+	if (levels == 0) {
+		return node;
 	}
+	node->data   = keys[mid];
+	node->count  = hi - lo;
+	node->left   = bst_build_balanced(nodes, keys, lo, mid, node, levels - 1);
+	node->right  = bst_build_balanced(nodes, keys, mid + 1, hi, node, levels - 1);
 
-	// then the parent node itself
-	free(node);
+	hl = node->left ? node->left->height : 0;
+	hr = node->right ? node->right->height : 0;
+	node->height = 1 + (hl > hr ? hl : hr);
+
+	return node;
 }
 
 
 /*
  ******************************************************************************
- * Destroy the binary search tree cleanly, freeing all memory.
- * If the tree is empty, then nothing to do. Otherwise
- * call the recursive destroy function.
+ * Create a perfectly balanced (AVL) tree holding the 'n' keys, which
+ * must be sorted in strictly ascending order. This takes O(n) time
+ * and a single allocation for all the nodes, where 'n' calls to
+ * bst_insert() would take O(n log n) - or O(n^2) for a BST_PLAIN tree.
+ * Return the new pointer, or NULL if the keys are not strictly
+ * ascending or memory runs out.
  ******************************************************************************
  */
-void bst_destroy(bst *my_tree) {
-	if (my_tree == NULL) {
-		// nothing to do!
-		return;
+bst *bst_create_from_sorted(const bst_key *keys, size_t n) {
+	struct bstnode_s *nodes;
+	bst *my_tree;
+	size_t i;
+
+	// sorted and no duplicates?
+	for (i=1; i<n; i++) {
+		if (keys[i-1] >= keys[i]) return NULL;
 	}
 
-	// recursively free the nodes
-	bst_destroy_recursive(my_tree->root);
+	if (! (my_tree = bst_create_type(BST_AVL))) return NULL;
+	if (n == 0) return my_tree;
 
-	// and finally the binary search tree struct itself
-	free(my_tree);
+	if (! (nodes = (struct bstnode_s *) bst_pool_alloc_block(&my_tree->pool, n))) {
+		bst_destroy(my_tree);
+		return NULL;
+	}
+
+	my_tree->root = bst_build_balanced(nodes, keys, 0, n, NULL, -1);
+	my_tree->size = n;
+
+	return my_tree;
 }
 
 
 /*
- ******************************************************************************
- * Return the current size.
- ******************************************************************************
+ * Helper function:
+ * qsort() comparison for keys, ascending.
  */
+static int bst_compare_keys(const void *a, const void *b) {
+	bst_key x = *(const bst_key *)a;
+	bst_key y = *(const bst_key *)b;
 
-int bst_size(bst *my_tree) {
-	return my_tree->size;
+	return (x > y) - (x < y);
 }
 
 
 /*
- * Helper function:
- * Perform the search recursively - binary search.
- * Return 1 for sucessful search, 0 for failure.
+ ******************************************************************************
+ * Create a perfectly balanced (AVL) tree holding the 'n' keys, which
+ * may be in any order and contain duplicates. The keys are copied,
+ * sorted and de-duplicated, then passed to bst_create_from_sorted().
+ * Return the new pointer, or NULL if memory runs out.
+ ******************************************************************************
  */
+bst *bst_create_from_array(const bst_key *keys, size_t n) {
+	bst *my_tree;
+	bst_key *sorted;
+	size_t i, unique = 0;
 
-int bst_search_recursive(struct bstnode_s *node, int data) {
-	if (data > node->data) {
-		if (node->right != NULL) {
-			return bst_search_recursive(node->right,data) ; // Go right
-		}
-		else {
-			return 0 ;
-		}
-	} else if (data < node->data) {
-		if (node->left != NULL) {
-			return bst_search_recursive(node->left,data) ; // Go left
-		} else {
-			return 0 ;
+	if (n == 0) return bst_create_type(BST_AVL);
+
+	if (! (sorted = (bst_key *) malloc(n * sizeof(bst_key)))) return NULL;
+	memcpy(sorted, keys, n * sizeof(bst_key));
+	qsort(sorted, n, sizeof(bst_key), bst_compare_keys);
+
+	// squeeze out the duplicates, which are now adjacent
+	for (i=0; i<n; i++) {
+		if (unique == 0 || sorted[unique-1] != sorted[i]) {
+			sorted[unique++] = sorted[i];
 		}
-	} else {
-		return 1 ; // Found the value
 	}
+
+	my_tree = bst_create_from_sorted(sorted, unique);
+
+	free(sorted);
+	return my_tree;
 }
 
+
 /*
- ******************************************************************************
- * Search for a value recursively - binary search.
- * If the tree is empty, then not found. Otherwise search
- * recursively.
- * Return 1 for sucessful search, 0 for failure.
- ******************************************************************************
+ * Helper functions:
+ * Build the subtrees of a bulk build in parallel. The top 'levels'
+ * levels of the balanced tree over keys[0..n) cut it into 2^levels
+ * subtrees, over ranges of keys that are known in advance; the threads
+ * build those, sharing them out round robin, and bst_build_balanced()
+ * then builds the top levels over them.
  */
+#define BST_BULK_MAX_LEVELS 8	// 256 subtrees, four or more a thread
+
+struct bst_build {
+	struct bstnode_s *nodes;
+	const bst_key *keys;
+	int p, ntasks;
+	size_t lo[1 << BST_BULK_MAX_LEVELS], hi[1 << BST_BULK_MAX_LEVELS];
+};
+
+static void bst_build_ranges(struct bst_build *b, size_t lo, size_t hi, int levels) {
+	size_t mid = lo + (hi - lo) / 2;
+
+	if (levels == 0 || lo == hi) {
+		b->lo[b->ntasks] = lo;
+		b->hi[b->ntasks] = hi;
+		b->ntasks++;
+		return;
+	}
+	bst_build_ranges(b, lo, mid, levels - 1);
+	bst_build_ranges(b, mid + 1, hi, levels - 1);
+}
 
-int bst_search(bst *my_tree, int data) {
-	if (my_tree->root == NULL) {
-		return 0;	// empty tree - return false
-	} else {
-		return bst_search_recursive(my_tree->root, data);
+static void bst_build_task(void *arg, int t) {
+	struct bst_build *b = (struct bst_build *) arg;
+	int i;
+
+	for (i=t; i<b->ntasks; i+=b->p) {
+		bst_build_balanced(b->nodes, b->keys, b->lo[i], b->hi[i], NULL, -1);
 	}
 }
 
 /*
  * Helper function:
- * Recursive insert.
- * Do not insert duplicate values.
- * Return 1 for sucessful insert, 0 for failure.
+ * Merge the sorted, distinct keys a[0..na) and b[0..nb) into 'out',
+ * keeping one of any key in both.
+ * Return the number of keys in 'out'.
  */
-
-int bst_insert_recursive(struct bstnode_s *node, int data) {
-	if (data > node->data) {
-		if (node->right != NULL) { 
-			return bst_insert_recursive(node->right,data) ; // Go right
-		} else {
-			if (! (node->right = (struct bstnode_s *) malloc(sizeof(struct bstnode_s)))) {
-				return 0 ;
-			} else {
-				node->right->data = data ;
-				node->right->left = NULL ;
-				node->right->right = NULL ;
-				return 1 ;
-			}
-		}
-	} else if (data < node->data) {
-		if (node->left != NULL) { 
-			return bst_insert_recursive(node->left,data) ; // Go right
+static size_t bst_merge_unique(const bst_key *a, size_t na, const bst_key *b, size_t nb,
+		bst_key *out) {
+	size_t i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			out[k++] = a[i++];
+		} else if (b[j] < a[i]) {
+			out[k++] = b[j++];
 		} else {
-			if (! (node->left = (struct bstnode_s *) malloc(sizeof(struct bstnode_s)))) {
-				return 0 ;
-			} else {
-				node->left->data = data ;
-				node->left->left = NULL ;
-				node->left->right = NULL ;
-				return 1 ;
-			}
+			out[k++] = a[i++];
+			j++;
 		}
-	} else {
-		return 0 ; // Duplicates
 	}
+	while (i < na) out[k++] = a[i++];
+	while (j < nb) out[k++] = b[j++];
+
+	return k;
 }
 
 /*
  ******************************************************************************
- * Insert a (unique) value into the tree.
- * Do not insert duplicate values.
- * If the tree is empty, it's the new root. Otherwise,
- * do a recursive insert.
- * Return 1 for sucessful insert, 0 for failure.
+ * Insert the 'n' keys, in any order and with any duplicates, using up
+ * to 'nthreads' threads. The keys are sample sorted and deduped in
+ * parallel (see bst_bulk.h), merged with the keys already in the tree,
+ * and the whole tree is rebuilt perfectly balanced, in one block of
+ * nodes, its subtrees built in parallel too - O(n + size) work, where
+ * n calls to bst_insert() would be O(n log n) on one thread. The old
+ * nodes go back to the pool. BST_WIDE trees only get the parallel
+ * sort: the sorted keys are then inserted one at a time. Under
+ * BST_STATS each of the 'n' keys counts as an insert, and each node
+ * built (or, for BST_WIDE, searched) as a visit.
+ * Return 1 on success, 0 if memory runs out (the tree is then
+ * unchanged, except that a BST_WIDE tree may hold some of the keys).
  ******************************************************************************
  */
-int bst_insert(bst *my_tree, int data) {
-	struct bstnode_s *node;
-
-	// empty tree?
-	if (my_tree->root == NULL) {
-		if (! (node=(struct bstnode_s *)malloc(sizeof(struct bstnode_s))) ) return 0; // return fail
-		node->left  = NULL;
-		node->right = NULL;
-		node->data  = data;
+int bst_insert_bulk(bst *my_tree, const bst_key *keys, size_t n, int nthreads) {
+	struct bst_build build;
+	struct bstnode_s *nodes, *node, *next;
+	bst_key *sorted, *old = NULL, *merged = NULL;
+	size_t unique, i;
+	int levels;
+
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > BST_BULK_MAX_THREADS) nthreads = BST_BULK_MAX_THREADS;
+
+	if (! (sorted = (bst_key *) malloc((n ? n : 1) * sizeof(bst_key)))) return 0;
+	if ((unique = bst_sort_unique(keys, sorted, n, nthreads)) == (size_t) -1) {
+		free(sorted);
+		return 0;
+	}
 
-		my_tree->root = node;
-		my_tree->size = 1;
+	bst_write_lock(my_tree);
 
+	if (my_tree->type == BST_WIDE) {
+		for (i=0; i<unique; i++) {
+			// fails for a duplicate - or out of memory, if the key isn't there
+			if (! bst_wide_insert(my_tree, sorted[i]) && ! bst_wide_search(my_tree, sorted[i])) {
+				bst_unlock(my_tree);
+				free(sorted);
+				return 0;
+			}
+		}
+		// the duplicates the sort dropped, which bst_wide_insert() never saw
+		BST_COUNT(my_tree, inserts, n - unique);
+		bst_unlock(my_tree);
+		free(sorted);
 		return 1;
-	} else {
-		if (bst_insert_recursive(my_tree->root, data)) {
-			my_tree->size++;
-			return 1;
-		} else {
+	}
+
+	// merge in the keys already there
+	if (my_tree->size > 0) {
+		old = (bst_key *) malloc(my_tree->size * sizeof(bst_key));
+		merged = (bst_key *) malloc((unique + my_tree->size) * sizeof(bst_key));
+		if (old == NULL || merged == NULL) {
+			bst_unlock(my_tree);
+			free(old);
+			free(merged);
+			free(sorted);
 			return 0;
 		}
+		bst_inorder_toarray_unlocked(my_tree, old);
+		unique = bst_merge_unique(old, my_tree->size, sorted, unique, merged);
+		free(old);
+		free(sorted);
+		sorted = merged;
+	}
+
+	if (unique == 0 || ! (nodes = (struct bstnode_s *) bst_pool_alloc_block(&my_tree->pool, unique))) {
+		bst_unlock(my_tree);
+		free(sorted);
+		return unique == 0;
+	}
+
+	// enough subtrees to keep every thread busy, unless the tree is small
+	build.nodes = nodes;
+	build.keys = sorted;
+	build.p = (unique < 65536) ? 1 : nthreads;
+	build.ntasks = 0;
+	for (levels=0; (1 << levels) < 4 * build.p && levels < BST_BULK_MAX_LEVELS; levels++);
+	if (build.p == 1) levels = 0;
+	bst_build_ranges(&build, 0, unique, levels);
+	bst_bulk_run(build.p, bst_build_task, &build);
+
+	// the old nodes go back to the pool - a node's links outlive freeing it
+	for (node = my_tree->root ? bst_min_node(my_tree->root) : NULL; node != NULL; node = next) {
+		next = bst_next_node(node);
+		bst_pool_free(&my_tree->pool, node);
 	}
+
+	my_tree->root = bst_build_balanced(nodes, sorted, 0, unique, NULL, levels);
+	my_tree->size = unique;
+	BST_COUNT(my_tree, inserts, n);
+	BST_COUNT(my_tree, insert_visits, unique);
+
+	bst_unlock(my_tree);
+	free(sorted);
+	return 1;
 }
 
+
 /*
- * Helper function:
- * Traverse the tree in-order (left, root, right).
- * Append each value to the string 'str'.
- * Assumes that the string has been allocated and has enough
- * space to hold all the values.
+ ******************************************************************************
+ * Destroy the binary search tree cleanly, freeing all memory.
+ * If the tree is empty, then nothing to do. Otherwise
+ * free the node pool, then the tree. The nodes are never visited:
+ * the pool releases them a whole chunk at a time.
+ ******************************************************************************
  */
-void bst_inorder_tostring_recursive(struct bstnode_s *node, char *str) {
-	char buf[10];
-
-	if (node == NULL) {
+void bst_destroy(bst *my_tree) {
+	if (my_tree == NULL) {
+		// nothing to do!
 		return;
-	} else {
-		bst_inorder_tostring_recursive(node->left, str);
+	}
 
-		sprintf(buf, "%d ", node->data);
-		strcat(str, buf);
+	// free the nodes
+	bst_pool_destroy(&my_tree->pool);
 
-		bst_inorder_tostring_recursive(node->right, str);
+	if (my_tree->flags & BST_THREADSAFE) {
+		pthread_rwlock_destroy(&my_tree->lock);
 	}
+
+	// and finally the binary search tree struct itself
+	free(my_tree);
 }
 
 
 /*
  ******************************************************************************
- * Traverse the tree in-order (left, root, right).
- * Append each value to the string 'str'.
- * Assumes that the string has been allocated and has enough
- * space to hold all the values.
+ * Return the current size.
  ******************************************************************************
  */
-void bst_inorder_tostring(bst *my_tree, char *str) {
-	char buf[10];
 
-	// initialise the string (assumes it has already been allocated)
-	*str = '\0';
+size_t bst_size(bst *my_tree) {
+	size_t size;
 
-	// empty tree?
-	if (my_tree->root == NULL) {
-		return;
-	} else {
-		bst_inorder_tostring_recursive(my_tree->root->left, str);
+	bst_read_lock(my_tree);
+	size = my_tree->size;
+	bst_unlock(my_tree);
+
+	return size;
+}
 
-		sprintf(buf, "%d ", my_tree->root->data);
-		strcat(str, buf);
 
-		bst_inorder_tostring_recursive(my_tree->root->right, str);
+/*
+ * Helper function:
+ * Walk a binary tree in order, keeping track of the depth of each node
+ * on the way, to sum the depths of the keys and find the deepest.
+ * O(n) time and O(1) space, however unbalanced the tree.
+ */
+static void bst_depths(struct bstnode_s *node, double *sum, int *max) {
+	int depth = 1;
+
+	*sum = 0;
+	*max = 0;
+	if (node == NULL) return;
+
+	while (node->left) node = node->left, depth++;
+	for (;;) {
+		*sum += depth;
+		if (depth > *max) *max = depth;
+
+		if (node->right) {
+			// the successor is the leftmost node of the right subtree
+			node = node->right, depth++;
+			while (node->left) node = node->left, depth++;
+		} else {
+			// climb out of right subtrees, then once more
+			while (node->parent && node == node->parent->right) node = node->parent, depth--;
+			if (! (node = node->parent)) return;
+			depth--;
+		}
 	}
 }
 
 /*
- * Helper function:
- * Traverse the tree pre-order (root, left, right).
- * Append each value to the string 'str'.
- * Assumes that the string has been allocated and has enough
- * space to hold all the values.
+ ******************************************************************************
+ * Fill in 'out' with the shape of the tree (walked in O(n) time), the
+ * memory it uses and, in a -DBST_STATS build, the operation counters
+ * since it was created - which only ever go up, for a metrics system
+ * to take the differences of.
+ ******************************************************************************
  */
+void bst_stats(bst *my_tree, bst_stats_t *out) {
+	double sum;
+	size_t fit;
+	int fanout;
 
-void bst_preorder_tostring_recursive(struct bstnode_s *node, char *str) {
-	char buf[10];
+	memset(out, 0, sizeof(bst_stats_t));
 
-	if (node == NULL) {
-		return;
+	bst_read_lock(my_tree);
+
+	out->size = my_tree->size;
+	if (my_tree->type == BST_WIDE) {
+		bst_wide_stats(my_tree, out);
+		fanout = BST_WIDE_MAX_KEYS + 1;
 	} else {
-		sprintf(buf, "%d ", node->data);
-		strcat(str, buf);
+		bst_depths(my_tree->root, &sum, &out->height);
+		out->avg_depth = out->size ? sum / out->size : 0;
+		out->nodes = out->size;
+		fanout = 2;
+	}
 
-		bst_preorder_tostring_recursive(node->left, str);
-		bst_preorder_tostring_recursive(node->right, str);
+	// a tree of height h holds up to fanout^h - 1 keys
+	for (fit = 0; fit < out->size; fit = fit * fanout + fanout - 1) {
+		out->min_height++;
 	}
+
+	out->node_bytes = out->nodes * my_tree->pool.node_size;
+	out->pool_chunks = my_tree->pool.nchunks;
+	out->pool_bytes = my_tree->pool.bytes;
+
+#ifdef BST_STATS
+	out->counting = 1;
+	out->ops.inserts = __atomic_load_n(&my_tree->counters.inserts, __ATOMIC_RELAXED);
+	out->ops.insert_visits = __atomic_load_n(&my_tree->counters.insert_visits, __ATOMIC_RELAXED);
+	out->ops.searches = __atomic_load_n(&my_tree->counters.searches, __ATOMIC_RELAXED);
+	out->ops.search_visits = __atomic_load_n(&my_tree->counters.search_visits, __ATOMIC_RELAXED);
+	out->ops.removes = __atomic_load_n(&my_tree->counters.removes, __ATOMIC_RELAXED);
+	out->ops.remove_visits = __atomic_load_n(&my_tree->counters.remove_visits, __ATOMIC_RELAXED);
+	out->ops.rotations = __atomic_load_n(&my_tree->counters.rotations, __ATOMIC_RELAXED);
+#endif
+
+	bst_unlock(my_tree);
 }
 
 
 /*
  ******************************************************************************
- * Traverse the tree pre-order (root, left, right).
- * Append each value to the string 'str'.
- * Assumes that the string has been allocated and has enough
- * space to hold all the values.
+ * Lock the tree for reading (shared with other readers) or for
+ * writing (exclusive). Does nothing unless it was created with
+ * BST_THREADSAFE.
+ * Every bst_* function on a tree takes the lock it needs around an
+ * _unlocked version of itself; take it explicitly only to make a
+ * sequence of calls to _unlocked functions atomic. The lock is not
+ * recursive.
  ******************************************************************************
  */
-void bst_preorder_tostring(bst *my_tree, char *str) {
-	char buf[10];
-
-	// initialise the string (assumes it has already been allocated)
-	*str = '\0';
+void bst_read_lock(bst *my_tree) {
+	if (my_tree->flags & BST_THREADSAFE) pthread_rwlock_rdlock(&my_tree->lock);
+}
 
-	// empty tree?
-	if (my_tree->root == NULL) {
-		return;
-	} else {
-		sprintf(buf, "%d ", my_tree->root->data);
-		strcat(str, buf);
+void bst_write_lock(bst *my_tree) {
+	if (my_tree->flags & BST_THREADSAFE) pthread_rwlock_wrlock(&my_tree->lock);
+}
 
-		bst_preorder_tostring_recursive(my_tree->root->left, str);
-		bst_preorder_tostring_recursive(my_tree->root->right, str);
-	}
+void bst_unlock(bst *my_tree) {
+	if (my_tree->flags & BST_THREADSAFE) pthread_rwlock_unlock(&my_tree->lock);
 }
 
 
 /*
  ******************************************************************************
- * Print the tree to stdout.
- * Use the bst_inorder_tostring() to traverse the tree
- * in-order and print the resultant string
- * to stdout.
+ * Search for a value - binary search.
+ * Walks down from the root in a loop, so the stack usage does
+ * not depend on the depth of the tree. A splay tree then splays the
+ * node found - or the last one looked at - up towards the root.
+ * Return 1 for sucessful search, 0 for failure.
  ******************************************************************************
  */
-void bst_display(bst *my_tree) {
-	/* temp string for display */
-	char *str = NULL;
 
-	// malloc 4 chars per entry (' 100'), and enough for twice the current size
-	str = (char *) malloc(bst_size(my_tree) * 2 * 4 * sizeof(char));
+static int bst_search_unlocked(bst *my_tree, bst_key data) {
+	struct bstnode_s *node = my_tree->root, *last = NULL;
+	size_t visits = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_search(my_tree, data);
+	}
 
-	bst_inorder_tostring(my_tree, str);
+	BST_COUNT(my_tree, searches, 1);
+	while (node != NULL) {
+		visits++;
+		last = node;
+		if (data > node->data) {
+			node = node->right;	// Go right
+		} else if (data < node->data) {
+			node = node->left;	// Go left
+		} else {
+			break;	// Found the value
+		}
+	}
+	BST_COUNT(my_tree, search_visits, visits);
 
-	printf("BST contains: %s\n", str);
+	if (my_tree->type == BST_SPLAY && last != NULL) {
+		bst_splay(my_tree, last);
+	}
 
-	free(str);
+	return node != NULL;	// NULL if we fell off the tree (or it was empty)
 }
 
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_find_min_recur
- *    Arguments:  struct bstnode_s * node - Node to check for min.
- *      Returns:  Minimum value.
- *  Description:  Recursively searchs tree for minimum value.
- * =====================================================================================
+/*
+ * bst_search_unlocked(), under the read lock - or the write lock for a
+ * splay tree, which a search changes
  */
+int bst_search(bst *my_tree, bst_key data) {
+	int found;
 
-int bst_find_min_recur(struct bstnode_s * node) {
-	if (node->left != NULL) {
-		return bst_find_min_recur(node->left) ;
+	if (my_tree->type == BST_SPLAY) {
+		bst_write_lock(my_tree);
 	} else {
-		return node->data ;
+		bst_read_lock(my_tree);
 	}
-}		/* -----  end of function bst_find_min_recur  ----- */
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_find_min
- *    Arguments:  bst * tree - The tree of which we're finding the minimum.
- *      Returns:  Minimum value present in binary tree. Default return value of 0.
- *  Description:  Finds the minimum value present in the tree.
- * =====================================================================================
- */
+	found = bst_search_unlocked(my_tree, data);
+	bst_unlock(my_tree);
 
-int bst_find_min(bst * tree) {
-	if (tree == NULL) {
-		return 0 ;
-	} else {
-		if (tree->root == NULL) {
-			return 0 ;
-		} else {
-			return bst_find_min_recur(tree->root) ;
+	return found;
+}
+
+/*
+ ******************************************************************************
+ * Search for 'n' values at once.
+ * Up to BST_BATCH_LANES lookups walk down the tree in lockstep, each
+ * taking one step per round and prefetching the child it moves to.
+ * By the time a lookup comes round again its node has (hopefully)
+ * arrived in cache, so the cache misses of all the lanes overlap
+ * instead of being paid one after another. A finished lane starts
+ * the next lookup straight away. BST_WIDE trees are only a few nodes
+ * deep, and are searched one lookup at a time. A BST_SPLAY tree is
+ * not splayed - a batch leaves it as it was, under the read lock.
+ * found_out[i] is set to 1 if keys[i] is in the tree, 0 if not;
+ * found_out may be NULL if only the count is wanted.
+ * Return the number of values found.
+ ******************************************************************************
+ */
+static size_t bst_search_batch_unlocked(bst *my_tree, const bst_key *keys, size_t n, uint8_t *found_out) {
+	struct bstnode_s *root = my_tree->root;
+	struct bstnode_s *node[BST_BATCH_LANES];
+	size_t slot[BST_BATCH_LANES];	// which key each lane is looking up
+	size_t next = 0, hits = 0, visits = 0;
+	int lanes, l;
+
+	if (my_tree->type == BST_WIDE) {
+		for (next = 0; next < n; next++) {
+			int found = bst_wide_search(my_tree, keys[next]);
+			if (found_out) found_out[next] = found;
+			hits += found;
 		}
+		return hits;
 	}
-}		/* -----  end of function bst_find_min  ----- */
 
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_find_max_recur
- *    Arguments:  struct bstnode_s * node - Node to check for max.
- *      Returns:  Maximum value.
- *  Description:  Recursively searchs tree for maximum value.
- * =====================================================================================
- */
+	BST_COUNT(my_tree, searches, n);
 
-int bst_find_max_recur(struct bstnode_s * node) {
-	if (node->right != NULL) {
-		return bst_find_max_recur(node->right) ;
-	} else {
-		return node->data ;
+	// start the first group of lookups at the root
+	for (lanes = 0; lanes < BST_BATCH_LANES && next < n; lanes++) {
+		node[lanes] = root;
+		slot[lanes] = next++;
 	}
-}		/* -----  end of function bst_find_max_recur  ----- */
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_find_max
- *    Arguments:  bst * tree - The tree of which we're finding the maximum.
- *      Returns:  Maximum value present in binary tree. Default return value of 0.
- *  Description:  Finds the maximum value present in the tree.
- * =====================================================================================
- */
 
-int bst_find_max(bst * tree) {
-	if (tree == NULL) {
-		return 0 ;
-	} else {
-		if (tree->root == NULL) {
-			return 0 ;
-		} else {
-			return bst_find_max_recur(tree->root) ;
-		}
-	}
-}		/* -----  end of function bst_find_max  ----- */
+	while (lanes > 0) {
+		for (l = 0; l < lanes; ) {
+			struct bstnode_s *x = node[l];
+			bst_key data = keys[slot[l]];
 
-enum {
-	FAILURE,
-	SUCCESS,
-	NO_CHILDREN,
-	ONE_CHILD,
-} ;
+			visits += (x != NULL);
 
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_remove_recur
- *    Arguments:  struct bstnode_s * node - Node to check for removal.
- *                int data - Data to remove.
- *      Returns:  Integer representing removal event. 0 if failure.
- *  Description:  Traverses the tree until the function finds the data to be removed.
- *                Depending on the number of children the node has the function performs
- *                slightly different removes.
- * =====================================================================================
- */
+			// one step down for this lane
+			if (x != NULL && data != x->data) {
+				x = (data > x->data) ? x->right : x->left;
+				__builtin_prefetch(x);
+				node[l] = x;
+				l++;
+				continue;
+			}
 
-int bst_remove_recur(struct bstnode_s * node, int data) {
-	// Go right
-	if (data > node->data) {
-		if (node->right != NULL) {
-			// Remove behaviour based on state of child node. 
-			int returnState = bst_remove_recur(node->right,data) ;
-			if (returnState == NO_CHILDREN) {
-				free(node->right) ;
-				node->right = NULL ;
-				return SUCCESS ;
-			} else if (returnState == ONE_CHILD) {
-				struct bstnode_s * temp = node->right ;
-				if (temp->right != NULL) {
-					node->right = temp->right ;
-				} else {
-					node->right = temp->left ;
-				}
-				free(temp) ;
-				return SUCCESS ;
-			} 
-			return returnState ;
-		}
-		else {
-			return FAILURE ;
-		}
-	} 
-	// Go left.
-	else if (data < node->data) {
-		if (node->left != NULL) {
-			// Remove behaviour based on state of child node. 
-			int returnState = bst_remove_recur(node->left,data) ;
-			if (returnState == NO_CHILDREN) {
-				free(node->left) ;
-				node->left = NULL ;
-				return SUCCESS ;
-			} else if (returnState == ONE_CHILD) {
-				struct bstnode_s * temp = node->left ;
-				if (temp->right != NULL) {
-					node->left = temp->right ;
-				} else {
-					node->left = temp->left ;
-				}
-				free(temp) ;
-				return SUCCESS ;
-			} 
-			return returnState ;
-		}
-		else {
-			return FAILURE ;
-		}
-	} 
-	// Data found.
-	else {
-		if (node->left == NULL) {
-			if (node->right == NULL) {
-				return NO_CHILDREN ;
+			// found (or fell off the tree) - record it
+			if (found_out) found_out[slot[l]] = (x != NULL);
+			hits += (x != NULL);
+
+			if (next < n) {
+				// reuse the lane for the next lookup
+				node[l] = root;
+				slot[l] = next++;
+				l++;
 			} else {
-				return ONE_CHILD ;
-			}
-		} else if (node->right == NULL) {
-				return ONE_CHILD ;
-		} 
-		// Has two children.
-		else {
-			int newVal = bst_find_min_recur(node->right) ;
-			node->data = newVal ;
-			// Handles case if right node has no children.
-			if (bst_remove_recur(node->right, newVal) == NO_CHILDREN) {
-				free(node->right) ;
-				node->right = NULL ;
+				// no more lookups - retire the lane
+				lanes--;
+				node[l] = node[lanes];
+				slot[l] = slot[lanes];
 			}
-			return SUCCESS ;
 		}
 	}
-}		/* -----  end of function bst_remove_recur  ----- */
 
-/* 
- * ===  FUNCTION  ======================================================================
- *         Name:  bst_remove
- *    Arguments:  bst * tree - The tree from which we're removing the data.
- *                int data - Data to remove.
- *      Returns:  1 if sucessful, 0 otherwise
- *  Description:  Traverses the binary tree and removes the node containing data, the
- *                function then reconfigures the tree such that it still fulfills the
- *                criteria for being a bst.
- * =====================================================================================
+	BST_COUNT(my_tree, search_visits, visits);
+	return hits;
+}
+
+/* bst_search_batch_unlocked(), under the read lock */
+size_t bst_search_batch(bst *my_tree, const bst_key *keys, size_t n, uint8_t *found_out) {
+	size_t hits;
+
+	bst_read_lock(my_tree);
+	hits = bst_search_batch_unlocked(my_tree, keys, n, found_out);
+	bst_unlock(my_tree);
+
+	return hits;
+}
+
+/*
+ * Helper function:
+ * Replace the child 'old' of 'parent' with 'node' (which may be NULL).
+ * A NULL parent means 'old' is the root of the tree.
  */
+static void bst_replace_child(bst *my_tree, struct bstnode_s *parent,
+		struct bstnode_s *old, struct bstnode_s *node) {
+	if (parent == NULL) {
+		my_tree->root = node;
+	} else if (parent->left == old) {
+		parent->left = node;
+	} else {
+		parent->right = node;
+	}
+}
 
-int bst_remove(bst * tree, int data) {
-	if (tree != NULL) {
-		if (tree->root != NULL) {
-			// Reduce tree size if remove sucessful. //
-			int returnVal = bst_remove_recur(tree->root, data) ;
-			if (returnVal == SUCCESS) {
-				--tree->size ;
-				return SUCCESS ;
-			} else if (returnVal == ONE_CHILD) {
-				if (tree->root->left != NULL) {
-					tree->root->data = tree->root->left->data ;
-					free(tree->root->left) ;
-					tree->root->left = NULL ;
-					return SUCCESS ;
-				} else {
-					tree->root->data = tree->root->right->data ;
-					free(tree->root->right) ;
-					tree->root->right = NULL ;
-					return SUCCESS ;
-				}
-			} else if (returnVal == NO_CHILDREN) {
-				// Delete root if only one element. //
-				free(tree->root) ;
-				--tree->size ;
-				tree->root = NULL ;
-				return SUCCESS ;
-			} else {
-				return FAILURE ;
-			}
-		} else {
-			return FAILURE ;
-		}
+/*
+ * Helper functions:
+ * Subtree counts. Every node stores the number of nodes in its subtree,
+ * so the nodes before a key can be counted on the way down to it (see
+ * bst_range_count()). An insert or remove changes the counts of the
+ * nodes on the path up to the root, and nothing else.
+ */
+static size_t bst_node_count(struct bstnode_s *node) {
+	return node ? node->count : 0;
+}
+
+static void bst_count_path(struct bstnode_s *node, int delta) {
+	for (; node != NULL; node = node->parent) {
+		node->count += delta;
+	}
+}
+
+/*
+ * Helper functions:
+ * AVL bookkeeping - bst_avl_height(), bst_avl_update(), the rotations,
+ * bst_avl_rebalance() and bst_avl_retrace(), from bst_avl_template.h,
+ * which the maps share. A rotation moves subtrees around, so it
+ * recounts the nodes it moves as well.
+ */
+#define BST_AVL_NAME bst_avl
+#define BST_AVL_NODE struct bstnode_s
+#define BST_AVL_TREE bst *
+#define BST_AVL_REPLACE(t, p, o, n) bst_replace_child((t), (p), (o), (n))
+#define BST_AVL_UPDATE(n) ((n)->count = 1 + bst_node_count((n)->left) + bst_node_count((n)->right))
+#define BST_AVL_ROTATED(t) BST_COUNT((t), rotations, 1)
+#include "bst_avl_template.h"
+
+/*
+ * Helper functions:
+ * Splaying. A BST_SPLAY tree keeps no heights, only the subtree counts,
+ * so it has its own rotation: 'node' is turned over its parent, and the
+ * two counts are worked out from the parent's old one and the subtree
+ * that changes sides - the only node off the path that is touched.
+ */
+static void bst_splay_rotate(bst *my_tree, struct bstnode_s *node) {
+	struct bstnode_s *parent = node->parent, *moved;
+	size_t total = parent->count;
+
+	BST_COUNT(my_tree, rotations, 1);
+	if (node == parent->left) {
+		moved = node->right;
+		parent->left = moved;
+		node->right = parent;
 	} else {
-		return FAILURE ;
+		moved = node->left;
+		parent->right = moved;
+		node->left = parent;
 	}
-}		/* -----  end of function bst_remove  ----- */
+	if (moved) moved->parent = parent;
 
+	node->parent = parent->parent;
+	bst_replace_child(my_tree, parent->parent, parent, node);
+	parent->parent = node;
 
+	parent->count = total - node->count + bst_node_count(moved);
+	node->count = total;
+}
+
+/*
+ * Semi-splay 'node' up to the root, two levels at a time (Sleator and
+ * Tarjan, "Self-Adjusting Binary Search Trees", 1985): on the same side
+ * of its parent as the parent is of the grandparent (zig-zig), only the
+ * parent is rotated up, and the splaying carries on from the parent;
+ * otherwise (zig-zag) the node is rotated up twice. A last single
+ * rotation (zig) finishes at the root. Every node on the path ends up
+ * about half as deep, so keys that are used often stay near the top - a
+ * skewed stream of accesses costs O(log(1/p)) amortised for a key used
+ * with probability p, rather than the depth it was put at. Full
+ * splaying would bring 'node' itself to the root, but takes about half
+ * as many rotations again, and each one writes to a subtree off the
+ * path, which is seldom in cache.
+ */
+static void bst_splay(bst *my_tree, struct bstnode_s *node) {
+	struct bstnode_s *parent, *grand;
+
+	while ((parent = node->parent) != NULL) {
+		grand = parent->parent;
+		if (grand == NULL) {
+			bst_splay_rotate(my_tree, node);	// zig
+		} else if ((node == parent->left) == (parent == grand->left)) {
+			bst_splay_rotate(my_tree, parent);	// zig-zig
+			node = parent;
+		} else {
+			bst_splay_rotate(my_tree, node);	// zig-zag
+			bst_splay_rotate(my_tree, node);
+		}
+	}
+}
+
+/*
+ ******************************************************************************
+ * Insert a (unique) value into the tree.
+ * Do not insert duplicate values.
+ * Walk down to the empty child where the value belongs and hang
+ * a new node there; for an AVL tree, then rebalance back up, and for
+ * a splay tree, splay it (or the duplicate found) up to the root.
+ * Return 1 for sucessful insert, 0 for failure.
+ ******************************************************************************
+ */
+static int bst_insert_unlocked(bst *my_tree, bst_key data) {
+	struct bstnode_s *node, *parent = NULL;
+	struct bstnode_s **link = &my_tree->root;
+	size_t visits = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_insert(my_tree, data);
+	}
+
+	// find the empty link where the value belongs
+	while (*link != NULL) {
+		parent = *link;
+		visits++;
+		if (data > parent->data) {
+			link = &parent->right;	// Go right
+		} else if (data < parent->data) {
+			link = &parent->left;	// Go left
+		} else {
+			break;	// Duplicates
+		}
+	}
+	BST_COUNT(my_tree, inserts, 1);
+	BST_COUNT(my_tree, insert_visits, visits);
+	if (*link != NULL) {
+		if (my_tree->type == BST_SPLAY) bst_splay(my_tree, *link);
+		return 0;
+	}
+
+	if (! (node=(struct bstnode_s *)bst_pool_alloc(&my_tree->pool)) ) return 0; // return fail
+	node->left   = NULL;
+	node->right  = NULL;
+	node->parent = parent;
+	node->data   = data;
+	node->height = 1;
+	node->count  = 1;
+
+	*link = node;
+	my_tree->size++;
+	bst_count_path(parent, 1);
+
+	if (my_tree->type == BST_AVL) {
+		bst_avl_retrace(my_tree, parent);
+	} else if (my_tree->type == BST_SPLAY) {
+		bst_splay(my_tree, node);
+	}
+
+	return 1;
+}
+
+/* bst_insert_unlocked(), under the write lock */
+int bst_insert(bst *my_tree, bst_key data) {
+	int inserted;
+
+	bst_write_lock(my_tree);
+	inserted = bst_insert_unlocked(my_tree, data);
+	bst_unlock(my_tree);
+
+	return inserted;
+}
+
+
+/*
+ ******************************************************************************
+ * Traverse the tree in-order (left, root, right).
+ * Append each value, and a space, to the writer 'w'. Steps from
+ * node to successor through the parent pointers, and appends at the
+ * writer's cursor, so it takes time linear in the size of the tree.
+ ******************************************************************************
+ */
+static void bst_inorder_write_unlocked(bst *my_tree, bst_writer *w) {
+	struct bstnode_s *node;
+
+	if (my_tree->type == BST_WIDE) {
+		bst_wide_inorder_write(my_tree, w);
+		return;
+	}
+
+	// empty tree?
+	if (my_tree->root == NULL) {
+		return;
+	}
+
+	for (node = bst_min_node(my_tree->root); node != NULL; node = bst_next_node(node)) {
+		bst_writer_int(w, node->data);
+	}
+}
+
+/* bst_inorder_write_unlocked(), under the read lock */
+void bst_inorder_write(bst *my_tree, bst_writer *w) {
+	bst_read_lock(my_tree);
+	bst_inorder_write_unlocked(my_tree, w);
+	bst_unlock(my_tree);
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree in-order (left, root, right).
+ * Write the values into 'str', which has room for 'cap' bytes
+ * including the '\0'. Output that doesn't fit is dropped.
+ * Return the length of the whole output, as snprintf() does: the
+ * string is complete if this is less than 'cap'.
+ ******************************************************************************
+ */
+size_t bst_inorder_tostring_n(bst *my_tree, char *str, size_t cap) {
+	bst_writer w;
+
+	bst_writer_init_buf(&w, str, cap);
+	bst_inorder_write(my_tree, &w);
+
+	return w.total;
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree in-order (left, root, right).
+ * Append each value to the string 'str'.
+ * Assumes that the string has been allocated and has enough
+ * space to hold all the values - see bst_inorder_tostring_n().
+ ******************************************************************************
+ */
+void bst_inorder_tostring(bst *my_tree, char *str) {
+	bst_inorder_tostring_n(my_tree, str, SIZE_MAX);
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree in-order (left, root, right).
+ * Store each value in the array 'arr', which produces a sorted array.
+ * Assumes that the array has been allocated and has room for
+ * bst_size() values. Steps from node to successor through the
+ * parent pointers, so uses no recursion.
+ ******************************************************************************
+ */
+void bst_inorder_toarray_unlocked(bst *my_tree, bst_key *arr) {
+	struct bstnode_s *node;
+
+	if (my_tree->type == BST_WIDE) {
+		bst_wide_inorder_toarray(my_tree, arr);
+		return;
+	}
+
+	// empty tree?
+	if (my_tree->root == NULL) {
+		return;
+	}
+
+	for (node = bst_min_node(my_tree->root); node != NULL; node = bst_next_node(node)) {
+		*arr++ = node->data;
+	}
+}
+
+/* bst_inorder_toarray_unlocked(), under the read lock */
+void bst_inorder_toarray(bst *my_tree, bst_key *arr) {
+	bst_read_lock(my_tree);
+	bst_inorder_toarray_unlocked(my_tree, arr);
+	bst_unlock(my_tree);
+}
+
+/*
+ * Helper function:
+ * Return the node after 'node' in pre-order: its first child, or
+ * else the right child of the nearest ancestor that it is to the
+ * left of. NULL after the last node.
+ */
+static struct bstnode_s *bst_preorder_next(struct bstnode_s *node) {
+	if (node->left != NULL) return node->left;
+	if (node->right != NULL) return node->right;
+
+	while (node->parent != NULL) {
+		if (node == node->parent->left && node->parent->right != NULL) {
+			return node->parent->right;
+		}
+		node = node->parent;
+	}
+	return NULL;
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree pre-order (root, left, right).
+ * Append each value, and a space, to the writer 'w'. Walks the
+ * parent pointers, so uses no recursion, in linear time.
+ ******************************************************************************
+ */
+static void bst_preorder_write_unlocked(bst *my_tree, bst_writer *w) {
+	struct bstnode_s *node;
+
+	if (my_tree->type == BST_WIDE) {
+		bst_wide_preorder_write(my_tree, w);
+		return;
+	}
+
+	for (node = my_tree->root; node != NULL; node = bst_preorder_next(node)) {
+		bst_writer_int(w, node->data);
+	}
+}
+
+/* bst_preorder_write_unlocked(), under the read lock */
+void bst_preorder_write(bst *my_tree, bst_writer *w) {
+	bst_read_lock(my_tree);
+	bst_preorder_write_unlocked(my_tree, w);
+	bst_unlock(my_tree);
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree pre-order (root, left, right), writing at most
+ * 'cap' bytes into 'str' as bst_inorder_tostring_n() does.
+ * Return the length of the whole output.
+ ******************************************************************************
+ */
+size_t bst_preorder_tostring_n(bst *my_tree, char *str, size_t cap) {
+	bst_writer w;
+
+	bst_writer_init_buf(&w, str, cap);
+	bst_preorder_write(my_tree, &w);
+
+	return w.total;
+}
+
+/*
+ ******************************************************************************
+ * Traverse the tree pre-order (root, left, right).
+ * Append each value to the string 'str'.
+ * Assumes that the string has been allocated and has enough
+ * space to hold all the values - see bst_preorder_tostring_n().
+ ******************************************************************************
+ */
+void bst_preorder_tostring(bst *my_tree, char *str) {
+	bst_preorder_tostring_n(my_tree, str, SIZE_MAX);
+}
+
+
+/*
+ ******************************************************************************
+ * Print the tree to stdout.
+ * Traverse the tree in-order, streaming the values straight
+ * to stdout a chunk at a time, so no string the size of the
+ * tree is needed.
+ ******************************************************************************
+ */
+void bst_display(bst *my_tree) {
+	bst_writer w;
+
+	bst_writer_init_file(&w, stdout);
+	bst_writer_str(&w, "BST contains: ");
+	bst_inorder_write(my_tree, &w);
+	bst_writer_str(&w, "\n");
+	bst_writer_finish(&w);
+}
+
+
+/*
+ * Helper function:
+ * Return the node holding the smallest key >= 'key' in the subtree
+ * under 'node', or NULL if every key there is smaller.
+ */
+static struct bstnode_s *bst_lower_bound_node(struct bstnode_s *node, bst_key key) {
+	struct bstnode_s *bound = NULL;
+
+	while (node != NULL) {
+		if (node->data >= key) {
+			bound = node;	// a candidate - look for a smaller one
+			node = node->left;
+		} else {
+			node = node->right;
+		}
+	}
+	return bound;
+}
+
+/*
+ * Helper function:
+ * Count the keys in the tree that are less than 'key' (or equal to it
+ * too, if 'inclusive' is set): on the way down, every step right passes
+ * over a node and its whole left subtree.
+ */
+static size_t bst_count_below(bst *my_tree, bst_key key, int inclusive) {
+	struct bstnode_s *node = my_tree->root;
+	size_t below = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_count_below(my_tree, key, inclusive);
+	}
+
+	while (node != NULL) {
+		if (node->data < key || (inclusive && node->data == key)) {
+			below += bst_node_count(node->left) + 1;
+			node = node->right;
+		} else {
+			node = node->left;
+		}
+	}
+	return below;
+}
+
+/*
+ ******************************************************************************
+ * Call 'visit' with each key in [lo, hi], in ascending order. Finds
+ * the first key >= lo and steps through successors from there, so it
+ * visits O(log n + k) nodes for k keys in the range. The tree is read
+ * locked while 'visit' runs, which must not change it. 'visit' may be
+ * NULL, to just count the keys.
+ * Return the number of keys in the range.
+ ******************************************************************************
+ */
+static size_t bst_range_foreach_unlocked(bst *my_tree, bst_key lo, bst_key hi,
+		bst_visit visit, void *ctx) {
+	struct bstnode_s *node;
+	size_t k = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_range_foreach(my_tree, lo, hi, visit, ctx);
+	}
+
+	for (node = bst_lower_bound_node(my_tree->root, lo);
+			node != NULL && node->data <= hi; node = bst_next_node(node)) {
+		if (visit) visit(node->data, ctx);
+		k++;
+	}
+	return k;
+}
+
+/* bst_range_foreach_unlocked(), under the read lock */
+size_t bst_range_foreach(bst *my_tree, bst_key lo, bst_key hi, bst_visit visit, void *ctx) {
+	size_t k;
+
+	bst_read_lock(my_tree);
+	k = bst_range_foreach_unlocked(my_tree, lo, hi, visit, ctx);
+	bst_unlock(my_tree);
+
+	return k;
+}
+
+/*
+ ******************************************************************************
+ * Count the keys in [lo, hi] in O(log n), from the subtree counts:
+ * the keys <= hi less the keys < lo.
+ * Return the number of keys in the range (0 if lo > hi).
+ ******************************************************************************
+ */
+static size_t bst_range_count_unlocked(bst *my_tree, bst_key lo, bst_key hi) {
+	if (lo > hi) {
+		return 0;
+	}
+
+	return bst_count_below(my_tree, hi, 1) - bst_count_below(my_tree, lo, 0);
+}
+
+/* bst_range_count_unlocked(), under the read lock */
+size_t bst_range_count(bst *my_tree, bst_key lo, bst_key hi) {
+	size_t k;
+
+	bst_read_lock(my_tree);
+	k = bst_range_count_unlocked(my_tree, lo, hi);
+	bst_unlock(my_tree);
+
+	return k;
+}
+
+/*
+ * Helper function:
+ * The bst_visit behind bst_range_to_array() for BST_WIDE trees: store
+ * keys while there is room in the array, and count the rest.
+ */
+struct bst_range_array {
+	bst_key *out;
+	size_t cap, n;
+};
+
+static void bst_range_store(bst_key key, void *ctx) {
+	struct bst_range_array *arr = (struct bst_range_array *) ctx;
+
+	if (arr->n < arr->cap) arr->out[arr->n] = key;
+	arr->n++;
+}
+
+/*
+ ******************************************************************************
+ * Store the keys in [lo, hi], in ascending order, in the array 'out',
+ * which has room for 'cap' keys. Keys that don't fit are dropped.
+ * Return the number of keys in the whole range, as bst_range_count()
+ * does: the array holds all of them if this is no more than 'cap'.
+ ******************************************************************************
+ */
+size_t bst_range_to_array(bst *my_tree, bst_key lo, bst_key hi, bst_key *out, size_t cap) {
+	struct bst_range_array arr = {out, cap, 0};
+	struct bstnode_s *node;
+	size_t k = 0;
+
+	bst_read_lock(my_tree);
+	if (my_tree->type == BST_WIDE) {
+		k = bst_wide_range_foreach(my_tree, lo, hi, bst_range_store, &arr);
+	} else {
+		for (node = bst_lower_bound_node(my_tree->root, lo);
+				node != NULL && node->data <= hi && k < cap; node = bst_next_node(node)) {
+			out[k++] = node->data;
+		}
+		// the array is full - count the rest without walking it
+		if (k == cap) k = bst_range_count_unlocked(my_tree, lo, hi);
+	}
+	bst_unlock(my_tree);
+
+	return k;
+}
+
+/*
+ ******************************************************************************
+ * Return the rank of 'key': the number of keys in the tree less than
+ * it, which for a key in the tree is its position in sorted order
+ * (counting from 0). Takes O(log n), from the subtree counts.
+ ******************************************************************************
+ */
+size_t bst_rank(bst *my_tree, bst_key key) {
+	size_t rank;
+
+	bst_read_lock(my_tree);
+	rank = bst_count_below(my_tree, key, 0);
+	bst_unlock(my_tree);
+
+	return rank;
+}
+
+/*
+ * Helper function:
+ * Return the k'th smallest key (counting from 0): on the way down,
+ * step left if the left subtree holds more than k keys, or else skip
+ * it and the node and step right. Default return value of 0 if there
+ * is no such key.
+ */
+static bst_key bst_select_unlocked(bst *my_tree, size_t k) {
+	struct bstnode_s *node = my_tree->root;
+	size_t left;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_select(my_tree, k);
+	}
+	if (k >= my_tree->size) {
+		return 0;
+	}
+
+	for (;;) {
+		left = bst_node_count(node->left);
+		if (k < left) {
+			node = node->left;
+		} else if (k == left) {
+			return node->data;
+		} else {
+			k -= left + 1;
+			node = node->right;
+		}
+	}
+}
+
+/*
+ ******************************************************************************
+ * Return the k'th smallest key (counting from 0), in O(log n), so that
+ * bst_select(my_tree, bst_size(my_tree) / 2) is the median.
+ * Default return value of 0 if k >= bst_size().
+ ******************************************************************************
+ */
+bst_key bst_select(bst *my_tree, size_t k) {
+	bst_key key;
+
+	bst_read_lock(my_tree);
+	key = bst_select_unlocked(my_tree, k);
+	bst_unlock(my_tree);
+
+	return key;
+}
+
+/*
+ ******************************************************************************
+ * Return the p'th percentile (0 <= p <= 100) of the keys, by the
+ * nearest-rank method: the smallest key with at least p% of the keys
+ * less than or equal to it. So p = 50 is the (lower) median, and p = 0
+ * the minimum. Default return value of 0 for an empty tree, or for a
+ * 'p' outside [0, 100] - NaN and the infinities included.
+ ******************************************************************************
+ */
+bst_key bst_percentile(bst *my_tree, double p) {
+	double rank;
+	size_t k;
+	bst_key key;
+
+	if (! (p >= 0.0 && p <= 100.0)) {
+		return 0;	// false for NaN too, which would make the cast undefined
+	}
+
+	bst_read_lock(my_tree);
+	rank = p / 100.0 * my_tree->size;
+	k = (rank <= 0.0) ? 0 : (size_t) rank;
+	if (k < rank) k++;	// round up to a whole number of keys
+	if (k > my_tree->size) k = my_tree->size;
+	key = bst_select_unlocked(my_tree, k ? k - 1 : 0);
+	bst_unlock(my_tree);
+
+	return key;
+}
+
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_min_node
+ *    Arguments:  struct bstnode_s * node - Root of the subtree to search.
+ *      Returns:  Node holding the minimum value.
+ *  Description:  Follows left children down the subtree in a loop.
+ * =====================================================================================
+ */
+
+struct bstnode_s * bst_min_node(struct bstnode_s * node) {
+	while (node->left != NULL) {
+		node = node->left ;
+	}
+	return node ;
+}		/* -----  end of function bst_min_node  ----- */
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_find_min_unlocked
+ *    Arguments:  bst * tree - The tree of which we're finding the minimum.
+ *      Returns:  Minimum value present in binary tree. Default return value of 0.
+ *  Description:  Finds the minimum value present in the tree: the key of rank 0.
+ * =====================================================================================
+ */
+
+static bst_key bst_find_min_unlocked(bst * tree) {
+	if (tree == NULL) {
+		return 0 ;
+	}
+	return bst_select_unlocked(tree, 0) ;
+}		/* -----  end of function bst_find_min_unlocked  ----- */
+
+/* bst_find_min_unlocked(), under the read lock */
+bst_key bst_find_min(bst * tree) {
+	bst_key min ;
+
+	if (tree == NULL) {
+		return 0 ;
+	}
+	bst_read_lock(tree) ;
+	min = bst_find_min_unlocked(tree) ;
+	bst_unlock(tree) ;
+
+	return min ;
+}
+
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_max_node
+ *    Arguments:  struct bstnode_s * node - Root of the subtree to search.
+ *      Returns:  Node holding the maximum value.
+ *  Description:  Follows right children down the subtree in a loop.
+ * =====================================================================================
+ */
+
+struct bstnode_s * bst_max_node(struct bstnode_s * node) {
+	while (node->right != NULL) {
+		node = node->right ;
+	}
+	return node ;
+}		/* -----  end of function bst_max_node  ----- */
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_next_node
+ *    Arguments:  struct bstnode_s * node - Node to find the in-order successor of.
+ *      Returns:  Node holding the next larger value, NULL if node holds the largest.
+ *  Description:  The successor is the minimum of the right subtree if there is one.
+ *                Otherwise it is the first ancestor reached from its left subtree.
+ * =====================================================================================
+ */
+
+struct bstnode_s * bst_next_node(struct bstnode_s * node) {
+	if (node->right != NULL) {
+		return bst_min_node(node->right) ;
+	}
+	while (node->parent != NULL && node == node->parent->right) {
+		node = node->parent ;
+	}
+	return node->parent ;
+}		/* -----  end of function bst_next_node  ----- */
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_prev_node
+ *    Arguments:  struct bstnode_s * node - Node to find the in-order predecessor of.
+ *      Returns:  Node holding the next smaller value, NULL if node holds the smallest.
+ *  Description:  The mirror image of bst_next_node: the maximum of the left subtree
+ *                if there is one, otherwise the first ancestor reached from its right.
+ * =====================================================================================
+ */
+
+struct bstnode_s * bst_prev_node(struct bstnode_s * node) {
+	if (node->left != NULL) {
+		return bst_max_node(node->left) ;
+	}
+	while (node->parent != NULL && node == node->parent->left) {
+		node = node->parent ;
+	}
+	return node->parent ;
+}		/* -----  end of function bst_prev_node  ----- */
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_find_max_unlocked
+ *    Arguments:  bst * tree - The tree of which we're finding the maximum.
+ *      Returns:  Maximum value present in binary tree. Default return value of 0.
+ *  Description:  Finds the maximum value present in the tree: the key of rank n-1.
+ * =====================================================================================
+ */
+
+static bst_key bst_find_max_unlocked(bst * tree) {
+	if (tree == NULL || tree->size == 0) {
+		return 0 ;
+	}
+	return bst_select_unlocked(tree, tree->size - 1) ;
+}		/* -----  end of function bst_find_max_unlocked  ----- */
+
+/* bst_find_max_unlocked(), under the read lock */
+bst_key bst_find_max(bst * tree) {
+	bst_key max ;
+
+	if (tree == NULL) {
+		return 0 ;
+	}
+	bst_read_lock(tree) ;
+	max = bst_find_max_unlocked(tree) ;
+	bst_unlock(tree) ;
+
+	return max ;
+}
+
+enum {
+	FAILURE,
+	SUCCESS,
+} ;
+
+/* 
+ * ===  FUNCTION  ======================================================================
+ *         Name:  bst_remove_unlocked
+ *    Arguments:  bst * tree - The tree from which we're removing the data.
+ *                bst_key data - Data to remove.
+ *      Returns:  1 if sucessful, 0 otherwise
+ *  Description:  Walks down the binary tree to the node containing data. A node with
+ *                two children takes over the value of its in-order successor, which
+ *                is removed instead. The node removed has at most one child, which
+ *                is spliced into its place. AVL trees are then rebalanced from the
+ *                removed node's parent upwards; splay trees splay that parent (or,
+ *                if data isn't there, the last node looked at) up to the root. No
+ *                recursion, so any depth is fine.
+ * =====================================================================================
+ */
+
+static int bst_remove_unlocked(bst * tree, bst_key data) {
+	struct bstnode_s * node ;
+	struct bstnode_s * child ;
+	struct bstnode_s * parent ;
+	struct bstnode_s * last = NULL ;
+	size_t visits = 0 ;
+
+	if (tree == NULL) {
+		return FAILURE ;
+	}
+	if (tree->type == BST_WIDE) {
+		return bst_wide_remove(tree, data) ;
+	}
+
+	// Find the node holding the data. //
+	node = tree->root ;
+	while (node != NULL && node->data != data) {
+		last = node ;
+		node = (data > node->data) ? node->right : node->left ;
+		visits++ ;
+	}
+	BST_COUNT(tree, removes, 1) ;
+	BST_COUNT(tree, remove_visits, visits + (node != NULL)) ;
+	if (node == NULL) {
+		if (tree->type == BST_SPLAY && last != NULL) {
+			bst_splay(tree, last) ;
+		}
+		return FAILURE ;
+	}
+
+	// Has two children - remove the successor in its place. //
+	if (node->left != NULL && node->right != NULL) {
+		struct bstnode_s * succ = bst_min_node(node->right) ;
+		node->data = succ->data ;
+		node = succ ;
+	}
+
+	// At most one child left, which takes the place of the node. //
+	child = (node->left != NULL) ? node->left : node->right ;
+	parent = node->parent ;
+	if (child != NULL) {
+		child->parent = parent ;
+	}
+	bst_replace_child(tree, parent, node, child) ;
+	bst_pool_free(&tree->pool, node) ;
+	--tree->size ;
+	bst_count_path(parent, -1) ;
+
+	if (tree->type == BST_AVL) {
+		bst_avl_retrace(tree, parent) ;
+	} else if (tree->type == BST_SPLAY && parent != NULL) {
+		bst_splay(tree, parent) ;
+	}
+
+	return SUCCESS ;
+}		/* -----  end of function bst_remove_unlocked  ----- */
+
+/* bst_remove_unlocked(), under the write lock */
+int bst_remove(bst * tree, bst_key data) {
+	int removed ;
+
+	if (tree == NULL) {
+		return FAILURE ;
+	}
+	bst_write_lock(tree) ;
+	removed = bst_remove_unlocked(tree, data) ;
+	bst_unlock(tree) ;
+
+	return removed ;
+}
+
+
+/*
+ ******************************************************************************
+ * Position the cursor 'it' on the smallest key >= 'key' in the tree.
+ * Found on the way down from the root, in O(log n).
+ * Return 1 if there is such a key, 0 if the cursor is off the end.
+ ******************************************************************************
+ */
+int bst_iter_lower_bound(bst_iter_t *it, bst *my_tree, bst_key key) {
+	it->tree = my_tree;
+	it->node = NULL;
+	it->depth = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_iter_lower_bound(it, key);
+	}
+
+	it->node = bst_lower_bound_node(my_tree->root, key);
+	return it->node != NULL;
+}
+
+/*
+ ******************************************************************************
+ * Position the cursor 'it' on the smallest (largest) key in the tree.
+ * Return 1, or 0 if the tree is empty.
+ ******************************************************************************
+ */
+int bst_iter_first(bst_iter_t *it, bst *my_tree) {
+	return bst_iter_lower_bound(it, my_tree, BST_KEY_MIN);
+}
+
+int bst_iter_last(bst_iter_t *it, bst *my_tree) {
+	it->tree = my_tree;
+	it->node = NULL;
+	it->depth = 0;
+
+	if (my_tree->type == BST_WIDE) {
+		return bst_wide_iter_last(it);
+	}
+
+	if (my_tree->root != NULL) it->node = bst_max_node(my_tree->root);
+	return it->node != NULL;
+}
+
+/*
+ ******************************************************************************
+ * Step the cursor 'it' to the next larger (smaller) key. Each step
+ * takes O(1) amortized: a walk over the whole tree crosses each edge
+ * twice. Once off the end, the cursor stays there.
+ * Return 1 if the cursor is on a key, 0 if it stepped off the end.
+ ******************************************************************************
+ */
+int bst_iter_next(bst_iter_t *it) {
+	if (it->tree->type == BST_WIDE) {
+		return bst_wide_iter_next(it);
+	}
+
+	if (it->node != NULL) it->node = bst_next_node(it->node);
+	return it->node != NULL;
+}
+
+int bst_iter_prev(bst_iter_t *it) {
+	if (it->tree->type == BST_WIDE) {
+		return bst_wide_iter_prev(it);
+	}
+
+	if (it->node != NULL) it->node = bst_prev_node(it->node);
+	return it->node != NULL;
+}
+
+/*
+ ******************************************************************************
+ * Return 1 if the cursor 'it' is on a key, 0 if it is off the end.
+ ******************************************************************************
+ */
+int bst_iter_valid(const bst_iter_t *it) {
+	if (it->tree->type == BST_WIDE) {
+		return it->depth > 0;
+	}
+	return it->node != NULL;
+}
+
+/*
+ ******************************************************************************
+ * Return the key under the cursor 'it'.
+ * Default return value of 0 if it is off the end.
+ ******************************************************************************
+ */
+bst_key bst_iter_key(const bst_iter_t *it) {
+	if (it->tree->type == BST_WIDE) {
+		if (it->depth == 0) return 0;
+		return it->path[it->depth - 1]->keys[it->index[it->depth - 1]];
+	}
+	return it->node ? it->node->data : 0;
+}
+
+
+/* which of the keys bst_set_op() keeps */
+enum {
+	BST_SET_UNION,
+	BST_SET_INTERSECT,
+	BST_SET_DIFFERENCE,
+};
+
+/*
+ * past this size ratio, look up each key of the small tree in the big
+ * one (O(m log n)) rather than merge the two (O(n + m))
+ */
+#define BST_SET_SEARCH_RATIO 8
+
+/*
+ * Helper function:
+ * Combine the keys of trees 'a' and 'b' - walking both in order with
+ * cursors, like the merge step of a merge sort - into the sorted array
+ * 'out', which has room for the result.
+ * Return the number of keys stored.
+ */
+static size_t bst_set_merge(bst *a, bst *b, int op, bst_key *out) {
+	bst_iter_t ia, ib;
+	int va, vb;
+	size_t k = 0;
+
+	va = bst_iter_first(&ia, a);
+	vb = bst_iter_first(&ib, b);
+	while (va && vb) {
+		bst_key ka = bst_iter_key(&ia), kb = bst_iter_key(&ib);
+
+		if (ka < kb) {
+			if (op != BST_SET_INTERSECT) out[k++] = ka;
+			va = bst_iter_next(&ia);
+		} else if (kb < ka) {
+			if (op == BST_SET_UNION) out[k++] = kb;
+			vb = bst_iter_next(&ib);
+		} else {
+			if (op != BST_SET_DIFFERENCE) out[k++] = ka;
+			va = bst_iter_next(&ia);
+			vb = bst_iter_next(&ib);
+		}
+	}
+
+	// the rest of one tree or the other
+	for (; va && op != BST_SET_INTERSECT; va = bst_iter_next(&ia)) {
+		out[k++] = bst_iter_key(&ia);
+	}
+	for (; vb && op == BST_SET_UNION; vb = bst_iter_next(&ib)) {
+		out[k++] = bst_iter_key(&ib);
+	}
+
+	return k;
+}
+
+/*
+ * Helper function:
+ * Keep each key of tree 'small' that is (or, if 'absent' is set, is
+ * not) in tree 'big' - gathering them into the array 'out' and looking
+ * them all up with bst_search_batch(), so the cache misses in the big
+ * tree overlap - and squeeze out the rest.
+ * Return the number of keys kept, or -1 if memory runs out.
+ */
+static long bst_set_lookup(bst *small, bst *big, int absent, bst_key *out) {
+	uint8_t *found;
+	size_t i, k = 0;
+
+	if (! (found = (uint8_t *) malloc(small->size + 1))) return -1;
+
+	bst_inorder_toarray_unlocked(small, out);
+	bst_search_batch_unlocked(big, out, small->size, found);
+	for (i=0; i<small->size; i++) {
+		if (found[i] != absent) out[k++] = out[i];
+	}
+
+	free(found);
+	return k;
+}
+
+/*
+ * Helper function:
+ * The set operation 'op' on the keys of trees 'a' and 'b', which are
+ * read locked while their keys are gathered into a sorted array. The
+ * result is built from that array in one pass, perfectly balanced.
+ * Return the new tree, or NULL if memory runs out.
+ */
+static bst *bst_set_op(bst *a, bst *b, int op) {
+	bst *result;
+	bst_key *keys;
+	size_t n;
+	long k;
+
+	// the locks in address order, so ops each way round can't deadlock
+	// behind writers waiting on both trees
+	bst_read_lock(a < b ? a : b);
+	if (b != a) bst_read_lock(a < b ? b : a);
+
+	n = a->size;
+	if (op == BST_SET_UNION) n += b->size;
+	if (op == BST_SET_INTERSECT && b->size < n) n = b->size;
+
+	if (! (keys = (bst_key *) malloc((n ? n : 1) * sizeof(bst_key)))) {
+		if (b != a) bst_unlock(b);
+		bst_unlock(a);
+		return NULL;
+	}
+
+	if (op == BST_SET_INTERSECT && a->size > BST_SET_SEARCH_RATIO * b->size) {
+		k = bst_set_lookup(b, a, 0, keys);
+	} else if (op == BST_SET_INTERSECT && b->size > BST_SET_SEARCH_RATIO * a->size) {
+		k = bst_set_lookup(a, b, 0, keys);
+	} else if (op == BST_SET_DIFFERENCE && b->size > BST_SET_SEARCH_RATIO * a->size) {
+		k = bst_set_lookup(a, b, 1, keys);
+	} else {
+		k = bst_set_merge(a, b, op, keys);
+	}
+
+	if (b != a) bst_unlock(b);
+	bst_unlock(a);
+
+	result = (k < 0) ? NULL : bst_create_from_sorted(keys, k);
+	free(keys);
+
+	return result;
+}
+
+/*
+ ******************************************************************************
+ * Return a new tree holding the keys in either (both) of the trees
+ * 'a' and 'b' - or in 'a' but not 'b' - which are left unchanged. The
+ * two trees are merged in O(n + m); when one is much smaller than the
+ * other, an intersection or a difference from the smaller tree looks
+ * up its keys in the bigger one instead, in O(m log n). The result is
+ * a perfectly balanced BST_AVL tree, whatever the types of 'a' and 'b'.
+ * Return NULL if memory runs out.
+ ******************************************************************************
+ */
+bst *bst_union(bst *a, bst *b) {
+	return bst_set_op(a, b, BST_SET_UNION);
+}
+
+bst *bst_intersect(bst *a, bst *b) {
+	return bst_set_op(a, b, BST_SET_INTERSECT);
+}
+
+bst *bst_difference(bst *a, bst *b) {
+	return bst_set_op(a, b, BST_SET_DIFFERENCE);
+}
+
+
+/*
+ * Helper function:
+ * Join the AVL subtrees 'left' and 'right' (either may be NULL, and
+ * neither has a parent) with 'node' between them: every key under
+ * 'left' is less than node->data, and every key under 'right' greater.
+ * 'node' is hung off the spine of the taller subtree, at the first
+ * node no more than one taller than the other subtree, which is then
+ * rebalanced on the way back up - O(difference in heights). The
+ * rotations are made (and counted) in 'my_tree', the tree the subtrees
+ * belong to, whose root is lent to the joined subtree meanwhile.
+ * Return the root of the joined subtree.
+ */
+static struct bstnode_s *bst_avl_join(bst *my_tree, struct bstnode_s *left,
+		struct bstnode_s *node, struct bstnode_s *right) {
+	int hl = bst_avl_height(left), hr = bst_avl_height(right);
+	struct bstnode_s *cut, *parent = NULL, *root = my_tree->root, *joined;
+
+	if (hl > hr + 1) {
+		// down the right spine of the left subtree
+		for (cut = left; bst_avl_height(cut) > hr + 1; cut = cut->right) parent = cut;
+		my_tree->root = left;
+	} else if (hr > hl + 1) {
+		// down the left spine of the right subtree
+		for (cut = right; bst_avl_height(cut) > hl + 1; cut = cut->left) parent = cut;
+		my_tree->root = right;
+	} else {
+		cut = NULL;
+		my_tree->root = node;
+	}
+
+	// 'node' takes the place of 'cut', with it and the shorter subtree below
+	if (parent == NULL) {
+		node->left = left;
+		node->right = right;
+	} else if (hl > hr) {
+		node->left = cut;
+		node->right = right;
+		parent->right = node;
+	} else {
+		node->left = left;
+		node->right = cut;
+		parent->left = node;
+	}
+	node->parent = parent;
+	if (node->left) node->left->parent = node;
+	if (node->right) node->right->parent = node;
+	bst_avl_update(node);
+
+	// every node above gained a subtree - recount and rebalance them all
+	for (; parent != NULL; parent = parent->parent) {
+		parent = bst_avl_rebalance(my_tree, parent);
+	}
+
+	joined = my_tree->root;
+	my_tree->root = root;
+	return joined;
+}
+
+/*
+ * Helper function:
+ * Split the AVL subtree under 'node' (which has no parent), of
+ * 'my_tree', into the keys less than 'key', returned in '*lo', and
+ * the rest, in '*hi'. Each node on the way down to 'key' is joined,
+ * with the subtree on its far side, onto what is split off below it.
+ * The joins' costs telescope, to O(log n) in all.
+ */
+static void bst_avl_split(bst *my_tree, struct bstnode_s *node, bst_key key,
+		struct bstnode_s **lo, struct bstnode_s **hi) {
+	struct bstnode_s *left, *right;
+
+	if (node == NULL) {
+		*lo = *hi = NULL;
+		return;
+	}
+
+	left = node->left;
+	right = node->right;
+	if (left) left->parent = NULL;
+	if (right) right->parent = NULL;
+
+	if (key <= node->data) {
+		bst_avl_split(my_tree, left, key, lo, hi);
+		*hi = bst_avl_join(my_tree, *hi, node, right);
+	} else {
+		bst_avl_split(my_tree, right, key, lo, hi);
+		*lo = bst_avl_join(my_tree, left, node, *lo);
+	}
+}
+
+/*
+ ******************************************************************************
+ * Split a BST_AVL tree in two: the keys less than 'key' stay in the
+ * tree, which is returned in '*lo', and the rest move to a new tree of
+ * the same type, returned in '*hi'. No node is copied - the new tree
+ * holds nodes in the old one's pool chunks, which they share until
+ * both are destroyed - and it takes O(log n) time.
+ * Return 1 on success, 0 for a tree that isn't BST_AVL or if memory
+ * runs out (the tree is then unchanged).
+ ******************************************************************************
+ */
+int bst_split(bst *my_tree, bst_key key, bst **lo, bst **hi) {
+	struct bstnode_s *root_lo, *root_hi;
+	bst *high;
+
+	if (my_tree->type != BST_AVL) {
+		return 0;
+	}
+	if (! (high = bst_create_type(my_tree->type | my_tree->flags))) {
+		return 0;
+	}
+
+	bst_write_lock(my_tree);
+	bst_avl_split(my_tree, my_tree->root, key, &root_lo, &root_hi);
+	my_tree->root = root_lo;
+	my_tree->size = bst_node_count(root_lo);
+	high->root = root_hi;
+	high->size = bst_node_count(root_hi);
+	bst_pool_share(&my_tree->pool, &high->pool);
+	bst_unlock(my_tree);
+
+	*lo = my_tree;
+	*hi = high;
+	return 1;
+}
+
+/*
+ ******************************************************************************
+ * Join two BST_AVL trees, where every key in 'lo' is less than every
+ * key in 'hi', into one: 'lo', which takes over all the nodes of 'hi',
+ * and is returned. 'hi' is destroyed. The smallest node of 'hi' is
+ * taken out of it to go between the two, so this takes O(log n) time,
+ * and no node is copied.
+ * Return 'lo', or NULL if the trees aren't both BST_AVL, their keys
+ * overlap, or memory runs out (both trees are then unchanged).
+ ******************************************************************************
+ */
+bst *bst_join(bst *lo, bst *hi) {
+	struct bstnode_s *mid, *parent;
+
+	if (lo == hi || lo->type != BST_AVL || hi->type != BST_AVL) {
+		return NULL;
+	}
+
+	// the locks in address order, so joins each way round can't deadlock
+	bst_write_lock(lo < hi ? lo : hi);
+	bst_write_lock(lo < hi ? hi : lo);
+	if ((lo->root && hi->root && bst_max_node(lo->root)->data >= bst_min_node(hi->root)->data)
+			|| ! bst_pool_merge(&lo->pool, &hi->pool)) {
+		bst_unlock(hi);
+		bst_unlock(lo);
+		return NULL;
+	}
+
+	if (hi->root != NULL) {
+		// unhook the smallest node of 'hi' - it has no left child
+		mid = bst_min_node(hi->root);
+		parent = mid->parent;
+		if (mid->right) mid->right->parent = parent;
+		bst_replace_child(hi, parent, mid, mid->right);
+		bst_count_path(parent, -1);
+		bst_avl_retrace(hi, parent);
+
+		lo->root = bst_avl_join(lo, lo->root, mid, hi->root);
+		lo->size = lo->root->count;
+		hi->root = NULL;
+		hi->size = 0;
+	}
+	bst_unlock(hi);
+	bst_unlock(lo);
+
+	bst_destroy(hi);
+	return lo;
+}
+
+
+
+/*
+ * Helper functions:
+ * The tasks of bst_parallel_reduce(). A task is a subtree. A big one
+ * is cut up from the top: its right subtree (or, in a wide node, every
+ * child but the first) is pushed for any worker to take, its own keys
+ * are mapped, and the task carries on down the left. One of no more
+ * than BST_REDUCE_GRAIN keys is just walked, by the worker that has it,
+ * into that worker's own accumulator.
+ */
+#define BST_REDUCE_GRAIN 4096
+#define BST_REDUCE_ALIGN 64	// a cache line between accumulators
+
+struct bst_reduce {
+	bst *tree;
+	bst_map_fn map;
+	void *ctx;
+	char *accs;	// an accumulator per worker, 'stride' bytes apart
+	size_t stride;
+};
+
+static void bst_reduce_wide_walk(struct bst_reduce *r, struct bst_widenode_s *node, void *acc) {
+	int i;
+
+	for (i=0; i<node->n; i++) {
+		if (! node->leaf) bst_reduce_wide_walk(r, node->child[i], acc);
+		r->map(node->keys[i], acc, r->ctx);
+	}
+	if (! node->leaf) bst_reduce_wide_walk(r, node->child[node->n], acc);
+}
+
+static void bst_reduce_wide_task(bst_steal *pool, int worker, struct bst_reduce *r,
+		struct bst_widenode_s *node, void *acc) {
+	int i;
+
+	while (! node->leaf && node->count > BST_REDUCE_GRAIN) {
+		for (i=1; i<=node->n; i++) {
+			bst_steal_push(pool, worker, node->child[i]);
+		}
+		for (i=0; i<node->n; i++) {
+			r->map(node->keys[i], acc, r->ctx);
+		}
+		node = node->child[0];
+	}
+	bst_reduce_wide_walk(r, node, acc);
+}
+
+static void bst_reduce_task(bst_steal *pool, int worker, void *task, void *arg) {
+	struct bst_reduce *r = (struct bst_reduce *) arg;
+	struct bstnode_s *node = (struct bstnode_s *) task;
+	void *acc = r->accs + worker * r->stride;
+	size_t n;
+
+	if (r->tree->type == BST_WIDE) {
+		bst_reduce_wide_task(pool, worker, r, (struct bst_widenode_s *) task, acc);
+		return;
+	}
+
+	while (node != NULL && node->count > BST_REDUCE_GRAIN) {
+		if (node->right) bst_steal_push(pool, worker, node->right);
+		r->map(node->data, acc, r->ctx);
+		node = node->left;
+	}
+	if (node == NULL) return;
+
+	// the subtree's nodes are the first 'count' in order from its minimum
+	for (n = node->count, node = bst_min_node(node); n > 0; n--, node = bst_next_node(node)) {
+		r->map(node->data, acc, r->ctx);
+	}
+}
+
+/*
+ ******************************************************************************
+ * Map-reduce over every key in the tree, on up to 'nthreads' threads.
+ * The tree is cut into subtrees that are shared out over a
+ * work-stealing pool (see bst_bulk.h), so an unbalanced tree keeps the
+ * threads busy too. Each thread has its own copy of the 'acc_size'
+ * bytes at 'acc' - which must hold the identity of the reduction, such
+ * as 0 for a sum - and calls map(key, its_acc, ctx) for each key it
+ * takes, in no particular order. When they are all done, each copy is
+ * folded into 'acc' with reduce(acc, copy, ctx), so reduce must be
+ * associative and commutative. Small trees, or a failed allocation of
+ * the copies, are mapped straight into 'acc' on the caller's thread.
+ * The tree is read locked throughout.
+ * Return the number of keys mapped.
+ ******************************************************************************
+ */
+size_t bst_parallel_reduce(bst *my_tree, bst_map_fn map, bst_reduce_fn reduce, void *ctx,
+		int nthreads, void *acc, size_t acc_size) {
+	struct bst_reduce r;
+	void *root;
+	size_t size;
+	int t;
+
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > BST_BULK_MAX_THREADS) nthreads = BST_BULK_MAX_THREADS;
+
+	bst_read_lock(my_tree);
+
+	size = my_tree->size;
+	root = (my_tree->type == BST_WIDE) ? (void *) my_tree->wroot : (void *) my_tree->root;
+	if (root == NULL) {
+		bst_unlock(my_tree);
+		return 0;
+	}
+
+	r.tree = my_tree;
+	r.map = map;
+	r.ctx = ctx;
+	r.stride = (acc_size + BST_REDUCE_ALIGN - 1) / BST_REDUCE_ALIGN * BST_REDUCE_ALIGN;
+	r.accs = NULL;
+	if (size > BST_REDUCE_GRAIN && nthreads > 1) {
+		r.accs = (char *) malloc(nthreads * r.stride);
+	}
+
+	if (r.accs == NULL) {
+		// one worker, mapping straight into 'acc'
+		r.accs = (char *) acc;
+		r.stride = 0;
+		bst_steal_run(1, bst_reduce_task, root, &r);
+		bst_unlock(my_tree);
+		return size;
+	}
+
+	for (t=0; t<nthreads; t++) {
+		memcpy(r.accs + t * r.stride, acc, acc_size);
+	}
+	bst_steal_run(nthreads, bst_reduce_task, root, &r);
+	bst_unlock(my_tree);
+
+	for (t=0; t<nthreads; t++) {
+		reduce(acc, r.accs + t * r.stride, ctx);
+	}
+	free(r.accs);
+
+	return size;
+}
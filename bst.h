@@ -2,31 +2,187 @@
 #define __BST_H
 
 #include<stdlib.h>
+#include<stdint.h>
+#include<limits.h>
+#include<pthread.h>
 
-/* a node within the binary search tree, storing an int */
+#include "bst_pool.h"
+#include "bst_writer.h"
+
+/* the balancing scheme of a tree, chosen when it is created */
+enum {
+	BST_PLAIN,	// no rebalancing - sorted input degrades to a list
+	BST_AVL,	// AVL height-balanced - O(log n) for any input order
+	BST_WIDE,	// B-tree of 8-16 way nodes searched with SIMD (see bst_wide.h)
+	BST_SPLAY,	// self-adjusting - each key used is semi-splayed up to the root
+};
+
+/* or'ed with the type: lock the tree so it can be shared between threads */
+#define BST_THREADSAFE 0x100
+
+/*
+ * The key type: int, or a 64-bit integer when built with -DBST_KEY64
+ * (see the Makefile), for trees past 2^31 distinct keys. For other key
+ * types, and values, see bst_map.h.
+ */
+#ifdef BST_KEY64
+typedef int64_t bst_key;
+#define BST_KEY_MIN INT64_MIN
+#define BST_KEY_MAX INT64_MAX
+#else
+typedef int bst_key;
+#define BST_KEY_MIN INT_MIN
+#define BST_KEY_MAX INT_MAX
+#endif
+
+/* a node within the binary search tree, storing a key */
 struct bstnode_s {
-	int data;	// potentially could be any other data type
+	bst_key data;
+	int height;	// height of the subtree rooted here (AVL trees only)
 	struct bstnode_s *left, *right;	// the left and right children
+	struct bstnode_s *parent;	// NULL for the root
+	size_t count;	// number of nodes in the subtree rooted here
 };
 
+struct bst_widenode_s;
+
+/*
+ * Counts of the operations on a tree, and of the nodes they visit on
+ * the way down (for a binary tree, one key comparison each; for a
+ * BST_WIDE tree, one node searched). An insert that visits about as
+ * many nodes as there are keys is the degenerate, LINEAR case - a
+ * bst_insert_bulk() rebuild visits each node once. They are only
+ * kept in a build with -DBST_STATS (see the Makefile), and cost
+ * nothing - read as 0 - otherwise.
+ */
+struct bst_counters {
+	uint64_t inserts, insert_visits;
+	uint64_t searches, search_visits;	// bst_search() and bst_search_batch()
+	uint64_t removes, remove_visits;
+	uint64_t rotations;	// BST_AVL rebalancing and BST_SPLAY splaying
+};
+
+#ifdef BST_STATS
+/* relaxed atomics, as searches count in parallel under the read lock */
+#define BST_COUNT(tree, field, n) \
+	__atomic_fetch_add(&(tree)->counters.field, (n), __ATOMIC_RELAXED)
+#else
+#define BST_COUNT(tree, field, n) ((void) (n))
+#endif
+
 /* the tree itself - stores the root pointer and the size */
 typedef struct bst_s {
     struct bstnode_s *root;
-    int size;
+    struct bst_widenode_s *wroot;	// the root instead, for BST_WIDE
+    size_t size;
+    int type;	// BST_PLAIN, BST_AVL, BST_WIDE or BST_SPLAY
+    int flags;	// BST_THREADSAFE or 0
+    bst_pool pool;	// the tree's nodes are allocated from here
+    pthread_rwlock_t lock;	// BST_THREADSAFE only: readers share, writers exclude
+#ifdef BST_STATS
+    struct bst_counters counters;
+#endif
 } bst;
 
+/*
+ * What bst_stats() reports: the shape of the tree, found by walking
+ * it, the memory it uses, and the operation counters.
+ */
+typedef struct bst_stats_s {
+	size_t size;	// keys
+	int height;	// levels of nodes - the depth of the deepest key - 0 if empty
+	int min_height;	// the least height 'size' keys could have
+	double avg_depth;	// mean depth of a key, the root's being 1: the nodes a search finding it visits
+	size_t nodes;	// nodes holding the keys (one per key, but for BST_WIDE)
+	size_t node_bytes;	// the bytes of those nodes
+	size_t pool_chunks;	// allocations from the system for the nodes
+	size_t pool_bytes;	// the bytes of those, free nodes and all
+	int counting;	// 1 in a -DBST_STATS build, else 'ops' is all 0
+	struct bst_counters ops;
+} bst_stats_t;
+
+/*
+ * A cursor over the keys of a tree, in order, which can step both
+ * ways. It lives wherever the caller puts it - no allocation. A
+ * binary tree is walked with its parent pointers; a wide tree has
+ * none, so the cursor keeps the path down to its key, which is never
+ * deeper than BST_ITER_DEPTH (a B-tree of 2^64 keys is 22 levels).
+ * The tree must not change while a cursor is in use - for a
+ * BST_THREADSAFE tree, hold bst_read_lock() around the walk.
+ */
+#define BST_ITER_DEPTH 24
+
+typedef struct bst_iter_s {
+	bst *tree;
+	struct bstnode_s *node;	// the current node, NULL off the end
+	int depth;	// BST_WIDE: the length of the path, 0 off the end
+	struct bst_widenode_s *path[BST_ITER_DEPTH];	// BST_WIDE: the nodes from the root down
+	int index[BST_ITER_DEPTH];	// BST_WIDE: the key (or child) taken in each
+} bst_iter_t;
+
+/* called by bst_range_foreach() with each key in the range, in order */
+typedef void (*bst_visit)(bst_key key, void *ctx);
+
+/*
+ * bst_parallel_reduce(): map each key into a thread's own accumulator,
+ * then fold the accumulators ('other' into 'acc') into one
+ */
+typedef void (*bst_map_fn)(bst_key key, void *acc, void *ctx);
+typedef void (*bst_reduce_fn)(void *acc, const void *other, void *ctx);
+
 
 bst *bst_create();
+bst *bst_create_type(int type);
+bst *bst_create_from_sorted(const bst_key *keys, size_t n);
+bst *bst_create_from_array(const bst_key *keys, size_t n);
+int bst_insert_bulk(bst *my_tree, const bst_key *keys, size_t n, int nthreads);
 void bst_destroy(bst *my_tree);
-int bst_insert(bst *my_tree, int data);
-int bst_search(bst *my_tree, int data);
-int bst_size(bst *my_tree);
+bst *bst_union(bst *a, bst *b);
+bst *bst_intersect(bst *a, bst *b);
+bst *bst_difference(bst *a, bst *b);
+int bst_split(bst *my_tree, bst_key key, bst **lo, bst **hi);
+bst *bst_join(bst *lo, bst *hi);
+int bst_insert(bst *my_tree, bst_key data);
+int bst_search(bst *my_tree, bst_key data);
+size_t bst_search_batch(bst *my_tree, const bst_key *keys, size_t n, uint8_t *found_out);
+size_t bst_size(bst *my_tree);
+void bst_stats(bst *my_tree, bst_stats_t *out);
 void bst_display(bst *my_tree);
 void bst_inorder_tostring(bst *my_tree, char *str);
 void bst_preorder_tostring(bst *my_tree, char *str);
-int bst_find_min(bst * my_tree) ;
-int bst_find_max(bst * my_tree) ;
-int bst_remove(bst * my_tree, int data) ;
+size_t bst_inorder_tostring_n(bst *my_tree, char *str, size_t cap);
+size_t bst_preorder_tostring_n(bst *my_tree, char *str, size_t cap);
+void bst_inorder_write(bst *my_tree, bst_writer *w);
+void bst_preorder_write(bst *my_tree, bst_writer *w);
+void bst_inorder_toarray(bst *my_tree, bst_key *arr);
+void bst_inorder_toarray_unlocked(bst *my_tree, bst_key *arr);
+size_t bst_range_foreach(bst *my_tree, bst_key lo, bst_key hi, bst_visit visit, void *ctx);
+size_t bst_range_to_array(bst *my_tree, bst_key lo, bst_key hi, bst_key *out, size_t cap);
+size_t bst_range_count(bst *my_tree, bst_key lo, bst_key hi);
+size_t bst_parallel_reduce(bst *my_tree, bst_map_fn map, bst_reduce_fn reduce, void *ctx,
+		int nthreads, void *acc, size_t acc_size);
+int bst_iter_first(bst_iter_t *it, bst *my_tree);
+int bst_iter_last(bst_iter_t *it, bst *my_tree);
+int bst_iter_lower_bound(bst_iter_t *it, bst *my_tree, bst_key key);
+int bst_iter_next(bst_iter_t *it);
+int bst_iter_prev(bst_iter_t *it);
+int bst_iter_valid(const bst_iter_t *it);
+bst_key bst_iter_key(const bst_iter_t *it);
+size_t bst_rank(bst *my_tree, bst_key key);
+bst_key bst_select(bst *my_tree, size_t k);
+bst_key bst_percentile(bst *my_tree, double p);
+bst_key bst_find_min(bst * my_tree) ;
+bst_key bst_find_max(bst * my_tree) ;
+int bst_remove(bst * my_tree, bst_key data) ;
+void bst_read_lock(bst *my_tree);
+void bst_write_lock(bst *my_tree);
+void bst_unlock(bst *my_tree);
+
+/* node-level helpers, for walking a tree without recursion */
+struct bstnode_s * bst_min_node(struct bstnode_s * node) ;
+struct bstnode_s * bst_max_node(struct bstnode_s * node) ;
+struct bstnode_s * bst_next_node(struct bstnode_s * node) ;
+struct bstnode_s * bst_prev_node(struct bstnode_s * node) ;
 
 #endif
 
@@ -0,0 +1,146 @@
+/*
+ * The AVL balancing code - deliberately no include guard, as it is
+ * included once for each kind of node that is balanced this way (the
+ * int trees in bst.c, and the bst_link nodes of the maps in
+ * bst_map.c), with these defined:
+ *
+ *   BST_AVL_NAME                 the prefix of the functions
+ *   BST_AVL_NODE                 the node type: left, right, parent and
+ *                                an int height, at least
+ *   BST_AVL_TREE                 what holds the root, passed to every function
+ *   BST_AVL_REPLACE(t, p, o, n)  point whatever pointed at 'o' - the
+ *                                parent 'p', or the root of 't' if 'p'
+ *                                is NULL - at 'n'
+ *   BST_AVL_UPDATE(n)            anything else a node keeps about its
+ *                                subtree, recomputed from its children
+ *                                (may be empty)
+ *   BST_AVL_ROTATED(t)           called for each rotation (may be empty)
+ *
+ * Every node stores the height of its subtree; the heights of the two
+ * children of any node differ by at most one, which bounds the tree
+ * height at ~1.44 log2(n). It defines these static functions:
+ *
+ *   int  NAME_height(node)              0 for NULL
+ *   void NAME_update(node)              height, and BST_AVL_UPDATE
+ *   NODE *NAME_rotate_left(tree, node)  returning the new subtree root
+ *   NODE *NAME_rotate_right(tree, node)
+ *   NODE *NAME_rebalance(tree, node)    restore the AVL property at node
+ *   void NAME_retrace(tree, node)       rebalance from node up, after
+ *                                       an insert or remove below it
+ *
+ * The parameters are #undef'ed at the end, ready for the next user.
+ */
+
+#define BST_AVL_CAT_(a, b) a##_##b
+#define BST_AVL_CAT(a, b) BST_AVL_CAT_(a, b)
+#define BST_AVL_FN(f) BST_AVL_CAT(BST_AVL_NAME, f)
+
+static int BST_AVL_FN(height)(BST_AVL_NODE *node) {
+	return node ? node->height : 0;
+}
+
+static void BST_AVL_FN(update)(BST_AVL_NODE *node) {
+	int hl = BST_AVL_FN(height)(node->left);
+	int hr = BST_AVL_FN(height)(node->right);
+
+	node->height = 1 + (hl > hr ? hl : hr);
+	BST_AVL_UPDATE(node);
+}
+
+static BST_AVL_NODE *BST_AVL_FN(rotate_right)(BST_AVL_TREE tree, BST_AVL_NODE *node) {
+	BST_AVL_NODE *pivot = node->left;
+
+	BST_AVL_ROTATED(tree);
+	node->left = pivot->right;
+	if (pivot->right) pivot->right->parent = node;
+
+	pivot->parent = node->parent;
+	BST_AVL_REPLACE(tree, node->parent, node, pivot);
+
+	pivot->right = node;
+	node->parent = pivot;
+
+	BST_AVL_FN(update)(node);
+	BST_AVL_FN(update)(pivot);
+
+	return pivot;
+}
+
+static BST_AVL_NODE *BST_AVL_FN(rotate_left)(BST_AVL_TREE tree, BST_AVL_NODE *node) {
+	BST_AVL_NODE *pivot = node->right;
+
+	BST_AVL_ROTATED(tree);
+	node->right = pivot->left;
+	if (pivot->left) pivot->left->parent = node;
+
+	pivot->parent = node->parent;
+	BST_AVL_REPLACE(tree, node->parent, node, pivot);
+
+	pivot->left = node;
+	node->parent = pivot;
+
+	BST_AVL_FN(update)(node);
+	BST_AVL_FN(update)(pivot);
+
+	return pivot;
+}
+
+/*
+ * Restore the AVL property at 'node', whose children are both balanced
+ * but may differ in height by two.
+ * Return the new root of the subtree.
+ */
+static BST_AVL_NODE *BST_AVL_FN(rebalance)(BST_AVL_TREE tree, BST_AVL_NODE *node) {
+	int balance;
+
+	BST_AVL_FN(update)(node);
+	balance = BST_AVL_FN(height)(node->left) - BST_AVL_FN(height)(node->right);
+
+	if (balance > 1) {
+		// left heavy - a left-right case needs a double rotation
+		if (BST_AVL_FN(height)(node->left->left) < BST_AVL_FN(height)(node->left->right)) {
+			BST_AVL_FN(rotate_left)(tree, node->left);
+		}
+		return BST_AVL_FN(rotate_right)(tree, node);
+	} else if (balance < -1) {
+		// right heavy - a right-left case needs a double rotation
+		if (BST_AVL_FN(height)(node->right->right) < BST_AVL_FN(height)(node->right->left)) {
+			BST_AVL_FN(rotate_right)(tree, node->right);
+		}
+		return BST_AVL_FN(rotate_left)(tree, node);
+	}
+
+	return node;
+}
+
+/*
+ * Walk from 'node' up to the root after an insert or remove below it,
+ * fixing heights and rotating where needed. Stops as soon as a subtree
+ * keeps its old height, since nothing above it can have changed.
+ */
+static void BST_AVL_FN(retrace)(BST_AVL_TREE tree, BST_AVL_NODE *node) {
+	int old_height;
+
+	while (node != NULL) {
+		old_height = node->height;
+		node = BST_AVL_FN(rebalance)(tree, node);
+		if (node->height == old_height) {
+			return;
+		}
+		node = node->parent;
+	}
+}
+
+#undef BST_AVL_NAME
+#undef BST_AVL_NODE
+#undef BST_AVL_TREE
+#undef BST_AVL_REPLACE
+#undef BST_AVL_UPDATE
+#undef BST_AVL_ROTATED
+#undef BST_AVL_FN
+#undef BST_AVL_CAT
+#undef BST_AVL_CAT_
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,517 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "bst.h"
+#include "bst_perf.h"
+#include "bst_workload.h"
+
+#define N 10000
+#define REPS 10
+#define WARMUP 2
+#define BLOCK 256
+#define SEED 97
+
+/* time_op() of calls that may or may not succeed */
+#define ANY ((size_t) -1)
+
+
+/*
+ * Purpose:
+ * Time each operation of a tree on its own: insert, search for keys
+ * that are there (hits) and keys that aren't (misses), find_min,
+ * find_max, remove and destroy.
+ *
+ * A tree of 'n' distinct keys is built, in the order of a workload
+ * (-k, see bst_workload.h - uniform, a random order, by default; -o
+ * is short for -k sequential), and then searched, with 'n' hits and
+ * 'n' misses, in random order. find_min and find_max are each called
+ * 'n' times; half the keys are removed, in random order, and the tree
+ * holding the rest is destroyed.
+ *
+ * Every operation but destroy is timed in blocks of BLOCK calls with
+ * clock_gettime(CLOCK_MONOTONIC), which is far finer than the calls
+ * it brackets, so each block gives one sample of the time per call;
+ * destroy gives one sample per tree. The whole sequence runs WARMUP
+ * times (-w) untimed, to fault in the memory and warm the caches, and
+ * then REPS times (-r). From all the samples of each operation, the
+ * mean, min, 50th, 90th and 99th percentiles and max, in nanoseconds
+ * per call, are printed, as CSV (the default) or JSON (-j):
+ *
+ *   type,workload,n,op,samples,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns
+ *
+ * for each tree type, or just the one given by -t. bench.sh sweeps
+ * the tree size into bench.csv, and picks the medians plot.gnu draws
+ * out into bench.dat - a column per series, after the size.
+ *
+ * With -m READ:INSERT:REMOVE, a mix of operations is timed instead,
+ * as real traffic is. After the tree is loaded, -x calls ('n' by
+ * default) are made, each a search, insert or remove with those
+ * percent chances, of a key drawn from [0, 2n) by the query workload
+ * -q (uniform by default - so about half the keys are in the tree).
+ * The op column is then "mix-READ:INSERT:REMOVE", and the workload
+ * column "LOAD/QUERY", e.g. for -m 95:5:0 -q zipf:0.99:
+ *
+ *   AVL,uniform/zipf:0.99,10000,mix-95:5:0,...
+ *
+ * With -p, hardware counters (see bst_perf.h) are read around each
+ * timed run of an operation, and their averages per call are added,
+ * as the columns
+ *
+ *   cycles,instructions,l1d_misses,llc_misses,branch_misses,dtlb_misses
+ *
+ * (fields in JSON). A counter that isn't available - in most
+ * containers, none are - is left empty (null in JSON).
+ */
+
+
+/* the operations timed, in the order they run */
+enum {
+	OP_INSERT,
+	OP_SEARCH_HIT,
+	OP_SEARCH_MISS,
+	OP_MIN,
+	OP_MAX,
+	OP_REMOVE,
+	OP_DESTROY,
+	OP_MIXED,	// with -m
+	NOPS
+};
+
+static const char *op_names[NOPS] = {
+	"insert", "search_hit", "search_miss", "min", "max", "remove", "destroy", "mixed"
+};
+
+/* with -m, what each call of the mix is */
+enum {
+	MIX_SEARCH,
+	MIX_INSERT,
+	MIX_REMOVE
+};
+static unsigned char *mix;
+static char mix_name[48];	// room for any three ints
+
+static const char *type_names[] = {"PLAIN", "AVL", "WIDE", "SPLAY"};
+
+/* the samples of one operation, in nanoseconds per call */
+struct samples {
+	double *ns;
+	size_t n, cap;
+	double total_ns;	// over every call, for the mean
+	size_t calls;
+	double counts[BST_PERF_NCOUNTERS];	// with -p, summed over every call
+};
+
+/* the hardware counters, with -p */
+static bst_perf *perf;
+
+/* the results of min and max go here, so the calls aren't optimised away */
+static volatile bst_key sink;
+
+
+void usage(char arg0[]) {
+	fprintf(stderr, "Usage: %s [-n TREE_SIZE] [-r REPS] [-w WARMUP] [-b BLOCK] "
+			"[-t plain|avl|wide|splay] [-k LOAD | -o] [-m READ:INSERT:REMOVE [-q QUERY] [-x CALLS]] "
+			"[-j] [-H] [-p]\n", arg0);
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Return the time in nanoseconds since some fixed point.
+ */
+double now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*
+ * Add a sample of 'ns' nanoseconds over 'calls' calls.
+ */
+void add_sample(struct samples *s, double ns, size_t calls) {
+	if (s->n == s->cap) {
+		s->cap = s->cap ? 2 * s->cap : 1024;
+		if (! (s->ns = (double *) realloc(s->ns, s->cap * sizeof(double)))) exit(EXIT_FAILURE);
+	}
+	s->ns[s->n++] = ns / calls;
+	s->total_ns += ns;
+	s->calls += calls;
+}
+
+
+/*
+ * Make calls lo..hi-1 of operation 'op', with keys[lo..hi).
+ * Return how many of them succeeded (found or changed the tree).
+ */
+size_t run_block(int op, bst *my_tree, const bst_key *keys, size_t lo, size_t hi) {
+	size_t i, ok = 0;
+
+	switch (op) {
+		case OP_INSERT:
+			for (i=lo; i<hi; i++) ok += bst_insert(my_tree, keys[i]);
+			break;
+		case OP_SEARCH_HIT:
+		case OP_SEARCH_MISS:
+			for (i=lo; i<hi; i++) ok += bst_search(my_tree, keys[i]);
+			break;
+		case OP_MIN:
+			for (i=lo; i<hi; i++) sink = bst_find_min(my_tree);
+			ok = hi - lo;
+			break;
+		case OP_MAX:
+			for (i=lo; i<hi; i++) sink = bst_find_max(my_tree);
+			ok = hi - lo;
+			break;
+		case OP_REMOVE:
+			for (i=lo; i<hi; i++) ok += bst_remove(my_tree, keys[i]);
+			break;
+		case OP_MIXED:
+			for (i=lo; i<hi; i++) {
+				if (mix[i] == MIX_SEARCH) ok += bst_search(my_tree, keys[i]);
+				else if (mix[i] == MIX_INSERT) ok += bst_insert(my_tree, keys[i]);
+				else ok += bst_remove(my_tree, keys[i]);
+			}
+			break;
+	}
+	return ok;
+}
+
+
+/*
+ * Make 'n' calls of operation 'op', timing each block of 'block' calls
+ * into 's' (unless it is NULL, for a warm-up), and check that 'expect'
+ * of them succeed (unless it is ANY). The counters, if any, are read
+ * once either side of all the blocks, so the reads don't land in the
+ * timings.
+ */
+void time_op(int op, bst *my_tree, const bst_key *keys, size_t n, size_t block,
+		struct samples *s, size_t expect) {
+	size_t i, hi, ok = 0;
+	double start;
+	int c;
+
+	if (perf && s) bst_perf_start(perf);
+	for (i=0; i<n; i=hi) {
+		hi = (n - i < block) ? n : i + block;
+		start = now_ns();
+		ok += run_block(op, my_tree, keys, i, hi);
+		if (s) add_sample(s, now_ns() - start, hi - i);
+	}
+	if (perf && s) {
+		bst_perf_stop(perf);
+		for (c=0; c<BST_PERF_NCOUNTERS; c++) {
+			s->counts[c] += perf->count[c];
+			perf->count[c] = 0;
+		}
+	}
+
+	if (expect != ANY && ok != expect) {
+		fprintf(stderr, "%s: %zu of %zu calls succeeded, expected %zu\n", op_names[op], ok, n, expect);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*
+ * Shuffle keys[0..n) into a random order.
+ */
+void shuffle(bst_key *keys, size_t n) {
+	size_t i, j;
+	bst_key tmp;
+
+	for (i=n; i>1; i--) {
+		j = (size_t)(i * drand48());
+		tmp = keys[i - 1];
+		keys[i - 1] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+
+/*
+ * Run the whole sequence of operations once on a new tree of 'type',
+ * recording the samples in s[op] (or nothing if 's' is NULL).
+ * keys[] holds the keys to insert, in order; hits[] the same keys in
+ * another order and misses[] keys that aren't there.
+ */
+void run_once(int type, const bst_key *keys, const bst_key *hits, const bst_key *misses,
+		size_t n, size_t block, struct samples *s) {
+	bst *my_tree = bst_create_type(type);
+	double start;
+
+	time_op(OP_INSERT, my_tree, keys, n, block, s ? &s[OP_INSERT] : NULL, n);
+	time_op(OP_SEARCH_HIT, my_tree, hits, n, block, s ? &s[OP_SEARCH_HIT] : NULL, n);
+	time_op(OP_SEARCH_MISS, my_tree, misses, n, block, s ? &s[OP_SEARCH_MISS] : NULL, 0);
+	time_op(OP_MIN, my_tree, keys, n, block, s ? &s[OP_MIN] : NULL, n);
+	time_op(OP_MAX, my_tree, keys, n, block, s ? &s[OP_MAX] : NULL, n);
+	time_op(OP_REMOVE, my_tree, hits, n / 2, block, s ? &s[OP_REMOVE] : NULL, n / 2);
+
+	start = now_ns();
+	bst_destroy(my_tree);
+	if (s) add_sample(&s[OP_DESTROY], now_ns() - start, 1);
+}
+
+/*
+ * Load a new tree of 'type' with keys[0..n), untimed, then time the
+ * mix of 'calls' calls on queries[], recording the samples in
+ * s[OP_MIXED] (or nothing if 's' is NULL).
+ */
+void run_mixed(int type, const bst_key *keys, size_t n, const bst_key *queries, size_t calls,
+		size_t block, struct samples *s) {
+	bst *my_tree = bst_create_type(type);
+
+	time_op(OP_INSERT, my_tree, keys, n, block, NULL, n);
+	time_op(OP_MIXED, my_tree, queries, calls, block, s ? &s[OP_MIXED] : NULL, ANY);
+	bst_destroy(my_tree);
+}
+
+
+int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Return the 'p'th percentile of the sorted samples v[0..n), by the
+ * nearest-rank method.
+ */
+double percentile(const double *v, size_t n, double p) {
+	size_t rank = (size_t)(p / 100.0 * n + 0.999999);
+
+	return v[rank > 0 ? rank - 1 : 0];
+}
+
+
+/*
+ * Print the counts per call of operation 's', if counting, as the rest
+ * of a CSV line or JSON object - empty, or null, for missing counters
+ * and for destroy, which isn't counted.
+ */
+void report_counts(struct samples *s, int op, int json) {
+	int c;
+
+	if (! perf) return;
+
+	for (c=0; c<BST_PERF_NCOUNTERS; c++) {
+		int have = perf->fd[c] >= 0 && op != OP_DESTROY;
+
+		if (json && have) {
+			printf(", \"%s\": %.2f", bst_perf_name(c), s->counts[c] / s->calls);
+		} else if (json) {
+			printf(", \"%s\": null", bst_perf_name(c));
+		} else if (have) {
+			printf(",%.2f", s->counts[c] / s->calls);
+		} else {
+			printf(",");
+		}
+	}
+}
+
+/*
+ * Print the summary of the samples of each operation, as CSV lines or
+ * as JSON objects ('first' is set for the first object printed).
+ */
+void report(const char *type, const char *workload, size_t n, struct samples *s, int json, int *first) {
+	int op;
+
+	for (op=0; op<NOPS; op++) {
+		double *v = s[op].ns;
+		size_t k = s[op].n;
+
+		if (k == 0) continue;
+		qsort(v, k, sizeof(double), compare_doubles);
+
+		if (json) {
+			printf("%s\n  {\"type\": \"%s\", \"workload\": \"%s\", \"n\": %zu, \"op\": \"%s\", "
+					"\"samples\": %zu, \"mean_ns\": %.1f, \"min_ns\": %.1f, \"p50_ns\": %.1f, "
+					"\"p90_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f",
+					*first ? "" : ",", type, workload, n, op_names[op], k, s[op].total_ns / s[op].calls,
+					v[0], percentile(v, k, 50), percentile(v, k, 90), percentile(v, k, 99), v[k - 1]);
+			report_counts(&s[op], op, json);
+			printf("}");
+			*first = 0;
+		} else {
+			printf("%s,%s,%zu,%s,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+					type, workload, n, op_names[op], k, s[op].total_ns / s[op].calls,
+					v[0], percentile(v, k, 50), percentile(v, k, 90), percentile(v, k, 99), v[k - 1]);
+			report_counts(&s[op], op, json);
+			printf("\n");
+		}
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+	size_t n = N;
+	size_t block = BLOCK;
+	int reps = REPS;
+	int warmup = WARMUP;
+	int only = -1;
+	int json = 0;
+	int header = 1;
+	bst_perf counters;
+	struct samples s[NOPS];
+	bst_workload load = {BST_WL_UNIFORM, 0}, query = {BST_WL_UNIFORM, 0};
+	int ratio[3] = {0, 0, 0};	// read, insert and remove percentages, with -m
+	size_t calls = 0;
+	char workload[80], spec[32];
+	unsigned short seed[3] = {SEED, 0, 0};
+	bst_key *keys, *hits, *misses, *queries = NULL;
+	size_t i;
+	int type, r, op, c, first = 1;
+
+	/* for getopt */
+	int opt;
+
+	/* process args */
+	while ((opt = getopt(argc, argv, "n:r:w:b:t:ok:m:q:x:jHph")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = strtoull(optarg, NULL, 0);
+				if (n < 1) usage(argv[0]);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				if (reps < 1) usage(argv[0]);
+				break;
+			case 'w':
+				warmup = atoi(optarg);
+				break;
+			case 'b':
+				block = strtoull(optarg, NULL, 0);
+				if (block < 1) usage(argv[0]);
+				break;
+			case 't':
+				if (strcmp(optarg, "plain") == 0) only = BST_PLAIN;
+				else if (strcmp(optarg, "avl") == 0) only = BST_AVL;
+				else if (strcmp(optarg, "wide") == 0) only = BST_WIDE;
+				else if (strcmp(optarg, "splay") == 0) only = BST_SPLAY;
+				else usage(argv[0]);
+				break;
+			case 'o':
+				load.kind = BST_WL_SEQUENTIAL;
+				break;
+			case 'k':
+				if (! bst_workload_parse(&load, optarg) || load.kind == BST_WL_ZIPF) usage(argv[0]);
+				break;
+			case 'm':
+				if (sscanf(optarg, "%d:%d:%d", &ratio[0], &ratio[1], &ratio[2]) != 3
+						|| ratio[0] < 0 || ratio[1] < 0 || ratio[2] < 0
+						|| ratio[0] > 100 || ratio[1] > 100 || ratio[2] > 100
+						|| ratio[0] + ratio[1] + ratio[2] != 100) usage(argv[0]);
+				snprintf(mix_name, sizeof(mix_name), "mix-%d:%d:%d", ratio[0], ratio[1], ratio[2]);
+				op_names[OP_MIXED] = mix_name;
+				break;
+			case 'q':
+				if (! bst_workload_parse(&query, optarg)) usage(argv[0]);
+				break;
+			case 'x':
+				calls = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				json = 1;
+				break;
+			case 'H':
+				header = 0;
+				break;
+			case 'p':
+				perf = &counters;
+				break;
+			case 'h':
+			default: /* '?' */
+				usage(argv[0]);
+		}
+	}
+
+	/* the even numbers below 2n are in the tree, the odd ones not */
+	keys = (bst_key *) malloc(n * sizeof(bst_key));
+	hits = (bst_key *) malloc(n * sizeof(bst_key));
+	misses = (bst_key *) malloc(n * sizeof(bst_key));
+	if (keys == NULL || hits == NULL || misses == NULL) exit(EXIT_FAILURE);
+
+	srand48(SEED);
+	bst_workload_order(&load, keys, n, seed);
+	for (i=0; i<n; i++) {
+		keys[i] *= 2;
+		hits[i] = (bst_key)(2 * i);
+		misses[i] = (bst_key)(2 * i + 1);
+	}
+	shuffle(hits, n);
+	shuffle(misses, n);
+	bst_workload_format(&load, workload, sizeof(workload));
+
+	/* the calls of a mix, and their keys */
+	if (mix_name[0]) {
+		if (calls == 0) calls = n;
+		mix = (unsigned char *) malloc(calls);
+		queries = (bst_key *) malloc(calls * sizeof(bst_key));
+		if (mix == NULL || queries == NULL || ! bst_workload_draw(&query, queries, calls, 2 * n, seed)) {
+			exit(EXIT_FAILURE);
+		}
+		for (i=0; i<calls; i++) {
+			int pick = (int)(100 * erand48(seed));
+
+			mix[i] = pick < ratio[0] ? MIX_SEARCH : pick < ratio[0] + ratio[1] ? MIX_INSERT : MIX_REMOVE;
+		}
+		bst_workload_format(&query, spec, sizeof(spec));
+		strcat(strcat(workload, "/"), spec);
+	}
+
+	if (perf && bst_perf_open(perf) < BST_PERF_NCOUNTERS) {
+		fprintf(stderr, "%s: %d of %d hardware counters available (%s)\n", argv[0],
+				perf->available, BST_PERF_NCOUNTERS, strerror(perf->error));
+	}
+
+	if (json) {
+		printf("[");
+	} else if (header) {
+		printf("type,workload,n,op,samples,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns");
+		for (c=0; perf && c<BST_PERF_NCOUNTERS; c++) {
+			printf(",%s", bst_perf_name(c));
+		}
+		printf("\n");
+	}
+
+	for (type=BST_PLAIN; type<=BST_SPLAY; type++) {
+		if (only >= 0 && type != only) continue;
+
+		memset(s, 0, sizeof(s));
+		for (r=0; r<warmup + reps; r++) {
+			if (mix) {
+				run_mixed(type, keys, n, queries, calls, block, r < warmup ? NULL : s);
+			} else {
+				run_once(type, keys, hits, misses, n, block, r < warmup ? NULL : s);
+			}
+		}
+
+		report(type_names[type], workload, n, s, json, &first);
+		fflush(stdout);
+
+		for (op=0; op<NOPS; op++) {
+			free(s[op].ns);
+		}
+	}
+
+	if (json) printf("\n]\n");
+	if (perf) bst_perf_close(perf);
+
+	free(keys);
+	free(hits);
+	free(misses);
+	free(queries);
+	free(mix);
+
+	return(0);
+}
+
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,474 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "bst_bulk.h"
+
+/* below this many keys, one thread sorts them all */
+#define BST_BULK_MIN_PARALLEL 65536
+/* keys sampled per thread to choose the splitters */
+#define BST_BULK_OVERSAMPLE 64
+/* below this many keys, insertion sort beats radix passes */
+#define BST_RADIX_MIN 64
+
+/* the keys as unsigned, with the sign bit flipped so they sort as unsigned */
+#ifdef BST_KEY64
+typedef uint64_t bst_ukey;
+#else
+typedef unsigned int bst_ukey;
+#endif
+#define BST_UKEY_SIGN ((bst_ukey) 1 << (8 * sizeof(bst_ukey) - 1))
+
+
+/*
+ * Helper function:
+ * The thread body behind bst_bulk_run().
+ */
+struct bst_bulk_thread {
+	bst_bulk_fn fn;
+	void *arg;
+	int t;
+};
+
+static void *bst_bulk_thread_main(void *p) {
+	struct bst_bulk_thread *th = (struct bst_bulk_thread *) p;
+
+	th->fn(th->arg, th->t);
+	return NULL;
+}
+
+/*
+ ******************************************************************************
+ * Run fn(arg, t) for t = 0..nthreads-1, each on its own thread (0 on
+ * the caller's), and wait for them all. A thread that can't be
+ * started has its share run on the caller's thread instead, so this
+ * always completes.
+ ******************************************************************************
+ */
+void bst_bulk_run(int nthreads, bst_bulk_fn fn, void *arg) {
+	struct bst_bulk_thread th[BST_BULK_MAX_THREADS];
+	pthread_t tid[BST_BULK_MAX_THREADS];
+	int started[BST_BULK_MAX_THREADS];
+	int t;
+
+	if (nthreads > BST_BULK_MAX_THREADS) nthreads = BST_BULK_MAX_THREADS;
+
+	for (t=1; t<nthreads; t++) {
+		th[t].fn = fn;
+		th[t].arg = arg;
+		th[t].t = t;
+		started[t] = (pthread_create(&tid[t], NULL, bst_bulk_thread_main, &th[t]) == 0);
+	}
+	fn(arg, 0);
+	for (t=1; t<nthreads; t++) {
+		if (started[t]) {
+			pthread_join(tid[t], NULL);
+		} else {
+			fn(arg, t);
+		}
+	}
+}
+
+
+/*
+ * Helper functions:
+ * Sort a[0..n) in place, using scratch[0..n) - an LSD radix sort, a
+ * byte per pass, that skips the passes where every key has the same
+ * byte (the high bytes of keys from a small range). Short runs are
+ * insertion sorted instead.
+ */
+static void bst_insertion_sort(bst_key *a, size_t n) {
+	size_t i, j;
+	bst_key key;
+
+	for (i=1; i<n; i++) {
+		key = a[i];
+		for (j=i; j>0 && a[j-1] > key; j--) {
+			a[j] = a[j-1];
+		}
+		a[j] = key;
+	}
+}
+
+static void bst_radix_sort(bst_key *a, bst_key *scratch, size_t n) {
+	bst_key *src = a, *dst = scratch, *swap;
+	size_t count[256], sum, c, i;
+	unsigned int shift;
+
+	if (n < BST_RADIX_MIN) {
+		bst_insertion_sort(a, n);
+		return;
+	}
+
+	for (shift=0; shift<8*sizeof(bst_key); shift+=8) {
+		memset(count, 0, sizeof(count));
+		for (i=0; i<n; i++) {
+			count[(((bst_ukey) src[i] ^ BST_UKEY_SIGN) >> shift) & 0xff]++;
+		}
+		if (count[(((bst_ukey) src[0] ^ BST_UKEY_SIGN) >> shift) & 0xff] == n) {
+			continue;	// all the same - nothing to do
+		}
+
+		for (sum=0, i=0; i<256; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i=0; i<n; i++) {
+			dst[count[(((bst_ukey) src[i] ^ BST_UKEY_SIGN) >> shift) & 0xff]++] = src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != a) memcpy(a, src, n * sizeof(bst_key));
+}
+
+/*
+ * Helper function:
+ * Squeeze the duplicates out of the sorted a[0..n).
+ * Return the number of distinct keys left.
+ */
+static size_t bst_unique(bst_key *a, size_t n) {
+	size_t i, k;
+
+	if (n == 0) return 0;
+	for (i=1, k=1; i<n; i++) {
+		if (a[i] != a[k-1]) a[k++] = a[i];
+	}
+	return k;
+}
+
+
+/* the state of a sample sort, shared by its threads */
+struct bst_sort {
+	const bst_key *in;
+	bst_key *out, *tmp;
+	size_t n;
+	int p;	// threads, and buckets
+	bst_key splitter[BST_BULK_MAX_THREADS];	// bucket b holds keys in (splitter[b-1], splitter[b]]
+	size_t *offset;	// [t * p + b]: keys of thread t's slice in bucket b, then where they go
+	size_t start[BST_BULK_MAX_THREADS + 1];	// where each bucket starts in 'tmp'
+	size_t unique[BST_BULK_MAX_THREADS];	// distinct keys in each bucket
+	size_t dest[BST_BULK_MAX_THREADS];	// where each bucket's go in 'out'
+};
+
+/*
+ * Helper function:
+ * Return the bucket of 'key': the number of splitters less than it.
+ */
+static int bst_sort_bucket(const struct bst_sort *s, bst_key key) {
+	int lo = 0, hi = s->p - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (s->splitter[mid] < key) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Helper functions:
+ * The phases of the sort, one call per thread 't': count the keys of
+ * slice 't' of the input going to each bucket; scatter them there;
+ * sort and dedup bucket 't'; copy it to its place in the output.
+ */
+static void bst_sort_count(void *arg, int t) {
+	struct bst_sort *s = (struct bst_sort *) arg;
+	size_t *count = s->offset + (size_t) t * s->p;
+	size_t i, end = s->n * (t + 1) / s->p;
+
+	for (i = s->n * t / s->p; i<end; i++) {
+		count[bst_sort_bucket(s, s->in[i])]++;
+	}
+}
+
+static void bst_sort_scatter(void *arg, int t) {
+	struct bst_sort *s = (struct bst_sort *) arg;
+	size_t *offset = s->offset + (size_t) t * s->p;
+	size_t i, end = s->n * (t + 1) / s->p;
+
+	for (i = s->n * t / s->p; i<end; i++) {
+		s->tmp[offset[bst_sort_bucket(s, s->in[i])]++] = s->in[i];
+	}
+}
+
+static void bst_sort_bucket_keys(void *arg, int t) {
+	struct bst_sort *s = (struct bst_sort *) arg;
+	size_t start = s->start[t], n = s->start[t + 1] - start;
+
+	// the output isn't written until the next phase - use it as scratch
+	bst_radix_sort(s->tmp + start, s->out + start, n);
+	s->unique[t] = bst_unique(s->tmp + start, n);
+}
+
+static void bst_sort_gather(void *arg, int t) {
+	struct bst_sort *s = (struct bst_sort *) arg;
+
+	memcpy(s->out + s->dest[t], s->tmp + s->start[t], s->unique[t] * sizeof(bst_key));
+}
+
+/*
+ * Helper function:
+ * Order keys for qsort().
+ */
+static int bst_sort_compare(const void *a, const void *b) {
+	bst_key x = *(const bst_key *) a, y = *(const bst_key *) b;
+
+	return (x > y) - (x < y);
+}
+
+
+/*
+ ******************************************************************************
+ * Sort the 'n' keys 'in' into 'out', which has room for 'n', leaving
+ * out only the duplicates, with 'nthreads' threads. Small inputs are
+ * sorted on the calling thread alone.
+ * Return the number of distinct keys, or (size_t) -1 if memory runs
+ * out.
+ ******************************************************************************
+ */
+size_t bst_sort_unique(const bst_key *in, bst_key *out, size_t n, int nthreads) {
+	struct bst_sort s;
+	bst_key sample[BST_BULK_MAX_THREADS * BST_BULK_OVERSAMPLE];
+	size_t nsample, i, sum, c;
+	int t, b;
+
+	if (nthreads > BST_BULK_MAX_THREADS) nthreads = BST_BULK_MAX_THREADS;
+	if (nthreads < 1 || n < BST_BULK_MIN_PARALLEL) nthreads = 1;
+
+	s.in = in;
+	s.out = out;
+	s.n = n;
+	s.p = nthreads;
+	if (! (s.tmp = (bst_key *) malloc((n ? n : 1) * sizeof(bst_key)))) return (size_t) -1;
+	if (! (s.offset = (size_t *) calloc((size_t) nthreads * nthreads, sizeof(size_t)))) {
+		free(s.tmp);
+		return (size_t) -1;
+	}
+
+	// splitters: evenly spaced keys of an evenly spaced sample
+	nsample = (size_t) nthreads * BST_BULK_OVERSAMPLE;
+	if (nsample > n) nsample = n;
+	for (i=0; i<nsample; i++) {
+		sample[i] = in[i * n / nsample];
+	}
+	qsort(sample, nsample, sizeof(bst_key), bst_sort_compare);
+	for (b=0; b<nthreads-1; b++) {
+		s.splitter[b] = sample[(b + 1) * nsample / nthreads];
+	}
+
+	bst_bulk_run(nthreads, bst_sort_count, &s);
+
+	// each slice's keys for a bucket go after the previous slices'
+	for (sum=0, b=0; b<nthreads; b++) {
+		s.start[b] = sum;
+		for (t=0; t<nthreads; t++) {
+			c = s.offset[t * nthreads + b];
+			s.offset[t * nthreads + b] = sum;
+			sum += c;
+		}
+	}
+	s.start[nthreads] = sum;
+
+	bst_bulk_run(nthreads, bst_sort_scatter, &s);
+	bst_bulk_run(nthreads, bst_sort_bucket_keys, &s);
+
+	for (sum=0, b=0; b<nthreads; b++) {
+		s.dest[b] = sum;
+		sum += s.unique[b];
+	}
+	bst_bulk_run(nthreads, bst_sort_gather, &s);
+
+	free(s.offset);
+	free(s.tmp);
+
+	return sum;
+}
+
+
+
+/* one worker's tasks: its own end is 'tail', thieves take from 'head' */
+struct bst_deque {
+	pthread_mutex_t lock;
+	void **tasks;
+	size_t head, tail, cap;
+};
+
+struct bst_steal_s {
+	int p;
+	bst_task_fn fn;
+	void *arg;
+	_Atomic long pending;	// tasks pushed but not yet finished
+	_Atomic int failed;	// a push ran out of memory
+	_Atomic unsigned long pushed;	// tasks ever pushed, to spot new work
+	_Atomic int idle;	// workers waiting for work, or about to
+	pthread_mutex_t idle_lock;
+	pthread_cond_t work;	// signalled on a push, and when all is done
+	struct bst_deque dq[BST_BULK_MAX_THREADS];
+};
+
+/*
+ * Helper functions:
+ * Take a task from the bottom of a worker's own deque (the newest), or
+ * from the top of someone else's (the oldest).
+ * Return the task, or NULL if the deque is empty.
+ */
+static void *bst_steal_pop(struct bst_deque *dq) {
+	void *task = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head) task = dq->tasks[--dq->tail];
+	pthread_mutex_unlock(&dq->lock);
+
+	return task;
+}
+
+static void *bst_steal_take(struct bst_deque *dq) {
+	void *task = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->tail > dq->head) task = dq->tasks[dq->head++];
+	pthread_mutex_unlock(&dq->lock);
+
+	return task;
+}
+
+/*
+ * Helper function:
+ * The loop each worker runs: its own tasks first, then other workers'
+ * (trying each in turn, starting with its neighbour), until every task
+ * pushed has been finished. With nothing to take while the last tasks
+ * are still being split, it sleeps until a push or the end - 'idle' is
+ * raised before 'pushed' is checked, so a push either sees the sleeper
+ * and signals it, or is seen by it.
+ */
+static void bst_steal_worker(void *arg, int t) {
+	bst_steal *pool = (bst_steal *) arg;
+	unsigned long seen;
+	void *task;
+	int i;
+
+	for (;;) {
+		seen = atomic_load(&pool->pushed);
+		task = bst_steal_pop(&pool->dq[t]);
+		for (i=1; task == NULL && i<pool->p; i++) {
+			task = bst_steal_take(&pool->dq[(t + i) % pool->p]);
+		}
+
+		if (task != NULL) {
+			pool->fn(pool, t, task, pool->arg);
+			if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+				// the last one - wake everyone to leave
+				pthread_mutex_lock(&pool->idle_lock);
+				pthread_cond_broadcast(&pool->work);
+				pthread_mutex_unlock(&pool->idle_lock);
+				return;
+			}
+		} else if (atomic_load(&pool->pending) == 0) {
+			return;
+		} else {
+			atomic_fetch_add(&pool->idle, 1);
+			pthread_mutex_lock(&pool->idle_lock);
+			while (atomic_load(&pool->pushed) == seen && atomic_load(&pool->pending) != 0) {
+				pthread_cond_wait(&pool->work, &pool->idle_lock);
+			}
+			pthread_mutex_unlock(&pool->idle_lock);
+			atomic_fetch_sub(&pool->idle, 1);
+		}
+	}
+}
+
+/*
+ ******************************************************************************
+ * Push 'task' onto the deque of 'worker' (the one running the current
+ * task), to be run by it later, or stolen by another worker.
+ * Return 1, or 0 if out of memory - the task is then run here and now.
+ ******************************************************************************
+ */
+int bst_steal_push(bst_steal *pool, int worker, void *task) {
+	struct bst_deque *dq = &pool->dq[worker];
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head > 0 && dq->tail == dq->cap) {
+		// slide the live tasks down over the stolen ones
+		memmove(dq->tasks, dq->tasks + dq->head, (dq->tail - dq->head) * sizeof(void *));
+		dq->tail -= dq->head;
+		dq->head = 0;
+	}
+	if (dq->tail == dq->cap) {
+		size_t cap = dq->cap ? 2 * dq->cap : 64;
+		void **tasks = (void **) realloc(dq->tasks, cap * sizeof(void *));
+
+		if (tasks == NULL) {
+			pthread_mutex_unlock(&dq->lock);
+			atomic_store(&pool->failed, 1);
+			pool->fn(pool, worker, task, pool->arg);
+			return 0;
+		}
+		dq->tasks = tasks;
+		dq->cap = cap;
+	}
+	atomic_fetch_add(&pool->pending, 1);
+	dq->tasks[dq->tail++] = task;
+	pthread_mutex_unlock(&dq->lock);
+
+	atomic_fetch_add(&pool->pushed, 1);
+	if (atomic_load(&pool->idle) > 0) {
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_signal(&pool->work);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+
+	return 1;
+}
+
+/*
+ ******************************************************************************
+ * Run the task 'first' - and every task it, and they, push - with
+ * fn(pool, worker, task, arg) on a pool of 'nthreads' workers, and
+ * wait for them all. Tasks should push the parts of their work that
+ * are worth sharing with bst_steal_push(), and do the rest themselves.
+ * Return 1, or 0 if a push ran out of memory (all the work was still
+ * done, but by fewer workers than it could have been).
+ ******************************************************************************
+ */
+int bst_steal_run(int nthreads, bst_task_fn fn, void *first, void *arg) {
+	bst_steal steal, *pool = &steal;
+	int t;
+
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > BST_BULK_MAX_THREADS) nthreads = BST_BULK_MAX_THREADS;
+
+	memset(pool, 0, sizeof(bst_steal));
+	pool->p = nthreads;
+	pool->fn = fn;
+	pool->arg = arg;
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->failed, 0);
+	atomic_init(&pool->pushed, 0);
+	atomic_init(&pool->idle, 0);
+	pthread_mutex_init(&pool->idle_lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	for (t=0; t<nthreads; t++) {
+		pthread_mutex_init(&pool->dq[t].lock, NULL);
+	}
+
+	if (bst_steal_push(pool, 0, first)) {
+		bst_bulk_run(nthreads, bst_steal_worker, pool);
+	}
+	for (t=0; t<nthreads; t++) {
+		pthread_mutex_destroy(&pool->dq[t].lock);
+		free(pool->dq[t].tasks);
+	}
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->idle_lock);
+
+	return ! atomic_load(&pool->failed);
+}
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,43 @@
+#ifndef __BST_BULK_H
+#define __BST_BULK_H
+
+#include<stdlib.h>
+
+#include "bst.h"
+
+/*
+ * The parallel building blocks of bst_insert_bulk().
+ *
+ * Work is split into phases, each run by 'nthreads' threads - the
+ * caller and nthreads-1 more - which all finish before the next phase
+ * starts. Sorting is a sample sort: the input is cut into one bucket
+ * of key values per thread, around splitters drawn from a sample of
+ * it, and each thread then radix sorts and dedups its own bucket.
+ *
+ * Work that can't be cut into even shares up front - a walk over an
+ * unbalanced tree - goes to a work-stealing pool instead: each worker
+ * keeps a deque of tasks, pushes and pops its own at the bottom, and
+ * when it runs dry steals from the top of another's, where the oldest
+ * (and so, when tasks are split top down, biggest) tasks are. With
+ * none anywhere, it sleeps until the next push, or the last task ends.
+ */
+#define BST_BULK_MAX_THREADS 64
+
+/* the work of thread 't' (0 <= t < nthreads) in a phase */
+typedef void (*bst_bulk_fn)(void *arg, int t);
+
+void bst_bulk_run(int nthreads, bst_bulk_fn fn, void *arg);
+size_t bst_sort_unique(const bst_key *in, bst_key *out, size_t n, int nthreads);
+
+/* a work-stealing pool, and what its workers run for each task */
+typedef struct bst_steal_s bst_steal;
+typedef void (*bst_task_fn)(bst_steal *pool, int worker, void *task, void *arg);
+
+int bst_steal_run(int nthreads, bst_task_fn fn, void *first, void *arg);
+int bst_steal_push(bst_steal *pool, int worker, void *task);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,178 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "bst_frozen.h"
+
+/* keys per cache line - the block of descendants prefetched per level */
+#define CACHE_LINE 64
+#define KEYS_PER_LINE (CACHE_LINE / sizeof(bst_key))
+
+
+/*
+ * Helper function:
+ * Visit the implicit subtree rooted at 'k' in-order, copying the
+ * sorted keys, starting from sorted[i], into their Eytzinger slots.
+ * The recursion is only log2(n) deep.
+ * Return the index of the next sorted key.
+ */
+static size_t bst_frozen_fill(bst_key *keys, size_t n, const bst_key *sorted, size_t i, size_t k) {
+	if (k <= n) {
+		i = bst_frozen_fill(keys, n, sorted, i, 2 * k);
+		keys[k] = sorted[i++];
+		i = bst_frozen_fill(keys, n, sorted, i, 2 * k + 1);
+	}
+	return i;
+}
+
+/*
+ * Helper function:
+ * The reverse of bst_frozen_fill(): copy the keys of the implicit
+ * subtree rooted at 'k' out in sorted order, starting at sorted[i].
+ * Return the index after the last key copied.
+ */
+static size_t bst_frozen_unfill(const bst_key *keys, size_t n, bst_key *sorted, size_t i, size_t k) {
+	if (k <= n) {
+		i = bst_frozen_unfill(keys, n, sorted, i, 2 * k);
+		sorted[i++] = keys[k];
+		i = bst_frozen_unfill(keys, n, sorted, i, 2 * k + 1);
+	}
+	return i;
+}
+
+
+/*
+ ******************************************************************************
+ * Create a frozen tree holding the 'n' keys, which must be sorted
+ * in strictly ascending order.
+ * Return the new pointer, or NULL if memory runs out.
+ ******************************************************************************
+ */
+bst_frozen *bst_frozen_create_from_sorted(const bst_key *keys, size_t n) {
+	bst_frozen *frozen;
+	void *mem;
+
+	if (! (frozen = (bst_frozen *) malloc(sizeof(bst_frozen)))) return NULL;
+
+	// cache line aligned, so each block of KEYS_PER_LINE descendants is exactly one line
+	if (posix_memalign(&mem, CACHE_LINE, (n + 1) * sizeof(bst_key)) != 0) {
+		free(frozen);
+		return NULL;
+	}
+
+	frozen->keys = (bst_key *) mem;
+	frozen->keys[0] = 0;
+	frozen->size = n;
+	frozen->map = NULL;
+	frozen->map_len = 0;
+	bst_frozen_fill(frozen->keys, n, keys, 0, 1);
+
+	return frozen;
+}
+
+
+/*
+ ******************************************************************************
+ * Freeze a tree: create a compact, read-only copy of its keys that
+ * supports a faster search. The tree itself is left unchanged.
+ * Return the new pointer, or NULL if memory runs out.
+ ******************************************************************************
+ */
+bst_frozen *bst_freeze(bst *my_tree) {
+	bst_frozen *frozen = NULL;
+	bst_key *sorted;
+
+	// hold the lock, so the size can't change under us
+	bst_read_lock(my_tree);
+	if ((sorted = (bst_key *) malloc((my_tree->size + 1) * sizeof(bst_key))) != NULL) {
+		bst_inorder_toarray_unlocked(my_tree, sorted);
+		frozen = bst_frozen_create_from_sorted(sorted, my_tree->size);
+		free(sorted);
+	}
+	bst_unlock(my_tree);
+
+	return frozen;
+}
+
+
+/*
+ ******************************************************************************
+ * Thaw a frozen tree back into a mutable, balanced (AVL) tree.
+ * The frozen tree is left unchanged.
+ * Return the new pointer, or NULL if memory runs out.
+ ******************************************************************************
+ */
+bst *bst_thaw(bst_frozen *frozen) {
+	bst *my_tree;
+	bst_key *sorted;
+
+	if (! (sorted = (bst_key *) malloc((frozen->size + 1) * sizeof(bst_key)))) return NULL;
+
+	bst_frozen_unfill(frozen->keys, frozen->size, sorted, 0, 1);
+	my_tree = bst_create_from_sorted(sorted, frozen->size);
+
+	free(sorted);
+	return my_tree;
+}
+
+
+/*
+ ******************************************************************************
+ * Destroy the frozen tree, freeing all memory, or unmapping the
+ * snapshot file it was loaded from.
+ ******************************************************************************
+ */
+void bst_frozen_destroy(bst_frozen *frozen) {
+	if (frozen == NULL) {
+		// nothing to do!
+		return;
+	}
+
+	if (frozen->map) {
+		munmap(frozen->map, frozen->map_len);
+	} else {
+		free(frozen->keys);
+	}
+	free(frozen);
+}
+
+
+/*
+ ******************************************************************************
+ * Return the number of keys.
+ ******************************************************************************
+ */
+size_t bst_frozen_size(bst_frozen *frozen) {
+	return frozen->size;
+}
+
+
+/*
+ ******************************************************************************
+ * Search for a value.
+ * The descent has no data-dependent branches: each level moves to
+ * child 2k or 2k+1 depending on one comparison, while the line holding
+ * the descendants four (three, with BST_KEY64) levels down is
+ * prefetched. Off the bottom of the tree, the path taken encodes the
+ * smallest key >= data: strip the trailing right turns (1 bits) and
+ * the final left turn to find it.
+ * Return 1 for sucessful search, 0 for failure.
+ ******************************************************************************
+ */
+int bst_frozen_search(bst_frozen *frozen, bst_key data) {
+	const bst_key *keys = frozen->keys;
+	size_t n = frozen->size;
+	size_t k = 1;
+
+	while (k <= n) {
+		__builtin_prefetch(keys + KEYS_PER_LINE * k);
+		k = 2 * k + (keys[k] < data);
+	}
+	k >>= __builtin_ffsl(~k);
+
+	return k != 0 && keys[k] == data;
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,38 @@
+#ifndef __BST_FROZEN_H
+#define __BST_FROZEN_H
+
+#include<stdlib.h>
+
+#include "bst.h"
+
+/*
+ * A read-only snapshot of a tree, stored without pointers in
+ * Eytzinger (breadth-first) order: the root is keys[1], and the
+ * children of keys[k] are keys[2k] and keys[2k+1].
+ *
+ * A search touches the same keys as a search of a balanced tree, but
+ * the top levels share a few cache lines, the nodes are 4 bytes rather
+ * than 32 (8 rather than 40 with BST_KEY64), and the descendants a few
+ * levels down are contiguous, so they can be prefetched while the
+ * current level is compared.
+ */
+typedef struct bst_frozen_s {
+	bst_key *keys;	// keys[1..size] in Eytzinger order, keys[0] unused
+	size_t size;
+	void *map;	// the mapped snapshot file the keys live in, or NULL
+	size_t map_len;
+} bst_frozen;
+
+
+bst_frozen *bst_freeze(bst *my_tree);
+bst_frozen *bst_frozen_create_from_sorted(const bst_key *keys, size_t n);
+void bst_frozen_destroy(bst_frozen *frozen);
+int bst_frozen_search(bst_frozen *frozen, bst_key data);
+size_t bst_frozen_size(bst_frozen *frozen);
+bst *bst_thaw(bst_frozen *frozen);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
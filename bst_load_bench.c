@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "bst.h"
+#include "bst_frozen.h"
+#include "bst_snapshot.h"
+
+#define N 1000000
+#define QUERIES 1000
+#define SEED 97
+#define PATH "bst_load_bench.snap"
+
+
+/*
+ * Purpose:
+ * Measure how long it takes to get from nothing to a searchable tree
+ * of 'n' random keys.
+ *
+ * The baseline replays 'n' bst_insert() calls into an AVL tree. That
+ * tree is then saved with bst_save(), and loaded back with
+ * bst_load_mmap_unchecked() (MAP) and bst_load_mmap() (CHECKED), each
+ * timed cold - with the file evicted from the page cache first - and
+ * warm. Every load is timed up to the answer of QUERIES searches, so
+ * the page faults the searches take are counted. Each line of output is
+ *
+ *   N REPLAY us COLD_MAP us COLD_CHECKED us WARM_MAP us WARM_CHECKED us
+ *
+ * Evicting the file uses posix_fadvise(), which needs no privileges
+ * but is only a hint; on some filesystems (tmpfs) it does nothing, and
+ * the cold times are really warm.
+ */
+
+
+void usage(char arg0[]) {
+	fprintf(stderr, "Usage: %s [-n TREE_SIZE] [-f SNAPSHOT_FILE]\n", arg0);
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Return the time in microseconds since some fixed point.
+ */
+double now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/*
+ * Drop the file's pages from the page cache.
+ */
+void evict(const char *path) {
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return;
+	fdatasync(fd);	// dirty pages can't be dropped
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+
+/*
+ * Time loading the snapshot, checked or not, and searching it for
+ * each of the queries. The number found must equal 'expected'.
+ * Return the elapsed time in microseconds.
+ */
+double time_load(const char *path, int checked, const int *queries, int expected) {
+	bst_frozen *frozen;
+	double start, elapsed;
+	int i, found = 0;
+
+	start = now_us();
+	frozen = checked ? bst_load_mmap(path) : bst_load_mmap_unchecked(path);
+	if (frozen == NULL) {
+		fprintf(stderr, "can't load %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	for (i=0; i<QUERIES; i++) {
+		found += bst_frozen_search(frozen, queries[i]);
+	}
+	elapsed = now_us() - start;
+
+	bst_frozen_destroy(frozen);
+
+	if (found != expected) {
+		fprintf(stderr, "loaded snapshot disagrees with bst_search\n");
+		exit(EXIT_FAILURE);
+	}
+	return elapsed;
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *path = PATH;
+	int queries[QUERIES];
+	bst *my_tree;
+	double start, replay;
+	int n = N;
+	int i, expected;
+
+	/* for getopt */
+	int opt;
+
+	/* process args */
+	while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = atoi(optarg);
+				break;
+			case 'f':
+				path = optarg;
+				break;
+			case 'h':
+			default: /* '?' */
+				usage(argv[0]);
+		}
+	}
+
+	/* the baseline: replay the inserts */
+	srand48(SEED);
+	start = now_us();
+	my_tree = bst_create_type(BST_AVL);
+	for (i=0; i<n; i++) {
+		bst_insert(my_tree, (int)(2.0 * n * drand48()));
+	}
+	replay = now_us() - start;
+
+	expected = 0;
+	for (i=0; i<QUERIES; i++) {
+		queries[i] = (int)(2.0 * n * drand48());
+		expected += bst_search(my_tree, queries[i]);
+	}
+
+	if (! bst_save(my_tree, path)) {
+		fprintf(stderr, "can't save %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	bst_destroy(my_tree);
+
+	printf("%d REPLAY %.0f ", n, replay);
+	evict(path);
+	printf("COLD_MAP %.0f ", time_load(path, 0, queries, expected));
+	evict(path);
+	printf("COLD_CHECKED %.0f ", time_load(path, 1, queries, expected));
+	printf("WARM_MAP %.0f ", time_load(path, 0, queries, expected));
+	printf("WARM_CHECKED %.0f\n", time_load(path, 1, queries, expected));
+
+	unlink(path);
+
+	return(0);
+}
+
+
+
+/*
+ * vim:ts=4:sw=4
+ */
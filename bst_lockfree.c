@@ -0,0 +1,588 @@
+#include <limits.h>
+
+#include "bst_lockfree.h"
+
+/* the low bits of a child pointer mark the edge */
+#define LF_FLAG ((uintptr_t) 1)	// the child (a leaf) is being removed
+#define LF_TAG  ((uintptr_t) 2)	// the parent is being removed
+#define LF_ADDR(p) ((struct bst_lf_node *)((p) & ~(LF_FLAG | LF_TAG)))
+
+/* sentinel keys, larger than any int */
+#define LF_INF0 ((int64_t) INT_MAX + 1)
+#define LF_INF1 ((int64_t) INT_MAX + 2)
+#define LF_INF2 ((int64_t) INT_MAX + 3)
+
+/* nodes retired before trying to advance the epoch */
+#define LF_RETIRE_BATCH 64
+
+
+/* the nodes on the path to a key that an update works on */
+struct bst_lf_seek {
+	struct bst_lf_node *ancestor;	// last node above an untagged edge
+	struct bst_lf_node *successor;	// its child on the path
+	struct bst_lf_node *parent;	// parent of the leaf
+	struct bst_lf_node *leaf;	// where the search ended
+	uintptr_t leaf_field;	// the edge to it, as read on the way down
+};
+
+
+/*
+ * Helper function:
+ * Allocate a node with the given key and children.
+ * Return NULL if out of memory.
+ */
+static struct bst_lf_node *bst_lf_node_create(int64_t key, struct bst_lf_node *left,
+		struct bst_lf_node *right) {
+	struct bst_lf_node *node;
+
+	if (! (node = (struct bst_lf_node *) malloc(sizeof(struct bst_lf_node)))) return NULL;
+	node->key = key;
+	atomic_init(&node->left, (uintptr_t) left);
+	atomic_init(&node->right, (uintptr_t) right);
+
+	return node;
+}
+
+
+/*
+ ******************************************************************************
+ * Create a new, empty lock-free tree: two internal sentinel nodes
+ * (keys INF2 and INF1) over three sentinel leaves. Every real key
+ * ends up below the INF0 leaf's side of the tree, so the update
+ * steps never run out of ancestors.
+ * Return the new pointer, or NULL if out of memory.
+ ******************************************************************************
+ */
+bst_lf *bst_lf_create() {
+	bst_lf *tree;
+	struct bst_lf_node *leaf0, *leaf1, *leaf2, *s = NULL;
+
+	if (! (tree = (bst_lf *) malloc(sizeof(bst_lf)))) return NULL;
+	tree->root = NULL;
+
+	leaf0 = bst_lf_node_create(LF_INF0, NULL, NULL);
+	leaf1 = bst_lf_node_create(LF_INF1, NULL, NULL);
+	leaf2 = bst_lf_node_create(LF_INF2, NULL, NULL);
+	if (leaf0 && leaf1) s = bst_lf_node_create(LF_INF1, leaf0, leaf1);
+	if (s && leaf2) tree->root = bst_lf_node_create(LF_INF2, s, leaf2);
+	if (! s || ! leaf2 || ! tree->root) {
+		free(leaf0);
+		free(leaf1);
+		free(leaf2);
+		free(s);
+		free(tree);
+		return NULL;
+	}
+
+	atomic_init(&tree->size, 0);
+	atomic_init(&tree->epoch, 0);
+	atomic_init(&tree->threads, NULL);
+
+	return tree;
+}
+
+
+/*
+ ******************************************************************************
+ * Destroy the tree, freeing all memory, including nodes still
+ * waiting to be reclaimed. No other thread may be using the tree,
+ * and the bst_lf_thread handles become invalid.
+ ******************************************************************************
+ */
+void bst_lf_destroy(bst_lf *tree) {
+	struct bst_lf_node *node, *left;
+	bst_lf_thread *thread, *next;
+	size_t i;
+	int e;
+
+	if (tree == NULL) {
+		// nothing to do!
+		return;
+	}
+
+	// free the nodes still in the tree, rotating left children up
+	// so that no stack is needed
+	node = tree->root;
+	while (node != NULL) {
+		left = LF_ADDR(atomic_load_explicit(&node->left, memory_order_relaxed));
+		if (left != NULL) {
+			atomic_store_explicit(&node->left,
+					atomic_load_explicit(&left->right, memory_order_relaxed), memory_order_relaxed);
+			atomic_store_explicit(&left->right, (uintptr_t) node, memory_order_relaxed);
+			node = left;
+		} else {
+			left = LF_ADDR(atomic_load_explicit(&node->right, memory_order_relaxed));
+			free(node);
+			node = left;
+		}
+	}
+
+	// and the retired ones
+	for (thread = atomic_load(&tree->threads); thread != NULL; thread = next) {
+		next = thread->next;
+		for (e=0; e<3; e++) {
+			for (i=0; i<thread->limbo_len[e]; i++) {
+				free(thread->limbo[e][i]);
+			}
+			free(thread->limbo[e]);
+		}
+		free(thread);
+	}
+
+	free(tree);
+}
+
+
+/*
+ ******************************************************************************
+ * Register the calling thread with the tree. An unregistered handle
+ * is reused if there is one.
+ * Return the handle to pass to the tree operations, or NULL if out
+ * of memory.
+ ******************************************************************************
+ */
+bst_lf_thread *bst_lf_register(bst_lf *tree) {
+	bst_lf_thread *thread;
+	int e;
+
+	for (thread = atomic_load(&tree->threads); thread != NULL; thread = thread->next) {
+		int unused = 0;
+		if (atomic_compare_exchange_strong(&thread->in_use, &unused, 1)) {
+			return thread;
+		}
+	}
+
+	if (! (thread = (bst_lf_thread *) malloc(sizeof(bst_lf_thread)))) return NULL;
+	thread->tree = tree;
+	atomic_init(&thread->state, 0);
+	atomic_init(&thread->in_use, 1);
+	thread->seen_epoch = 0;
+	for (e=0; e<3; e++) {
+		thread->limbo[e] = NULL;
+		thread->limbo_len[e] = 0;
+		thread->limbo_max[e] = 0;
+		thread->limbo_epoch[e] = 0;
+	}
+	thread->retired = 0;
+
+	// push it on the list - threads are only removed by destroy
+	thread->next = atomic_load(&tree->threads);
+	while (! atomic_compare_exchange_weak(&tree->threads, &thread->next, thread))
+		;
+
+	return thread;
+}
+
+
+/*
+ ******************************************************************************
+ * Unregister the thread; the handle must not be used again. Its
+ * retired nodes are kept, to be freed by the next thread to reuse
+ * the handle or by bst_lf_destroy().
+ ******************************************************************************
+ */
+void bst_lf_unregister(bst_lf_thread *thread) {
+	atomic_store(&thread->state, 0);
+	atomic_store(&thread->in_use, 0);
+}
+
+
+/*
+ * Helper function:
+ * Free the retired nodes that no thread can be reading any more:
+ * those retired at least two epochs before 'epoch'.
+ */
+static void bst_lf_reclaim(bst_lf_thread *thread, unsigned long epoch) {
+	size_t i;
+	int e;
+
+	for (e=0; e<3; e++) {
+		if (thread->limbo_len[e] > 0 && thread->limbo_epoch[e] + 2 <= epoch) {
+			for (i=0; i<thread->limbo_len[e]; i++) {
+				free(thread->limbo[e][i]);
+			}
+			thread->limbo_len[e] = 0;
+		}
+	}
+}
+
+/*
+ * Helper function:
+ * Start an operation: announce the current global epoch, so nodes
+ * retired from now on aren't freed while we might be reading them.
+ * The fence keeps the tree reads that follow - acquire and relaxed
+ * loads, which may otherwise pass the store - after the announcement.
+ */
+static void bst_lf_enter(bst_lf_thread *thread) {
+	unsigned long epoch = atomic_load(&thread->tree->epoch);
+
+	atomic_store(&thread->state, epoch << 1 | 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (epoch != thread->seen_epoch) {
+		thread->seen_epoch = epoch;
+		bst_lf_reclaim(thread, epoch);
+	}
+}
+
+/*
+ * Helper function:
+ * End an operation.
+ */
+static void bst_lf_exit(bst_lf_thread *thread) {
+	atomic_store_explicit(&thread->state, 0, memory_order_release);
+}
+
+/*
+ * Helper function:
+ * Move the global epoch on, if every thread inside an operation has
+ * already seen the current one.
+ */
+static void bst_lf_advance(bst_lf *tree) {
+	unsigned long epoch = atomic_load(&tree->epoch);
+	unsigned long state;
+	bst_lf_thread *thread;
+
+	for (thread = atomic_load(&tree->threads); thread != NULL; thread = thread->next) {
+		state = atomic_load(&thread->state);
+		if ((state & 1) && (state >> 1) != epoch) {
+			return;	// still in an older epoch
+		}
+	}
+	atomic_compare_exchange_strong(&tree->epoch, &epoch, epoch + 1);
+}
+
+/*
+ * Helper function:
+ * Retire a node that has been unlinked from the tree: it is freed
+ * two epochs after the global one now. That, not the epoch this
+ * operation announced, is the newest any thread that saw the node
+ * can have announced - and the epoch can only move two on from it
+ * once they have all left.
+ */
+static void bst_lf_retire(bst_lf_thread *thread, struct bst_lf_node *node) {
+	unsigned long epoch = atomic_load(&thread->tree->epoch);
+	int e = epoch % 3;
+	size_t i;
+
+	// anything left in this slot is from three epochs ago - safe to go
+	if (thread->limbo_epoch[e] != epoch) {
+		for (i=0; i<thread->limbo_len[e]; i++) {
+			free(thread->limbo[e][i]);
+		}
+		thread->limbo_len[e] = 0;
+		thread->limbo_epoch[e] = epoch;
+	}
+
+	if (thread->limbo_len[e] == thread->limbo_max[e]) {
+		size_t max = thread->limbo_max[e] ? 2 * thread->limbo_max[e] : LF_RETIRE_BATCH;
+		struct bst_lf_node **limbo = (struct bst_lf_node **) realloc(thread->limbo[e], max * sizeof(*limbo));
+
+		if (limbo == NULL) {
+			// out of memory - leak the node rather than free it too soon
+			return;
+		}
+		thread->limbo[e] = limbo;
+		thread->limbo_max[e] = max;
+	}
+	thread->limbo[e][thread->limbo_len[e]++] = node;
+
+	if (++thread->retired >= LF_RETIRE_BATCH) {
+		thread->retired = 0;
+		bst_lf_advance(thread->tree);
+	}
+}
+
+
+/*
+ * Helper function:
+ * Walk down towards 'key', recording the leaf reached, its parent,
+ * and the last edge on the way down that was not tagged: everything
+ * between that edge and the leaf's parent is already being removed.
+ */
+static void bst_lf_seek(bst_lf *tree, int64_t key, struct bst_lf_seek *seek) {
+	struct bst_lf_node *s = LF_ADDR(atomic_load_explicit(&tree->root->left, memory_order_acquire));
+	uintptr_t parent_field, current_field;
+	struct bst_lf_node *current;
+
+	seek->ancestor = tree->root;
+	seek->successor = s;
+	seek->parent = s;
+	parent_field = atomic_load_explicit(&s->left, memory_order_acquire);
+	seek->leaf = LF_ADDR(parent_field);
+
+	current_field = atomic_load_explicit(key < seek->leaf->key ? &seek->leaf->left : &seek->leaf->right,
+			memory_order_acquire);
+	current = LF_ADDR(current_field);
+
+	while (current != NULL) {
+		if (! (parent_field & LF_TAG)) {
+			seek->ancestor = seek->parent;
+			seek->successor = seek->leaf;
+		}
+		seek->parent = seek->leaf;
+		seek->leaf = current;
+
+		parent_field = current_field;
+		current_field = atomic_load_explicit(key < current->key ? &current->left : &current->right,
+				memory_order_acquire);
+		current = LF_ADDR(current_field);
+	}
+	seek->leaf_field = parent_field;
+}
+
+/*
+ * Helper function:
+ * Finish removing the flagged leaf below seek->parent: tag the edge
+ * to its sibling, then swing the ancestor's edge from the successor
+ * to the sibling, cutting the flagged leaf and every node between
+ * the successor and the parent out of the tree. The thread whose CAS
+ * does this retires the nodes cut out.
+ * Return 1 if this call did it, 0 if it must be retried.
+ */
+static int bst_lf_cleanup(bst_lf_thread *thread, int64_t key, struct bst_lf_seek *seek) {
+	struct bst_lf_node *ancestor = seek->ancestor;
+	struct bst_lf_node *successor = seek->successor;
+	struct bst_lf_node *parent = seek->parent;
+	struct bst_lf_node *node, *removed;
+	_Atomic uintptr_t *successor_addr, *child_addr, *sibling_addr;
+	uintptr_t sibling_field, expected;
+
+	successor_addr = key < ancestor->key ? &ancestor->left : &ancestor->right;
+	if (key < parent->key) {
+		child_addr = &parent->left;
+		sibling_addr = &parent->right;
+	} else {
+		child_addr = &parent->right;
+		sibling_addr = &parent->left;
+	}
+
+	// our leaf's edge isn't flagged? then it's the sibling being removed
+	if (! (atomic_load(child_addr) & LF_FLAG)) {
+		sibling_addr = child_addr;
+	}
+
+	// tag the edge to the node that stays, then move it up, keeping its flag
+	sibling_field = atomic_fetch_or(sibling_addr, LF_TAG);
+	expected = (uintptr_t) successor;
+	if (! atomic_compare_exchange_strong(successor_addr, &expected, sibling_field & ~LF_TAG)) {
+		return 0;
+	}
+
+	// every node from the successor down to the parent is now unreachable,
+	// along with the flagged leaf hanging off each of them
+	for (node = successor; node != parent; ) {
+		if (key < node->key) {
+			removed = LF_ADDR(atomic_load(&node->right));
+			bst_lf_retire(thread, removed);
+			bst_lf_retire(thread, node);
+			node = LF_ADDR(atomic_load(&node->left));
+		} else {
+			removed = LF_ADDR(atomic_load(&node->left));
+			bst_lf_retire(thread, removed);
+			bst_lf_retire(thread, node);
+			node = LF_ADDR(atomic_load(&node->right));
+		}
+	}
+	removed = LF_ADDR(atomic_load(sibling_addr == &parent->left ? &parent->right : &parent->left));
+	bst_lf_retire(thread, removed);
+	bst_lf_retire(thread, parent);
+
+	return 1;
+}
+
+
+/*
+ ******************************************************************************
+ * Search for a value.
+ * Return 1 for sucessful search, 0 for failure.
+ ******************************************************************************
+ */
+int bst_lf_search(bst_lf_thread *thread, int data) {
+	struct bst_lf_seek seek;
+	int found;
+
+	bst_lf_enter(thread);
+	bst_lf_seek(thread->tree, data, &seek);
+	found = (seek.leaf->key == data && ! (seek.leaf_field & LF_FLAG));
+	bst_lf_exit(thread);
+
+	return found;
+}
+
+
+/*
+ ******************************************************************************
+ * Insert a (unique) value into the tree.
+ * Do not insert duplicate values.
+ * The leaf where the search ends is replaced, in one CAS, by a new
+ * internal node whose children are that leaf and a new leaf for the
+ * value. If the edge was marked by a remove in progress, help that
+ * remove finish, then try again.
+ * Return 1 for sucessful insert, 0 for failure.
+ ******************************************************************************
+ */
+int bst_lf_insert(bst_lf_thread *thread, int data) {
+	struct bst_lf_node *leaf, *parent, *new_leaf, *new_internal;
+	struct bst_lf_seek seek;
+	_Atomic uintptr_t *child_addr;
+	uintptr_t expected;
+
+	if (! (new_leaf = bst_lf_node_create(data, NULL, NULL))) return 0;
+	if (! (new_internal = bst_lf_node_create(0, NULL, NULL))) {
+		free(new_leaf);
+		return 0;
+	}
+
+	bst_lf_enter(thread);
+	for (;;) {
+		bst_lf_seek(thread->tree, data, &seek);
+		leaf = seek.leaf;
+		parent = seek.parent;
+
+		// duplicates - unless the leaf is already on its way out
+		if (leaf->key == data) {
+			if (seek.leaf_field & LF_FLAG) {
+				bst_lf_cleanup(thread, data, &seek);
+				continue;
+			}
+			bst_lf_exit(thread);
+			free(new_leaf);
+			free(new_internal);
+			return 0;
+		}
+
+		// the new internal node routes between the old leaf and the new one
+		if (data < leaf->key) {
+			new_internal->key = leaf->key;
+			atomic_store_explicit(&new_internal->left, (uintptr_t) new_leaf, memory_order_relaxed);
+			atomic_store_explicit(&new_internal->right, (uintptr_t) leaf, memory_order_relaxed);
+		} else {
+			new_internal->key = data;
+			atomic_store_explicit(&new_internal->left, (uintptr_t) leaf, memory_order_relaxed);
+			atomic_store_explicit(&new_internal->right, (uintptr_t) new_leaf, memory_order_relaxed);
+		}
+
+		child_addr = data < parent->key ? &parent->left : &parent->right;
+		expected = (uintptr_t) leaf;
+		if (atomic_compare_exchange_strong(child_addr, &expected, (uintptr_t) new_internal)) {
+			atomic_fetch_add_explicit(&thread->tree->size, 1, memory_order_relaxed);
+			bst_lf_exit(thread);
+			return 1;
+		}
+
+		// failed - if a remove has marked the edge, help it along
+		if (LF_ADDR(expected) == leaf && (expected & (LF_FLAG | LF_TAG))) {
+			bst_lf_cleanup(thread, data, &seek);
+		}
+	}
+}
+
+
+/*
+ ******************************************************************************
+ * Remove a value from the tree.
+ * First flag the edge to the leaf holding the value (the moment it
+ * leaves the set), then clean up - tag the sibling edge and cut the
+ * leaf and its parent out. If another thread finishes the cleanup
+ * first, so much the better.
+ * Return 1 for sucessful remove, 0 if the value is not present.
+ ******************************************************************************
+ */
+int bst_lf_remove(bst_lf_thread *thread, int data) {
+	struct bst_lf_node *leaf = NULL;
+	struct bst_lf_seek seek;
+	_Atomic uintptr_t *child_addr;
+	uintptr_t expected;
+	int flagged = 0;
+
+	bst_lf_enter(thread);
+	for (;;) {
+		bst_lf_seek(thread->tree, data, &seek);
+
+		if (! flagged) {
+			// injection - find the leaf and flag the edge to it
+			leaf = seek.leaf;
+			if (leaf->key != data || (seek.leaf_field & LF_FLAG)) {
+				bst_lf_exit(thread);
+				return 0;
+			}
+			child_addr = data < seek.parent->key ? &seek.parent->left : &seek.parent->right;
+			expected = (uintptr_t) leaf;
+			if (atomic_compare_exchange_strong(child_addr, &expected, (uintptr_t) leaf | LF_FLAG)) {
+				flagged = 1;
+				atomic_fetch_sub_explicit(&thread->tree->size, 1, memory_order_relaxed);
+				if (bst_lf_cleanup(thread, data, &seek)) break;
+			} else if (LF_ADDR(expected) == leaf && (expected & (LF_FLAG | LF_TAG))) {
+				// another update has marked the edge - help it along
+				bst_lf_cleanup(thread, data, &seek);
+			}
+		} else {
+			// cleanup - unless another thread has already done it
+			if (seek.leaf != leaf) break;
+			if (bst_lf_cleanup(thread, data, &seek)) break;
+		}
+	}
+	bst_lf_exit(thread);
+
+	return 1;
+}
+
+
+/*
+ ******************************************************************************
+ * Return the current size. Exact when no update is in progress.
+ ******************************************************************************
+ */
+long bst_lf_size(bst_lf *tree) {
+	return atomic_load_explicit(&tree->size, memory_order_relaxed);
+}
+
+
+/*
+ ******************************************************************************
+ * Store the keys in sorted order in 'arr', which must have room for
+ * bst_lf_size() values. Only for use while no updates are running.
+ * A Morris traversal: the rightmost leaf of each left subtree is
+ * threaded back to the node above it (with the tag bit set) on the
+ * way down, and unthreaded on the way back, so no stack is needed
+ * and the tree is unchanged on return.
+ ******************************************************************************
+ */
+void bst_lf_inorder_toarray(bst_lf *tree, int *arr) {
+	struct bst_lf_node *node, *pred;
+	uintptr_t left, right;
+
+	node = tree->root;
+	while (node != NULL) {
+		left = atomic_load_explicit(&node->left, memory_order_relaxed);
+
+		if (left == 0) {
+			// a leaf - the keys are in the leaves
+			if (node->key < LF_INF0) *arr++ = (int) node->key;
+			node = LF_ADDR(atomic_load_explicit(&node->right, memory_order_relaxed));
+			continue;
+		}
+
+		// find the rightmost leaf of the left subtree
+		pred = LF_ADDR(left);
+		while (atomic_load_explicit(&pred->left, memory_order_relaxed) != 0) {
+			pred = LF_ADDR(atomic_load_explicit(&pred->right, memory_order_relaxed));
+		}
+
+		right = atomic_load_explicit(&pred->right, memory_order_relaxed);
+		if (right == 0) {
+			// first visit - thread the leaf back to here, go left
+			atomic_store_explicit(&pred->right, (uintptr_t) node | LF_TAG, memory_order_relaxed);
+			node = LF_ADDR(left);
+		} else {
+			// back again via the thread - remove it, go right
+			atomic_store_explicit(&pred->right, 0, memory_order_relaxed);
+			node = LF_ADDR(atomic_load_explicit(&node->right, memory_order_relaxed));
+		}
+	}
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
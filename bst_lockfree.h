@@ -0,0 +1,74 @@
+#ifndef __BST_LOCKFREE_H
+#define __BST_LOCKFREE_H
+
+#include<stdlib.h>
+#include<stdint.h>
+#include<stdatomic.h>
+
+/*
+ * A lock-free set of ints, after Natarajan and Mittal, "Fast Concurrent
+ * Lock-Free Binary Search Trees" (PPoPP 2014).
+ *
+ * The tree is external: the keys live in the leaves, and internal nodes
+ * only route. Removing a key first flags the edge to its leaf, then tags
+ * the edge to the leaf's sibling, and finally swings the edge above the
+ * parent over to the sibling. Marked edges never change again, so any
+ * thread that runs into a half-finished remove can finish it itself.
+ * Every operation is a seek down the tree plus one to three CAS steps -
+ * no thread ever waits for another.
+ *
+ * Unlinked nodes can't be freed straight away, as other threads may
+ * still be reading them. Instead they are retired, and freed by
+ * epoch-based reclamation once every thread has moved on: each
+ * operation announces the global epoch it started in, and the epoch can
+ * only advance once every thread inside an operation has seen it.
+ *
+ * Every thread that uses a tree must register with it first, and pass
+ * its bst_lf_thread to each operation.
+ */
+
+/* a node: internal nodes route, leaves hold the keys */
+struct bst_lf_node {
+	int64_t key;	// wide enough for the three sentinel keys above INT_MAX
+	_Atomic uintptr_t left, right;	// child pointers, with the flag and tag bits
+};
+
+typedef struct bst_lf_thread_s bst_lf_thread;
+
+/* the tree itself - the root sentinel, size and reclamation state */
+typedef struct bst_lf_s {
+	struct bst_lf_node *root;
+	atomic_long size;
+	atomic_ulong epoch;	// the global epoch
+	_Atomic(bst_lf_thread *) threads;	// every thread that has registered
+} bst_lf;
+
+/* a registered thread's epoch and retired nodes */
+struct bst_lf_thread_s {
+	bst_lf *tree;
+	atomic_ulong state;	// epoch << 1 | 1 inside an operation, 0 outside
+	atomic_int in_use;	// 0 once unregistered, so it can be reused
+	unsigned long seen_epoch;
+	struct bst_lf_node **limbo[3];	// retired nodes, by epoch % 3
+	size_t limbo_len[3], limbo_max[3];
+	unsigned long limbo_epoch[3];
+	size_t retired;	// since the last attempt to advance the epoch
+	bst_lf_thread *next;
+};
+
+
+bst_lf *bst_lf_create();
+void bst_lf_destroy(bst_lf *tree);
+bst_lf_thread *bst_lf_register(bst_lf *tree);
+void bst_lf_unregister(bst_lf_thread *thread);
+int bst_lf_insert(bst_lf_thread *thread, int data);
+int bst_lf_search(bst_lf_thread *thread, int data);
+int bst_lf_remove(bst_lf_thread *thread, int data);
+long bst_lf_size(bst_lf *tree);
+void bst_lf_inorder_toarray(bst_lf *tree, int *arr);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,96 @@
+#include "bst_map.h"
+
+/* compile the functions of every map type */
+#define BST_MAP_IMPLEMENT
+#include "bst_map_types.h"
+#undef BST_MAP_IMPLEMENT
+
+
+/* point whatever pointed at 'old' - parent or root - at 'node' */
+static inline void bst_link_replace(struct bst_link **root, struct bst_link *parent,
+		struct bst_link *old, struct bst_link *node) {
+	if (parent == NULL) {
+		*root = node;
+	} else if (parent->left == old) {
+		parent->left = node;
+	} else {
+		parent->right = node;
+	}
+}
+
+/*
+ * Helper functions:
+ * AVL balancing on bst_link nodes - the same code as balances the int
+ * trees in bst.c, from bst_avl_template.h, on links embedded in each
+ * map's own node type.
+ */
+#define BST_AVL_NAME bst_link
+#define BST_AVL_NODE struct bst_link
+#define BST_AVL_TREE struct bst_link **
+#define BST_AVL_REPLACE(t, p, o, n) bst_link_replace((t), (p), (o), (n))
+#define BST_AVL_UPDATE(n) ((void) (n))
+#define BST_AVL_ROTATED(t) ((void) (t))
+#include "bst_avl_template.h"
+
+
+/*
+ ******************************************************************************
+ * Link 'node' into the tree at '*link', the empty child pointer of
+ * 'parent' (or the root) where the search for its key ended, and
+ * rebalance.
+ ******************************************************************************
+ */
+void bst_link_insert(struct bst_link **root, struct bst_link *parent,
+		struct bst_link **link, struct bst_link *node) {
+	node->left = node->right = NULL;
+	node->parent = parent;
+	node->height = 1;
+	*link = node;
+
+	bst_link_retrace(root, parent);
+}
+
+/*
+ ******************************************************************************
+ * Unlink 'node' from the tree, and rebalance. A node with two
+ * children is replaced by its successor - relinked, not copied, as
+ * the map's nodes are bigger than their links.
+ ******************************************************************************
+ */
+void bst_link_erase(struct bst_link **root, struct bst_link *node) {
+	struct bst_link *child, *succ, *retrace;
+
+	if (node->left == NULL || node->right == NULL) {
+		child = node->left ? node->left : node->right;
+		if (child) child->parent = node->parent;
+		bst_link_replace(root, node->parent, node, child);
+		bst_link_retrace(root, node->parent);
+		return;
+	}
+
+	// the successor has no left child: splice it out, unless it is
+	// node->right, then put it where the node was
+	for (succ = node->right; succ->left != NULL; succ = succ->left)
+		;
+	if (succ->parent == node) {
+		retrace = succ;
+	} else {
+		retrace = succ->parent;
+		retrace->left = succ->right;
+		if (succ->right) succ->right->parent = retrace;
+		succ->right = node->right;
+		node->right->parent = succ;
+	}
+	succ->left = node->left;
+	node->left->parent = succ;
+	succ->parent = node->parent;
+	bst_link_replace(root, node->parent, node, succ);
+	succ->height = node->height;
+
+	bst_link_retrace(root, retrace);
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,66 @@
+#ifndef __BST_MAP_H
+#define __BST_MAP_H
+
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+
+#include "bst_pool.h"
+
+/*
+ * Maps from keys to values, for when a tree of ints isn't enough.
+ *
+ * Each map type is generated from bst_map_template.h with its own key
+ * type and comparison, which the compiler inlines into the search
+ * loop - there is no call through a function pointer per node. The
+ * types here all map to a void * value:
+ *
+ *   bst_map_i64    int64_t keys
+ *   bst_map_u64    uint64_t keys
+ *   bst_map_f64    double keys (not NaN)
+ *   bst_map_str    strings of up to BST_MAP_STRLEN - 1 chars, stored
+ *                  in the node (make keys with bst_mapstr_make())
+ *   bst_map_ptr    any keys, by pointer, ordered by a comparator
+ *                  callback given to bst_map_ptr_create()
+ *
+ * For other key or value types - a struct value stored in the node,
+ * say - include bst_map_template.h with your own parameters.
+ */
+
+/* the links of an AVL tree node, shared by every map type */
+struct bst_link {
+	struct bst_link *left, *right;
+	struct bst_link *parent;	// NULL for the root
+	int height;	// of the subtree rooted here
+};
+
+void bst_link_insert(struct bst_link **root, struct bst_link *parent,
+		struct bst_link **link, struct bst_link *node);
+void bst_link_erase(struct bst_link **root, struct bst_link *node);
+
+
+/* a fixed-length string key, '\0' padded so it compares with memcmp() */
+#define BST_MAP_STRLEN 32
+typedef struct bst_mapstr_s {
+	char s[BST_MAP_STRLEN];
+} bst_mapstr;
+
+/*
+ * Make a string key, truncating 'str' if it is too long.
+ */
+static inline bst_mapstr bst_mapstr_make(const char *str) {
+	bst_mapstr key;
+
+	memset(&key, 0, sizeof(key));
+	strncpy(key.s, str, BST_MAP_STRLEN - 1);
+	return key;
+}
+
+
+#include "bst_map_types.h"
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,207 @@
+/*
+ * A key/value map template - deliberately no include guard, as it is
+ * included once per map type, with these defined:
+ *
+ *   BST_MAP_NAME           the map type, and the prefix of its functions
+ *   BST_MAP_KEY            the key type, passed by value
+ *   BST_MAP_VALUE          the value type, stored in the node
+ *   BST_MAP_CMP(m, a, b)   compare keys a and b of map m: < 0, 0 or > 0
+ *
+ * and, if BST_MAP_CMP calls the map's comparator m->cmp,
+ *
+ *   BST_MAP_WITH_CMP       create() takes the comparator, and refuses NULL
+ *
+ * Included without BST_MAP_IMPLEMENT, it declares the map type and its
+ * functions; with it, in the one file that compiles them, it defines
+ * the functions. BST_MAP_CMP is expanded straight into the search
+ * loops, so for the specializations in bst_map.h it is inlined;
+ * bst_map_ptr shows how a comparator callback goes through the same
+ * template.
+ *
+ * Every map is an AVL tree of bst_link nodes (see bst_map.h), so only
+ * the descent to a key is generated here - the balancing is shared.
+ * The parameters are #undef'ed at the end, ready for the next map.
+ */
+
+#define BST_MAP_CAT_(a, b) a##_##b
+#define BST_MAP_CAT(a, b) BST_MAP_CAT_(a, b)
+#define BST_MAP_FN(f) BST_MAP_CAT(BST_MAP_NAME, f)
+
+#ifdef BST_MAP_WITH_CMP
+#define BST_MAP_CREATE_ARGS int (*cmp)(const void *a, const void *b)
+#else
+#define BST_MAP_CREATE_ARGS void
+#endif
+
+#ifndef BST_MAP_IMPLEMENT
+
+/* a node: the links first, so a struct bst_link * is a node pointer */
+struct BST_MAP_FN(node) {
+	struct bst_link link;
+	BST_MAP_KEY key;
+	BST_MAP_VALUE value;
+};
+
+/* the map itself - the root, the size and the node pool */
+typedef struct BST_MAP_FN(s) {
+	struct bst_link *root;
+	size_t size;
+	bst_pool pool;
+	int (*cmp)(const void *a, const void *b);	// for BST_MAP_CMP, if it wants one
+} BST_MAP_NAME;
+
+
+BST_MAP_NAME *BST_MAP_FN(create)(BST_MAP_CREATE_ARGS);
+void BST_MAP_FN(destroy)(BST_MAP_NAME *map);
+int BST_MAP_FN(insert)(BST_MAP_NAME *map, BST_MAP_KEY key, BST_MAP_VALUE value);
+BST_MAP_VALUE *BST_MAP_FN(get)(BST_MAP_NAME *map, BST_MAP_KEY key);
+int BST_MAP_FN(remove)(BST_MAP_NAME *map, BST_MAP_KEY key, BST_MAP_VALUE *value_out);
+size_t BST_MAP_FN(size)(BST_MAP_NAME *map);
+
+#else
+
+/*
+ ******************************************************************************
+ * Create a new, empty map - with BST_MAP_WITH_CMP, ordering its keys
+ * with 'cmp', which returns < 0, 0 or > 0 as strcmp() does.
+ * Return the new pointer, or NULL if out of memory (or 'cmp' is NULL).
+ ******************************************************************************
+ */
+BST_MAP_NAME *BST_MAP_FN(create)(BST_MAP_CREATE_ARGS) {
+	BST_MAP_NAME *map;
+
+#ifdef BST_MAP_WITH_CMP
+	if (cmp == NULL) return NULL;
+#endif
+	if (! (map = (BST_MAP_NAME *) malloc(sizeof(BST_MAP_NAME)))) return NULL;
+	map->root = NULL;
+	map->size = 0;
+#ifdef BST_MAP_WITH_CMP
+	map->cmp = cmp;
+#else
+	map->cmp = NULL;
+#endif
+	bst_pool_init(&map->pool, sizeof(struct BST_MAP_FN(node)));
+
+	return map;
+}
+
+/*
+ ******************************************************************************
+ * Destroy the map, freeing all memory.
+ ******************************************************************************
+ */
+void BST_MAP_FN(destroy)(BST_MAP_NAME *map) {
+	if (map == NULL) {
+		// nothing to do!
+		return;
+	}
+
+	bst_pool_destroy(&map->pool);
+	free(map);
+}
+
+/*
+ ******************************************************************************
+ * Insert a key and its value. Do not insert duplicate keys - use
+ * get() to change the value of a key already present.
+ * Return 1 for sucessful insert, 0 for failure.
+ ******************************************************************************
+ */
+int BST_MAP_FN(insert)(BST_MAP_NAME *map, BST_MAP_KEY key, BST_MAP_VALUE value) {
+	struct bst_link **link = &map->root, *parent = NULL;
+	struct BST_MAP_FN(node) *node;
+	int cmp;
+
+	while (*link != NULL) {
+		node = (struct BST_MAP_FN(node) *) *link;
+		cmp = BST_MAP_CMP(map, key, node->key);
+		if (cmp == 0) return 0;	// duplicates
+		parent = *link;
+		link = cmp < 0 ? &parent->left : &parent->right;
+	}
+
+	if (! (node = (struct BST_MAP_FN(node) *) bst_pool_alloc(&map->pool))) return 0;
+	node->key = key;
+	node->value = value;
+	bst_link_insert(&map->root, parent, link, &node->link);
+	map->size++;
+
+	return 1;
+}
+
+/*
+ * Helper function:
+ * Return the node holding 'key', or NULL.
+ */
+static inline struct BST_MAP_FN(node) *BST_MAP_FN(find)(BST_MAP_NAME *map, BST_MAP_KEY key) {
+	struct bst_link *link = map->root;
+	struct BST_MAP_FN(node) *node;
+	int cmp;
+
+	while (link != NULL) {
+		node = (struct BST_MAP_FN(node) *) link;
+		cmp = BST_MAP_CMP(map, key, node->key);
+		if (cmp == 0) return node;
+		link = cmp < 0 ? link->left : link->right;
+	}
+	return NULL;
+}
+
+/*
+ ******************************************************************************
+ * Search for a key.
+ * Return a pointer to its value, which may be updated in place, or
+ * NULL if the key is not present. The pointer is valid until the key
+ * is removed.
+ ******************************************************************************
+ */
+BST_MAP_VALUE *BST_MAP_FN(get)(BST_MAP_NAME *map, BST_MAP_KEY key) {
+	struct BST_MAP_FN(node) *node = BST_MAP_FN(find)(map, key);
+
+	return node ? &node->value : NULL;
+}
+
+/*
+ ******************************************************************************
+ * Remove a key, storing its value at 'value_out' unless that is NULL.
+ * Return 1 for sucessful remove, 0 if the key is not present.
+ ******************************************************************************
+ */
+int BST_MAP_FN(remove)(BST_MAP_NAME *map, BST_MAP_KEY key, BST_MAP_VALUE *value_out) {
+	struct BST_MAP_FN(node) *node = BST_MAP_FN(find)(map, key);
+
+	if (node == NULL) return 0;
+	if (value_out) *value_out = node->value;
+
+	bst_link_erase(&map->root, &node->link);
+	bst_pool_free(&map->pool, node);
+	map->size--;
+
+	return 1;
+}
+
+/*
+ ******************************************************************************
+ * Return the number of keys.
+ ******************************************************************************
+ */
+size_t BST_MAP_FN(size)(BST_MAP_NAME *map) {
+	return map->size;
+}
+
+#endif
+
+#undef BST_MAP_NAME
+#undef BST_MAP_KEY
+#undef BST_MAP_VALUE
+#undef BST_MAP_CMP
+#undef BST_MAP_WITH_CMP
+#undef BST_MAP_CREATE_ARGS
+#undef BST_MAP_FN
+#undef BST_MAP_CAT
+#undef BST_MAP_CAT_
+
+/*
+ * vim:ts=4:sw=4
+ */
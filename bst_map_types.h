@@ -0,0 +1,40 @@
+/*
+ * The map types of bst_map.h, one instantiation of bst_map_template.h
+ * each. No include guard: bst_map.c includes this a second time, with
+ * BST_MAP_IMPLEMENT defined, to compile their functions.
+ */
+
+#define BST_MAP_NAME bst_map_i64
+#define BST_MAP_KEY int64_t
+#define BST_MAP_VALUE void *
+#define BST_MAP_CMP(m, a, b) (((a) > (b)) - ((a) < (b)))
+#include "bst_map_template.h"
+
+#define BST_MAP_NAME bst_map_u64
+#define BST_MAP_KEY uint64_t
+#define BST_MAP_VALUE void *
+#define BST_MAP_CMP(m, a, b) (((a) > (b)) - ((a) < (b)))
+#include "bst_map_template.h"
+
+#define BST_MAP_NAME bst_map_f64
+#define BST_MAP_KEY double
+#define BST_MAP_VALUE void *
+#define BST_MAP_CMP(m, a, b) (((a) > (b)) - ((a) < (b)))
+#include "bst_map_template.h"
+
+#define BST_MAP_NAME bst_map_str
+#define BST_MAP_KEY bst_mapstr
+#define BST_MAP_VALUE void *
+#define BST_MAP_CMP(m, a, b) memcmp((a).s, (b).s, BST_MAP_STRLEN)
+#include "bst_map_template.h"
+
+#define BST_MAP_NAME bst_map_ptr
+#define BST_MAP_KEY const void *
+#define BST_MAP_VALUE void *
+#define BST_MAP_CMP(m, a, b) (m)->cmp((a), (b))
+#define BST_MAP_WITH_CMP
+#include "bst_map_template.h"
+
+/*
+ * vim:ts=4:sw=4
+ */
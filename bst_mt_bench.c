@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "bst.h"
+#include "bst_lockfree.h"
+
+#define N 1000000
+#define DURATION 1000
+#define SEED 97
+
+
+/*
+ * Purpose:
+ * Measure how search throughput on one shared tree scales with the
+ * number of reader threads, while a writer thread keeps inserting
+ * and removing keys.
+ *
+ * For each reader count from 1 to the number of cores (or -t), three
+ * ways of sharing a tree are compared: an AVL tree with every call
+ * wrapped in one global mutex, a BST_THREADSAFE AVL tree, where readers
+ * share the tree's read lock, and the lock-free tree. Each line of
+ * output is
+ *
+ *   READERS MUTEX reads/s writes/s RWLOCK reads/s writes/s LOCKFREE reads/s writes/s
+ *
+ * With -r, it measures bst_parallel_reduce() instead: the sum of the
+ * keys of an AVL tree and a wide tree of TREE_SIZE keys, on 1 to the
+ * number of cores (or -t) threads, against a plain walk with a cursor
+ * on one thread. Each line of output is
+ *
+ *   THREADS AVL ms speedup WIDE ms speedup
+ */
+
+
+/* what each thread needs to know */
+struct worker {
+	pthread_t thread;
+	bst *tree;
+	pthread_mutex_t *mutex;	// NULL for the BST_THREADSAFE tree
+	bst_lf *lf;	// set for the lock-free tree instead
+	int n;
+	unsigned short seed[3];
+	long ops;
+};
+
+/* set when the time is up */
+static volatile int stop;
+
+
+void usage(char arg0[]) {
+	fprintf(stderr, "Usage: %s [-n TREE_SIZE] [-d DURATION_MS] [-t MAX_READERS] [-r]\n", arg0);
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Reader thread: random searches until told to stop.
+ */
+void *reader(void *arg) {
+	struct worker *w = (struct worker *) arg;
+	bst_lf_thread *me = w->lf ? bst_lf_register(w->lf) : NULL;
+	int k;
+
+	while (! stop) {
+		k = (int)(2.0 * w->n * erand48(w->seed));
+		if (me) {
+			bst_lf_search(me, k);
+		} else if (w->mutex) {
+			pthread_mutex_lock(w->mutex);
+			bst_search(w->tree, k);
+			pthread_mutex_unlock(w->mutex);
+		} else {
+			bst_search(w->tree, k);
+		}
+		w->ops++;
+	}
+	if (me) bst_lf_unregister(me);
+	return NULL;
+}
+
+
+/*
+ * Writer thread: alternately insert and remove random keys, so the
+ * tree stays about the same size.
+ */
+void *writer(void *arg) {
+	struct worker *w = (struct worker *) arg;
+	bst_lf_thread *me = w->lf ? bst_lf_register(w->lf) : NULL;
+	int k;
+
+	while (! stop) {
+		k = (int)(2.0 * w->n * erand48(w->seed));
+		if (me) {
+			if (w->ops & 1) {
+				bst_lf_remove(me, k);
+			} else {
+				bst_lf_insert(me, k);
+			}
+			w->ops++;
+			continue;
+		}
+		if (w->mutex) pthread_mutex_lock(w->mutex);
+		if (w->ops & 1) {
+			bst_remove(w->tree, k);
+		} else {
+			bst_insert(w->tree, k);
+		}
+		if (w->mutex) pthread_mutex_unlock(w->mutex);
+		w->ops++;
+	}
+	if (me) bst_lf_unregister(me);
+	return NULL;
+}
+
+
+/*
+ * Run 'readers' reader threads and one writer thread against the
+ * tree for 'duration' milliseconds, and print the operations per
+ * second of each kind.
+ */
+void run(bst *tree, pthread_mutex_t *mutex, bst_lf *lf, int n, int readers, int duration) {
+	struct worker *w;
+	struct timeval start, end;
+	double elapsed;
+	long reads = 0;
+	int i;
+
+	if (! (w = (struct worker *) calloc(readers + 1, sizeof(struct worker)))) exit(EXIT_FAILURE);
+
+	stop = 0;
+	gettimeofday(&start, NULL);
+	for (i=0; i<=readers; i++) {
+		w[i].tree = tree;
+		w[i].mutex = mutex;
+		w[i].lf = lf;
+		w[i].n = n;
+		w[i].seed[0] = SEED;
+		w[i].seed[1] = i;
+		pthread_create(&w[i].thread, NULL, i < readers ? reader : writer, &w[i]);
+	}
+
+	usleep(duration * 1000);
+	stop = 1;
+
+	for (i=0; i<=readers; i++) {
+		pthread_join(w[i].thread, NULL);
+		if (i < readers) reads += w[i].ops;
+	}
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;	// seconds
+
+	printf("%.0f %.0f ", reads / elapsed, w[readers].ops / elapsed);
+
+	free(w);
+}
+
+
+/*
+ * Build an AVL tree of about 'n' random keys in [0, 2n).
+ */
+bst *build(int type, int n) {
+	bst *tree = bst_create_type(type);
+	int i;
+
+	srand48(SEED);
+	for (i=0; i<n; i++) {
+		bst_insert(tree, (int)(2.0 * n * drand48()));
+	}
+	return tree;
+}
+
+
+/*
+ * The same keys in a lock-free tree.
+ */
+bst_lf *build_lockfree(int n) {
+	bst_lf *tree = bst_lf_create();
+	bst_lf_thread *me = bst_lf_register(tree);
+	int i;
+
+	srand48(SEED);
+	for (i=0; i<n; i++) {
+		bst_lf_insert(me, (int)(2.0 * n * drand48()));
+	}
+	bst_lf_unregister(me);
+	return tree;
+}
+
+
+/*
+ * The map and reduce of a sum, for bst_parallel_reduce().
+ */
+void sum_map(bst_key key, void *acc, void *ctx) {
+	(void) ctx;
+	*(long long *) acc += key;
+}
+
+void sum_reduce(void *acc, const void *other, void *ctx) {
+	(void) ctx;
+	*(long long *) acc += *(const long long *) other;
+}
+
+double now_ms() {
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return t.tv_sec * 1e3 + t.tv_usec / 1e3;
+}
+
+/*
+ * Sum the keys of 'tree' on 'threads' threads (0 for a cursor walk
+ * on this one), and return the milliseconds taken. The sums are
+ * checked against each other.
+ */
+double time_reduce(bst *tree, int threads) {
+	static long long expect;
+	long long sum = 0;
+	bst_iter_t it;
+	double start = now_ms(), ms;
+	int ok;
+
+	if (threads == 0) {
+		for (ok = bst_iter_first(&it, tree); ok; ok = bst_iter_next(&it)) {
+			sum += bst_iter_key(&it);
+		}
+		ms = now_ms() - start;
+		expect = sum;
+	} else {
+		bst_parallel_reduce(tree, sum_map, sum_reduce, NULL, threads, &sum, sizeof(sum));
+		ms = now_ms() - start;
+		if (sum != expect) {
+			fprintf(stderr, "reduce on %d threads: sum %lld, expected %lld\n", threads, sum, expect);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return ms;
+}
+
+/*
+ * The -r mode: bst_parallel_reduce() over trees of about 'n' keys.
+ */
+void reduce_bench(int n, int max_threads) {
+	bst *avl = bst_create_type(BST_AVL), *wide = bst_create_type(BST_WIDE);
+	bst_key *keys;
+	double avl_serial, wide_serial, avl_ms, wide_ms;
+	int i, threads;
+
+	if (! (keys = (bst_key *) malloc(n * sizeof(bst_key)))) exit(EXIT_FAILURE);
+	srand48(SEED);
+	for (i=0; i<n; i++) {
+		keys[i] = (bst_key)(2.0 * n * drand48());
+	}
+	if (! bst_insert_bulk(avl, keys, n, max_threads) || ! bst_insert_bulk(wide, keys, n, max_threads)) {
+		exit(EXIT_FAILURE);
+	}
+	free(keys);
+
+	for (threads=1; threads<=max_threads; threads++) {
+		avl_serial = time_reduce(avl, 0);
+		avl_ms = time_reduce(avl, threads);
+		wide_serial = time_reduce(wide, 0);
+		wide_ms = time_reduce(wide, threads);
+		printf("%d AVL %.1f %.2f WIDE %.1f %.2f\n", threads,
+				avl_ms, avl_serial / avl_ms, wide_ms, wide_serial / wide_ms);
+		fflush(stdout);
+	}
+
+	bst_destroy(avl);
+	bst_destroy(wide);
+}
+
+
+int main(int argc, char *argv[]) {
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	bst *shared, *locked;
+	bst_lf *lockfree;
+	int n = N;
+	int duration = DURATION;
+	int max_readers = sysconf(_SC_NPROCESSORS_ONLN);
+	int readers;
+	int reduce = 0;
+
+	/* for getopt */
+	int opt;
+
+	/* process args */
+	while ((opt = getopt(argc, argv, "n:d:t:rh")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = atoi(optarg);
+				break;
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 't':
+				max_readers = atoi(optarg);
+				break;
+			case 'r':
+				reduce = 1;
+				break;
+			case 'h':
+			default: /* '?' */
+				usage(argv[0]);
+		}
+	}
+	if (max_readers < 1) max_readers = 1;
+
+	if (reduce) {
+		reduce_bench(n, max_readers);
+		return(0);
+	}
+
+	/* the same keys in every tree */
+	shared = build(BST_AVL, n);
+	locked = build(BST_AVL | BST_THREADSAFE, n);
+	lockfree = build_lockfree(n);
+
+	for (readers=1; readers<=max_readers; readers++) {
+		printf("%d MUTEX ", readers);
+		run(shared, &mutex, NULL, n, readers, duration);
+		printf("RWLOCK ");
+		run(locked, NULL, NULL, n, readers, duration);
+		printf("LOCKFREE ");
+		run(NULL, NULL, lockfree, n, readers, duration);
+		printf("\n");
+		fflush(stdout);
+	}
+
+	/* tidy up */
+	bst_destroy(shared);
+	bst_destroy(locked);
+	bst_lf_destroy(lockfree);
+
+	return(0);
+}
+
+
+
+/*
+ * vim:ts=4:sw=4
+ */
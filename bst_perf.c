@@ -0,0 +1,167 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "bst_perf.h"
+
+static const char *bst_perf_names[BST_PERF_NCOUNTERS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses"
+};
+
+
+#ifdef __linux__
+
+/* the event behind each counter */
+#define BST_PERF_CACHE(cache, op, result) \
+	((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} bst_perf_events[BST_PERF_NCOUNTERS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, BST_PERF_CACHE(PERF_COUNT_HW_CACHE_L1D,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	{PERF_TYPE_HW_CACHE, BST_PERF_CACHE(PERF_COUNT_HW_CACHE_DTLB,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+};
+
+
+/*
+ * Helper function:
+ * Read a counter, scaled up for any time it wasn't scheduled on the PMU.
+ * Return 0 if it can't be read.
+ */
+static double bst_perf_read(int fd) {
+	uint64_t v[3];	// value, time enabled, time running
+
+	if (read(fd, v, sizeof(v)) != sizeof(v)) return 0;
+	if (v[2] == 0) return 0;
+	if (v[2] < v[1]) return (double) v[0] * v[1] / v[2];
+	return (double) v[0];
+}
+
+
+/*
+ ******************************************************************************
+ * Open and start the counters, for the calling thread.
+ * Return how many could be opened - 0 where there are no counters.
+ ******************************************************************************
+ */
+int bst_perf_open(bst_perf *perf) {
+	struct perf_event_attr attr;
+	int i;
+
+	memset(perf, 0, sizeof(bst_perf));
+
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = bst_perf_events[i].type;
+		attr.config = bst_perf_events[i].config;
+		attr.exclude_kernel = 1;	// all that perf_event_paranoid 2 allows
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		perf->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (perf->fd[i] >= 0) {
+			perf->available++;
+		} else if (perf->error == 0) {
+			perf->error = errno;
+		}
+	}
+	return perf->available;
+}
+
+/*
+ ******************************************************************************
+ * Close the counters. The counts are kept.
+ ******************************************************************************
+ */
+void bst_perf_close(bst_perf *perf) {
+	int i;
+
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		if (perf->fd[i] >= 0) close(perf->fd[i]);
+		perf->fd[i] = -1;
+	}
+	perf->available = 0;
+}
+
+/*
+ ******************************************************************************
+ * Mark the start, and the stop, of a stretch of code to count. The
+ * counts in between are added to 'count'. The counters run all the
+ * time, so this costs a read() per counter at each end and nothing in
+ * between.
+ ******************************************************************************
+ */
+void bst_perf_start(bst_perf *perf) {
+	int i;
+
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		if (perf->fd[i] >= 0) perf->start[i] = bst_perf_read(perf->fd[i]);
+	}
+}
+
+void bst_perf_stop(bst_perf *perf) {
+	double end[BST_PERF_NCOUNTERS];
+	int i;
+
+	// read them all first, so the later reads count less of the earlier ones
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		if (perf->fd[i] >= 0) end[i] = bst_perf_read(perf->fd[i]);
+	}
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		if (perf->fd[i] >= 0) perf->count[i] += end[i] - perf->start[i];
+	}
+}
+
+#else
+
+/* no perf events - there are never any counters */
+int bst_perf_open(bst_perf *perf) {
+	int i;
+
+	memset(perf, 0, sizeof(bst_perf));
+	for (i=0; i<BST_PERF_NCOUNTERS; i++) {
+		perf->fd[i] = -1;
+	}
+	perf->error = ENOSYS;
+	return 0;
+}
+
+void bst_perf_close(bst_perf *perf) {
+}
+
+void bst_perf_start(bst_perf *perf) {
+}
+
+void bst_perf_stop(bst_perf *perf) {
+}
+
+#endif
+
+
+/*
+ ******************************************************************************
+ * Return the name of a counter, as the benchmarks print it.
+ ******************************************************************************
+ */
+const char *bst_perf_name(int counter) {
+	return bst_perf_names[counter];
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,48 @@
+#ifndef __BST_PERF_H
+#define __BST_PERF_H
+
+#include<stdint.h>
+
+/*
+ * Hardware performance counters, read with perf_event_open(2), for
+ * telling why a batch of tree operations got slower: more cache
+ * misses, more branch mispredictions, or more TLB misses.
+ *
+ * Each counter is opened on its own, counting user space in the
+ * calling thread only, so one the CPU (or VM) lacks doesn't take the
+ * others with it. Where counters can't be had at all - not Linux, a
+ * kernel without perf events, a container whose seccomp profile or
+ * perf_event_paranoid forbids them - bst_perf_open() just reports
+ * none, and start/stop do nothing. When the PMU is shared out between
+ * more counters than it has, the counts are scaled up by the fraction
+ * of the time each was actually running.
+ */
+enum {
+	BST_PERF_CYCLES,
+	BST_PERF_INSTRUCTIONS,
+	BST_PERF_L1D_MISSES,	// L1 data cache read misses
+	BST_PERF_LLC_MISSES,	// last level cache misses
+	BST_PERF_BRANCH_MISSES,
+	BST_PERF_DTLB_MISSES,	// data TLB read misses
+	BST_PERF_NCOUNTERS
+};
+
+typedef struct bst_perf_s {
+	int fd[BST_PERF_NCOUNTERS];	// -1 for a counter that isn't available
+	double start[BST_PERF_NCOUNTERS];	// the scaled counts at bst_perf_start()
+	double count[BST_PERF_NCOUNTERS];	// summed over each start/stop
+	int available;	// how many of the counters opened
+	int error;	// errno of the first counter that didn't
+} bst_perf;
+
+int bst_perf_open(bst_perf *perf);
+void bst_perf_close(bst_perf *perf);
+void bst_perf_start(bst_perf *perf);
+void bst_perf_stop(bst_perf *perf);
+const char *bst_perf_name(int counter);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,247 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "bst_pool.h"
+
+/* the first chunk is small, so tiny trees stay tiny */
+#define POOL_MIN_CHUNK 64
+/* chunks stop growing here (2 MB of 32 byte nodes) */
+#define POOL_MAX_CHUNK 65536
+
+/* guards the chunk lists and rings of pools sharing chunks */
+static pthread_mutex_t bst_pool_share_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ ******************************************************************************
+ * Initialise an empty pool of nodes of 'node_size' bytes.
+ * No memory is allocated until the first node is.
+ ******************************************************************************
+ */
+void bst_pool_init(bst_pool *pool, size_t node_size) {
+	// every node must be able to hold the free list link
+	if (node_size < sizeof(void *)) node_size = sizeof(void *);
+
+	pool->node_size   = node_size;
+	pool->free_list   = NULL;
+	pool->next        = NULL;
+	pool->end         = NULL;
+	pool->chunk_nodes = POOL_MIN_CHUNK;
+	pool->chunks      = NULL;
+	pool->nchunks     = 0;
+	pool->max_chunks  = 0;
+	pool->bytes       = 0;
+	pool->share_prev  = pool;
+	pool->share_next  = pool;
+}
+
+
+/*
+ * Helper function:
+ * Move the chunks of 'src' to the end of the list of 'dst'.
+ * The caller holds bst_pool_share_lock.
+ * Return 1 on success, 0 if out of memory.
+ */
+static int bst_pool_take_chunks(bst_pool *dst, bst_pool *src) {
+	size_t max_chunks = dst->max_chunks;
+
+	if (src->nchunks == 0) return 1;
+
+	// make room to remember them all
+	while (dst->nchunks + src->nchunks > max_chunks) {
+		max_chunks = max_chunks ? 2 * max_chunks : 16;
+	}
+	if (max_chunks != dst->max_chunks) {
+		void **chunks = (void **) realloc(dst->chunks, max_chunks * sizeof(void *));
+
+		if (chunks == NULL) return 0;
+		dst->chunks = chunks;
+		dst->max_chunks = max_chunks;
+	}
+
+	memcpy(dst->chunks + dst->nchunks, src->chunks, src->nchunks * sizeof(void *));
+	dst->nchunks += src->nchunks;
+	dst->bytes += src->bytes;
+
+	free(src->chunks);
+	src->chunks = NULL;
+	src->nchunks = src->max_chunks = 0;
+	src->bytes = 0;
+
+	return 1;
+}
+
+/*
+ * Helper function:
+ * Take 'pool' out of its ring. The caller holds bst_pool_share_lock.
+ */
+static void bst_pool_unlink(bst_pool *pool) {
+	pool->share_prev->share_next = pool->share_next;
+	pool->share_next->share_prev = pool->share_prev;
+	pool->share_prev = pool->share_next = pool;
+}
+
+
+/*
+ ******************************************************************************
+ * Free every chunk, and so every node, in the pool - unless other
+ * pools still hold nodes in its chunks, in which case the chunks are
+ * handed to one of them.
+ * The pool is left empty and can be used again.
+ ******************************************************************************
+ */
+void bst_pool_destroy(bst_pool *pool) {
+	size_t i;
+
+	pthread_mutex_lock(&bst_pool_share_lock);
+	if (pool->share_next != pool) {
+		// if this fails the chunks leak - the others' nodes are in them
+		bst_pool_take_chunks(pool->share_next, pool);
+		bst_pool_unlink(pool);
+		pthread_mutex_unlock(&bst_pool_share_lock);
+		free(pool->chunks);
+		bst_pool_init(pool, pool->node_size);
+		return;
+	}
+	pthread_mutex_unlock(&bst_pool_share_lock);
+
+	for (i=0; i<pool->nchunks; i++) {
+		free(pool->chunks[i]);
+	}
+	free(pool->chunks);
+
+	bst_pool_init(pool, pool->node_size);
+}
+
+
+/*
+ * Helper function:
+ * Allocate a chunk of 'n' nodes and remember it for destroy.
+ * Return NULL if out of memory.
+ */
+static char *bst_pool_add_chunk(bst_pool *pool, size_t n) {
+	void *chunk;
+
+	if (posix_memalign(&chunk, BST_POOL_ALIGN, n * pool->node_size) != 0) return NULL;
+
+	pthread_mutex_lock(&bst_pool_share_lock);
+
+	// make room to remember the new chunk
+	if (pool->nchunks == pool->max_chunks) {
+		size_t max_chunks = pool->max_chunks ? 2 * pool->max_chunks : 16;
+		void **chunks = (void **) realloc(pool->chunks, max_chunks * sizeof(void *));
+
+		if (chunks == NULL) {
+			pthread_mutex_unlock(&bst_pool_share_lock);
+			free(chunk);
+			return NULL;
+		}
+		pool->chunks = chunks;
+		pool->max_chunks = max_chunks;
+	}
+
+	pool->chunks[pool->nchunks++] = chunk;
+	pool->bytes += n * pool->node_size;
+
+	pthread_mutex_unlock(&bst_pool_share_lock);
+
+	return (char *) chunk;
+}
+
+
+/*
+ ******************************************************************************
+ * Slow path of bst_pool_alloc(): the newest chunk is used up, so
+ * allocate another, twice the size of the last one (up to a limit),
+ * and return its first node.
+ * Return NULL if out of memory.
+ ******************************************************************************
+ */
+void *bst_pool_grow(bst_pool *pool) {
+	char *chunk;
+
+	if (! (chunk = bst_pool_add_chunk(pool, pool->chunk_nodes))) return NULL;
+
+	// hand out the first node, keep the rest for bump allocation
+	pool->next = chunk + pool->node_size;
+	pool->end  = chunk + pool->chunk_nodes * pool->node_size;
+
+	if (pool->chunk_nodes < POOL_MAX_CHUNK) pool->chunk_nodes *= 2;
+
+	return chunk;
+}
+
+
+/*
+ ******************************************************************************
+ * Allocate 'n' nodes as one contiguous array, in a chunk of their own.
+ * The nodes belong to the pool like any other: they can be freed
+ * one at a time, and are released by bst_pool_destroy().
+ * Return NULL if out of memory (or 'n' is zero).
+ ******************************************************************************
+ */
+void *bst_pool_alloc_block(bst_pool *pool, size_t n) {
+	if (n == 0 || n > (size_t) -1 / pool->node_size) return NULL;
+
+	return bst_pool_add_chunk(pool, n);
+}
+
+
+
+/*
+ ******************************************************************************
+ * Let the empty pool 'other' hold nodes from the chunks of 'pool',
+ * by adding it to the ring of pools sharing them.
+ ******************************************************************************
+ */
+void bst_pool_share(bst_pool *pool, bst_pool *other) {
+	pthread_mutex_lock(&bst_pool_share_lock);
+	other->share_prev = pool;
+	other->share_next = pool->share_next;
+	pool->share_next->share_prev = other;
+	pool->share_next = other;
+	pthread_mutex_unlock(&bst_pool_share_lock);
+}
+
+/*
+ ******************************************************************************
+ * Hand all the nodes of pool 'src' over to 'dst': its chunks, its free
+ * list if 'dst' has none (otherwise its free nodes are only reclaimed
+ * with the chunks), and its place in any ring of shared chunks.
+ * Costs O(chunks), not O(nodes). 'src' is left empty.
+ * Return 1 on success, 0 if out of memory ('src' is then unchanged).
+ ******************************************************************************
+ */
+int bst_pool_merge(bst_pool *dst, bst_pool *src) {
+	bst_pool *p;
+
+	pthread_mutex_lock(&bst_pool_share_lock);
+	if (! bst_pool_take_chunks(dst, src)) {
+		pthread_mutex_unlock(&bst_pool_share_lock);
+		return 0;
+	}
+	if (dst->free_list == NULL) {
+		dst->free_list = src->free_list;
+	}
+
+	// join the two rings into one, unless they are one already
+	for (p = dst->share_next; p != dst && p != src; p = p->share_next);
+	if (p == dst) {
+		bst_pool *dst_next = dst->share_next, *src_prev = src->share_prev;
+
+		dst->share_next = src;
+		src->share_prev = dst;
+		src_prev->share_next = dst_next;
+		dst_next->share_prev = src_prev;
+	}
+	bst_pool_unlink(src);
+	pthread_mutex_unlock(&bst_pool_share_lock);
+
+	bst_pool_init(src, src->node_size);
+	return 1;
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,78 @@
+#ifndef __BST_POOL_H
+#define __BST_POOL_H
+
+#include<stdlib.h>
+
+/*
+ * A pool of fixed-size nodes, carved out of large chunks.
+ *
+ * Allocation pops the free list, or else bumps a pointer through the
+ * newest chunk, so the common case never calls malloc and consecutive
+ * nodes sit next to each other in memory. Chunks start on a cache line,
+ * so nodes whose size is a multiple of one never straddle more lines
+ * than they must. Freed nodes are pushed on
+ * the free list (linked through their first word) for reuse. Chunks are
+ * only ever returned to the system all at once, by bst_pool_destroy(),
+ * which costs O(chunks) rather than O(nodes).
+ *
+ * Nodes can move between pools without being copied (see bst_split()
+ * and bst_join()). Pools that hold nodes in each other's chunks are
+ * linked in a ring, and a pool destroyed while others share its
+ * chunks hands them on rather than freeing them; the last one frees
+ * them all. The chunk lists of sharing pools may change from any of
+ * them, so they are only touched under a lock, which the bump and free
+ * list fast paths never take.
+ */
+#define BST_POOL_ALIGN 64	// bytes - a cache line
+
+typedef struct bst_pool_s {
+	size_t node_size;	// bytes per node, at least a pointer
+	void *free_list;	// nodes freed back to the pool
+	char *next, *end;	// unused tail of the newest chunk
+	size_t chunk_nodes;	// nodes in the next chunk - grows geometrically
+	void **chunks;		// every chunk allocated, for destroy
+	size_t nchunks, max_chunks;
+	size_t bytes;		// total size of the chunks
+	struct bst_pool_s *share_prev, *share_next;	// the ring of pools sharing chunks
+} bst_pool;
+
+void bst_pool_init(bst_pool *pool, size_t node_size);
+void bst_pool_destroy(bst_pool *pool);
+void *bst_pool_grow(bst_pool *pool);
+void *bst_pool_alloc_block(bst_pool *pool, size_t n);
+void bst_pool_share(bst_pool *pool, bst_pool *other);
+int bst_pool_merge(bst_pool *dst, bst_pool *src);
+
+
+/*
+ * Allocate one node from the pool.
+ * Return NULL if a new chunk was needed and could not be allocated.
+ */
+static inline void *bst_pool_alloc(bst_pool *pool) {
+	void *node;
+
+	if ((node = pool->free_list) != NULL) {
+		pool->free_list = *(void **)node;
+		return node;
+	}
+	if (pool->next < pool->end) {
+		node = pool->next;
+		pool->next += pool->node_size;
+		return node;
+	}
+	return bst_pool_grow(pool);
+}
+
+/*
+ * Return a node to the pool for reuse.
+ */
+static inline void bst_pool_free(bst_pool *pool, void *node) {
+	*(void **)node = pool->free_list;
+	pool->free_list = node;
+}
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
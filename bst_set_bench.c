@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "bst.h"
+
+#define N 1000000
+#define MAX_RATIO 1000
+#define SEED 97
+
+
+/*
+ * Purpose:
+ * Compare bst_union(), bst_intersect() and bst_difference() with the
+ * loops of bst_search() and bst_insert() they replace, on a tree A of
+ * 'n' random keys and a tree B of n/ratio, for ratios 1, 10, 100 ...
+ * up to -r. Both trees draw from [0, 2n), so about half of B is in A.
+ *
+ * The naive union inserts every key of A, then every key of B not
+ * already there; the naive intersection looks up each key of the
+ * smaller tree, B, in A; the naive difference A - B looks up each key
+ * of A in B. Each line of output is
+ *
+ *   RATIO r N n M m UNION naive fast INTERSECT naive fast DIFFERENCE naive fast
+ *
+ * with the times in microseconds.
+ */
+
+
+void usage(char arg0[]) {
+	fprintf(stderr, "Usage: %s [-n TREE_SIZE] [-r MAX_RATIO]\n", arg0);
+	exit(EXIT_FAILURE);
+}
+
+
+/*
+ * Return the time in microseconds since some fixed point.
+ */
+double now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/*
+ * Return an AVL tree of up to 'n' random keys from [0, range).
+ */
+bst *random_tree(size_t n, size_t range) {
+	bst *my_tree = bst_create_type(BST_AVL);
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		bst_insert(my_tree, (bst_key)(range * drand48()));
+	}
+	return my_tree;
+}
+
+
+/*
+ * The set operations as loops over the keys of one tree, looking each
+ * up in the other and inserting it into the result.
+ */
+bst *naive_union(bst *a, bst *b) {
+	bst *result = bst_create_type(BST_AVL);
+	bst_key *keys = (bst_key *) malloc((bst_size(a) + bst_size(b) + 1) * sizeof(bst_key));
+	size_t i;
+
+	bst_inorder_toarray(a, keys);
+	for (i=0; i<bst_size(a); i++) {
+		bst_insert(result, keys[i]);
+	}
+	bst_inorder_toarray(b, keys);
+	for (i=0; i<bst_size(b); i++) {
+		if (! bst_search(result, keys[i])) bst_insert(result, keys[i]);
+	}
+
+	free(keys);
+	return result;
+}
+
+bst *naive_filter(bst *a, bst *b, int keep_present) {
+	bst *result = bst_create_type(BST_AVL);
+	bst_key *keys = (bst_key *) malloc((bst_size(a) + 1) * sizeof(bst_key));
+	size_t i;
+
+	bst_inorder_toarray(a, keys);
+	for (i=0; i<bst_size(a); i++) {
+		if (bst_search(b, keys[i]) == keep_present) bst_insert(result, keys[i]);
+	}
+
+	free(keys);
+	return result;
+}
+
+
+/*
+ * Time one operation, naive and fast, checking that both agree.
+ */
+void time_op(const char *name, bst *(*naive)(bst *, bst *), bst *(*fast)(bst *, bst *),
+		bst *a, bst *b) {
+	bst *r1, *r2;
+	double start, t1, t2;
+
+	start = now_us();
+	r1 = naive(a, b);
+	t1 = now_us() - start;
+
+	start = now_us();
+	r2 = fast(a, b);
+	t2 = now_us() - start;
+
+	if (r2 == NULL || bst_size(r1) != bst_size(r2)) {
+		fprintf(stderr, "%s disagrees with the naive loop\n", name);
+		exit(EXIT_FAILURE);
+	}
+	printf("%s %.0f %.0f ", name, t1, t2);
+
+	bst_destroy(r1);
+	bst_destroy(r2);
+}
+
+bst *naive_intersect(bst *a, bst *b) {
+	return naive_filter(b, a, 1);	// the smaller tree's keys
+}
+
+bst *naive_difference(bst *a, bst *b) {
+	return naive_filter(a, b, 0);
+}
+
+
+int main(int argc, char *argv[]) {
+	size_t n = N;
+	size_t max_ratio = MAX_RATIO;
+	size_t ratio;
+	bst *a, *b;
+
+	/* for getopt */
+	int opt;
+
+	/* process args */
+	while ((opt = getopt(argc, argv, "n:r:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = strtoull(optarg, NULL, 0);
+				break;
+			case 'r':
+				max_ratio = strtoull(optarg, NULL, 0);
+				if (max_ratio < 1) usage(argv[0]);
+				break;
+			case 'h':
+			default: /* '?' */
+				usage(argv[0]);
+		}
+	}
+
+	srand48(SEED);
+	a = random_tree(n, 2 * n);
+	for (ratio=1; ratio<=max_ratio && n / ratio > 0; ratio*=10) {
+		b = random_tree(n / ratio, 2 * n);
+
+		printf("RATIO %zu N %zu M %zu ", ratio, bst_size(a), bst_size(b));
+		time_op("UNION", naive_union, bst_union, a, b);
+		time_op("INTERSECT", naive_intersect, bst_intersect, a, b);
+		time_op("DIFFERENCE", naive_difference, bst_difference, a, b);
+		printf("\n");
+		fflush(stdout);
+
+		bst_destroy(b);
+	}
+	bst_destroy(a);
+
+	return(0);
+}
+
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bst_snapshot.h"
+
+enum {FAILURE, SUCCESS};
+
+
+/*
+ ******************************************************************************
+ * Checksum 'n' keys: a Fletcher-style pair of running sums over the
+ * 32-bit words of the keys, which is one add each per word and so runs
+ * at about memory speed, while still catching reordered as well as
+ * corrupted words.
+ ******************************************************************************
+ */
+uint64_t bst_snapshot_checksum(const bst_key *keys, size_t n) {
+	const uint32_t *words = (const uint32_t *) keys;
+	uint64_t a = 0, b = 0;
+	size_t i;
+
+	n *= sizeof(bst_key) / sizeof(uint32_t);
+	for (i=0; i<n; i++) {
+		a += words[i];
+		b += a;
+	}
+
+	return a ^ (b << 32 | b >> 32);
+}
+
+
+/*
+ * Helper function:
+ * Write all 'len' bytes of 'buf' to 'fd'.
+ * Return SUCCESS, or FAILURE on a write error.
+ */
+static int bst_snapshot_write(int fd, const void *buf, size_t len) {
+	const char *p = (const char *) buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return FAILURE;
+		p += n;
+		len -= n;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Helper function:
+ * Flush the directory holding 'path' to disk, so that a rename into
+ * it survives a crash.
+ * Return SUCCESS, or FAILURE (with errno set).
+ */
+static int bst_snapshot_sync_dir(const char *path) {
+	const char *slash = strrchr(path, '/');
+	size_t len = slash == NULL ? 0 : slash == path ? 1 : (size_t) (slash - path);
+	char *dir;
+	int fd, ok;
+
+	if (! (dir = (char *) malloc(len + 2))) return FAILURE;
+	if (len == 0) {
+		strcpy(dir, ".");
+	} else {
+		memcpy(dir, path, len);
+		dir[len] = '\0';
+	}
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	free(dir);
+	if (fd < 0) return FAILURE;
+	ok = (fsync(fd) == 0);
+	close(fd);
+
+	return ok ? SUCCESS : FAILURE;
+}
+
+
+/*
+ ******************************************************************************
+ * Save a frozen tree to the snapshot file 'path'. The file is written
+ * under a fresh temporary name beside it, flushed to disk and renamed
+ * into place, and then the directory is flushed too - so a reader
+ * never sees half a snapshot, two saves to the same path don't share
+ * a temporary file, and after a crash 'path' holds either the old
+ * snapshot or the whole new one.
+ * Return 1 on success, 0 on failure (with errno set).
+ ******************************************************************************
+ */
+int bst_frozen_save(bst_frozen *frozen, const char *path) {
+	struct bst_snapshot_header header;
+	char *tmp;
+	int fd, ok, err;
+
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, BST_SNAPSHOT_MAGIC);
+	header.version = BST_SNAPSHOT_VERSION;
+	header.endian = BST_SNAPSHOT_ENDIAN;
+	header.header_size = sizeof(header);
+	header.key_size = sizeof(bst_key);
+	header.count = frozen->size;
+	header.checksum = bst_snapshot_checksum(frozen->keys, frozen->size + 1);
+
+	if (! (tmp = (char *) malloc(strlen(path) + 8))) return FAILURE;
+	sprintf(tmp, "%s.XXXXXX", path);
+
+	if ((fd = mkstemp(tmp)) < 0) {
+		free(tmp);
+		return FAILURE;
+	}
+	ok = fchmod(fd, 0644) == 0	// mkstemp() makes it private
+			&& bst_snapshot_write(fd, &header, sizeof(header))
+			&& bst_snapshot_write(fd, frozen->keys, (frozen->size + 1) * sizeof(bst_key))
+			&& fsync(fd) == 0;
+	ok = (close(fd) == 0) && ok;
+	ok = ok && rename(tmp, path) == 0;
+	if (! ok) {
+		err = errno;
+		unlink(tmp);
+		errno = err;
+	}
+	free(tmp);
+
+	return ok && bst_snapshot_sync_dir(path) ? SUCCESS : FAILURE;
+}
+
+/*
+ ******************************************************************************
+ * Save a tree to the snapshot file 'path', via a frozen copy.
+ * Return 1 on success, 0 on failure.
+ ******************************************************************************
+ */
+int bst_save(bst *my_tree, const char *path) {
+	bst_frozen *frozen;
+	int ok;
+
+	if (! (frozen = bst_freeze(my_tree))) return FAILURE;
+	ok = bst_frozen_save(frozen, path);
+	bst_frozen_destroy(frozen);
+
+	return ok;
+}
+
+
+/*
+ * Helper function:
+ * Map the snapshot file 'path' read-only and check its header - and,
+ * if 'verify' is set, the checksum of the keys, which reads the whole
+ * file.
+ * Return a frozen tree whose keys are the mapped file, or NULL if the
+ * file can't be mapped or isn't a valid snapshot.
+ */
+static bst_frozen *bst_snapshot_map(const char *path, int verify) {
+	struct bst_snapshot_header *header;
+	bst_frozen *frozen;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*header)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps the file open
+	if (map == MAP_FAILED) return NULL;
+
+	header = (struct bst_snapshot_header *) map;
+	if (memcmp(header->magic, BST_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != BST_SNAPSHOT_VERSION
+			|| header->endian != BST_SNAPSHOT_ENDIAN
+			|| header->header_size != sizeof(*header)
+			|| header->key_size != sizeof(bst_key)
+			|| header->count >= (size_t) st.st_size / sizeof(bst_key)
+			|| (size_t) st.st_size != sizeof(*header) + (header->count + 1) * sizeof(bst_key)
+			|| (verify && bst_snapshot_checksum((bst_key *)(header + 1), header->count + 1) != header->checksum)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	if (! (frozen = (bst_frozen *) malloc(sizeof(bst_frozen)))) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	frozen->keys = (bst_key *)(header + 1);
+	frozen->size = header->count;
+	frozen->map = map;
+	frozen->map_len = st.st_size;
+
+	return frozen;
+}
+
+/*
+ ******************************************************************************
+ * Load a snapshot file saved by bst_save(), verifying its checksum.
+ * The keys stay in the mapped file: nothing is copied or allocated
+ * per key. bst_frozen_destroy() unmaps it.
+ * Return the frozen tree, or NULL if the file can't be mapped or is
+ * not a valid snapshot.
+ ******************************************************************************
+ */
+bst_frozen *bst_load_mmap(const char *path) {
+	return bst_snapshot_map(path, 1);
+}
+
+/*
+ ******************************************************************************
+ * As bst_load_mmap(), but only check the header. The checksum pass
+ * reads every page of the file; without it, loading costs the same
+ * whatever the size, and searches only fault in the pages they touch.
+ ******************************************************************************
+ */
+bst_frozen *bst_load_mmap_unchecked(const char *path) {
+	return bst_snapshot_map(path, 0);
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
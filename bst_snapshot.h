@@ -0,0 +1,44 @@
+#ifndef __BST_SNAPSHOT_H
+#define __BST_SNAPSHOT_H
+
+#include<stdint.h>
+
+#include "bst.h"
+#include "bst_frozen.h"
+
+/*
+ * Snapshot files: a tree's keys saved in the frozen (Eytzinger)
+ * layout, so that loading one is a single mmap() - no parsing, no
+ * per-node allocation, and searches can start at once, faulting in
+ * pages as they touch them.
+ *
+ * The file is a 64-byte header followed by the keys array of a
+ * bst_frozen, keys[0] included, in native byte order:
+ */
+#define BST_SNAPSHOT_MAGIC "BSTSNAP"	// with its '\0', the first 8 bytes
+#define BST_SNAPSHOT_VERSION 1
+#define BST_SNAPSHOT_ENDIAN 0x01020304	// read back differently on another byte order
+
+struct bst_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t header_size;	// where the keys start
+	uint32_t key_size;	// sizeof(bst_key) - files don't mix with BST_KEY64 builds
+	uint64_t count;	// keys[1..count] follow keys[0]
+	uint64_t checksum;	// bst_snapshot_checksum() of keys[0..count]
+	char reserved[24];
+};
+
+
+int bst_save(bst *my_tree, const char *path);
+int bst_frozen_save(bst_frozen *frozen, const char *path);
+bst_frozen *bst_load_mmap(const char *path);
+bst_frozen *bst_load_mmap_unchecked(const char *path);
+uint64_t bst_snapshot_checksum(const bst_key *keys, size_t n);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
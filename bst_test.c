@@ -5,9 +5,11 @@
 #include <sys/time.h>
 
 #include "bst.h"
+#include "bst_frozen.h"
 
 #define N 1000
 #define SEED 97
+#define BATCH 256
 
 
 /*
@@ -20,59 +22,65 @@
  * against the degenerate case (where the values are inserted
  * already in order, and the tree effectively becomes a linked
  * list, and any binary structure is lost).
+ *
+ * Both cases are then repeated for an AVL tree, which rebalances
+ * on insert and so should not degrade for ordered input.
+ *
+ * Finally, the ordered keys are bulk-loaded in one go with
+ * bst_create_from_sorted(), which needs no rebalancing at all.
+ *
+ * With -s, search is tested instead: 'n' lookups (about half of
+ * them hits) in an AVL tree of 'n' random keys, against the same
+ * lookups in a frozen copy of the tree, against the same lookups
+ * made through bst_search_batch(), BATCH_SIZE at a time (-b), and
+ * against the same lookups in a BST_WIDE tree of the same keys.
+ *
+ * With -l, one AVL tree is grown by ascending inserts up to 'n' keys
+ * (which can be billions - build with -DBST_KEY64 past 2^31), and at
+ * each doubling of its size the memory used per node, the insert and
+ * search times per operation, and the height are reported.
+ *
+ * With -t, 'n' random keys are loaded into an AVL tree by bst_insert(),
+ * then by bst_insert_bulk() with 1, 2, 4 ... up to THREADS threads,
+ * and each bulk time is reported with its speedup over one thread.
+ *
+ * These are coarse, whole-run timings. For each operation timed on its
+ * own, with warm-up, repetitions and percentiles, see bst_bench.c.
  */
 
 
 void usage(char arg0[]) {
-	fprintf(stderr, "Usage: %s [-n NUM_TESTS]\n", arg0);
+	fprintf(stderr, "Usage: %s [-n NUM_TESTS] [-s [-b BATCH_SIZE] | -l | -t THREADS]\n", arg0);
 	exit(EXIT_FAILURE);
 }
 
 
-int main(int argc, char *argv[]) {
-	/* declare variables */
+/*
+ * Time the creation of a tree of the given type, 'n' inserts
+ * (in random order if 'random' is set, otherwise ascending) and
+ * the destruction of the tree.
+ * Return the elapsed time in milliseconds.
+ */
+long time_inserts(int type, int random, size_t n) {
 	bst *my_tree;
-	int n = N;
-	int i, k;
-
-	/* for getopt */
-	int opt;
+	bst_key k;
+	size_t i;
 
 	/* for gettimeofday */
 	struct timeval start, end;
-	long elapsed;
-
 
-	/* seed rng */
+	/* same random sequence for every tree type */
 	srand48(SEED);
 
-
-	/* process args */
-	while ((opt = getopt(argc, argv, "n:h")) != -1) {
-		switch (opt) {
-			case 'n':
-				n = atoi(optarg);
-				break;
-			case 'h':
-			default: /* '?' */
-				usage(argv[0]);
-		}
-	}
-
-
-	/**********************************************************************/
-	/* PART1 - get timing for some random inserts */
-	/**********************************************************************/
-
 	/* start the clock */
 	gettimeofday(&start, NULL);
 
 	/* init the tree */
-	my_tree = bst_create();
+	my_tree = bst_create_type(type);
 
-	/* populate the tree with some random ints */
+	/* populate the tree with random ints, or ints in linear order */
 	for (i=0; i<n; i++) {
-		k = (int)(n * drand48());
+		k = random ? (bst_key)(n * drand48()) : (bst_key) i;
 
 		bst_insert(my_tree, k);
 	}
@@ -82,38 +90,341 @@ int main(int argc, char *argv[]) {
 
 	/* stop the clock */
 	gettimeofday(&end, NULL);
-	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	return ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+}
 
-	/* printf, start... more below */
-	printf("%d RANDOM %ld ", n, elapsed);
 
+/*
+ * Time building a tree from 'n' ascending keys with
+ * bst_create_from_sorted(), and the destruction of the tree.
+ * Return the elapsed time in milliseconds, or -1 if out of memory.
+ */
+long time_sorted_build(size_t n) {
+	bst *my_tree;
+	bst_key *keys;
+	size_t i;
 
+	/* for gettimeofday */
+	struct timeval start, end;
 
-	/**********************************************************************/
-	/* PART2 - get timing for linear inserts */
-	/**********************************************************************/
+	/* the keys are set up outside the timed section */
+	if (! (keys = (bst_key *) malloc(n * sizeof(bst_key)))) return -1;
+	for (i=0; i<n; i++) {
+		keys[i] = i;
+	}
 
 	/* start the clock */
 	gettimeofday(&start, NULL);
 
-	/* init the tree */
-	my_tree = bst_create();
+	my_tree = bst_create_from_sorted(keys, n);
+	bst_destroy(my_tree);
+
+	/* stop the clock */
+	gettimeofday(&end, NULL);
+
+	free(keys);
+	return ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+}
+
+
+/*
+ * Time 'n' searches in a random AVL tree of size 'n', then the
+ * same searches in a frozen copy of it, then the same searches
+ * again in batches of 'batch', then in a wide-node tree.
+ * Print the elapsed times in milliseconds.
+ */
+void time_searches(size_t n, size_t batch) {
+	bst *my_tree, *wide_tree;
+	bst_frozen *frozen;
+	bst_key *queries;
+	size_t i, found;
+
+	/* for gettimeofday */
+	struct timeval start, end;
+	long elapsed;
+
+	/* the tree and queries are set up outside the timed sections */
+	srand48(SEED);
+	my_tree = bst_create_type(BST_AVL);
+	wide_tree = bst_create_type(BST_WIDE);
+	for (i=0; i<n; i++) {
+		bst_key k = (bst_key)(2.0 * n * drand48());
+
+		bst_insert(my_tree, k);
+		bst_insert(wide_tree, k);
+	}
+	frozen = bst_freeze(my_tree);
+
+	if (! (queries = (bst_key *) malloc(n * sizeof(bst_key)))) exit(EXIT_FAILURE);
+	for (i=0; i<n; i++) {
+		queries[i] = (bst_key)(2.0 * n * drand48());
+	}
+
+	/* pointer-based search */
+	found = 0;
+	gettimeofday(&start, NULL);
+	for (i=0; i<n; i++) {
+		found += bst_search(my_tree, queries[i]);
+	}
+	gettimeofday(&end, NULL);
+	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	printf("%zu SEARCH %ld ", n, elapsed);
+
+	/* frozen search - must agree on every lookup */
+	gettimeofday(&start, NULL);
+	for (i=0; i<n; i++) {
+		found -= bst_frozen_search(frozen, queries[i]);
+	}
+	gettimeofday(&end, NULL);
+	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	printf("FROZEN %ld ", elapsed);
+
+	if (found != 0) {
+		fprintf(stderr, "frozen search disagrees with bst_search\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* batched search - must agree too */
+	gettimeofday(&start, NULL);
+	for (i=0; i<n; i+=batch) {
+		found += bst_search_batch(my_tree, queries + i, (n - i < batch) ? n - i : batch, NULL);
+	}
+	gettimeofday(&end, NULL);
+	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	printf("BATCH %ld ", elapsed);
+
+	for (i=0; i<n; i++) {
+		found -= bst_search(my_tree, queries[i]);
+	}
+	if (found != 0) {
+		fprintf(stderr, "batched search disagrees with bst_search\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* wide-node (B-tree) search - must agree too */
+	gettimeofday(&start, NULL);
+	for (i=0; i<n; i++) {
+		found += bst_search(wide_tree, queries[i]);
+	}
+	gettimeofday(&end, NULL);
+	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	printf("WIDE %ld\n", elapsed);
 
-	/* populate the tree with ints in linear order */
 	for (i=0; i<n; i++) {
-		bst_insert(my_tree, i);
+		found -= bst_search(my_tree, queries[i]);
+	}
+	if (found != 0) {
+		fprintf(stderr, "wide search disagrees with bst_search\n");
+		exit(EXIT_FAILURE);
 	}
 
 	/* tidy up */
+	free(queries);
+	bst_destroy(wide_tree);
+	bst_frozen_destroy(frozen);
 	bst_destroy(my_tree);
+}
 
-	/* stop the clock */
+
+/*
+ * Grow an AVL tree by ascending inserts to 'max' keys, and at each
+ * doubling print the size, the bytes allocated per node, the insert
+ * and search times per operation in nanoseconds, and the height.
+ * Stops early if memory runs out.
+ */
+void time_large(size_t max) {
+	bst *my_tree = bst_create_type(BST_AVL);
+	size_t i, n = 0, step = 1 << 16, found;
+	struct timeval start, end;
+	double insert_ns, search_ns;
+
+	/* past BST_KEY_MAX the keys would wrap */
+	if (max - 1 > (size_t) BST_KEY_MAX) max = (size_t) BST_KEY_MAX + 1;
+
+	srand48(SEED);
+	while (n < max) {
+		step = (step < max - n) ? step : max - n;
+
+		gettimeofday(&start, NULL);
+		for (i=n; i<n + step; i++) {
+			if (! bst_insert(my_tree, (bst_key) i)) break;
+		}
+		gettimeofday(&end, NULL);
+		insert_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_usec - start.tv_usec) * 1e3) / step;
+
+		if (i < n + step) {
+			fprintf(stderr, "out of memory after %zu keys\n", i);
+			break;
+		}
+		n += step;
+
+		/* a million random hits */
+		found = 0;
+		gettimeofday(&start, NULL);
+		for (i=0; i<1000000; i++) {
+			found += bst_search(my_tree, (bst_key)(n * drand48()));
+		}
+		gettimeofday(&end, NULL);
+		search_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_usec - start.tv_usec) * 1e3) / 1000000;
+		if (found != 1000000) {
+			fprintf(stderr, "large tree lost keys\n");
+			exit(EXIT_FAILURE);
+		}
+
+		printf("%zu NODE_BYTES %zu POOL_BYTES_PER_KEY %.1f INSERT_NS %.0f SEARCH_NS %.0f HEIGHT %d\n",
+				n, sizeof(struct bstnode_s), (double) my_tree->pool.bytes / n,
+				insert_ns, search_ns, my_tree->root->height);
+		fflush(stdout);
+
+		step = n;	// double each time
+	}
+
+	bst_destroy(my_tree);
+}
+
+
+/*
+ * Time loading 'n' random keys into an AVL tree one bst_insert() at a
+ * time, then with bst_insert_bulk() on 1, 2, 4 ... 'max_threads'
+ * threads, printing a line per thread count.
+ */
+void time_bulk(size_t n, int max_threads) {
+	struct timeval start, end;
+	bst *my_tree;
+	bst_key *keys;
+	long elapsed, single = 0;
+	size_t i, size;
+	int threads;
+
+	if (! (keys = (bst_key *) malloc(n * sizeof(bst_key)))) exit(EXIT_FAILURE);
+	srand48(SEED);
+	for (i=0; i<n; i++) {
+		keys[i] = (bst_key)(n * drand48());
+	}
+
+	gettimeofday(&start, NULL);
+	my_tree = bst_create_type(BST_AVL);
+	for (i=0; i<n; i++) {
+		bst_insert(my_tree, keys[i]);
+	}
 	gettimeofday(&end, NULL);
-	elapsed = ((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) / 1000;	// milliseconds
+	size = bst_size(my_tree);
+	bst_destroy(my_tree);
+	elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	printf("%zu INSERT %ld\n", n, elapsed);
+
+	for (threads=1; ; threads*=2) {
+		if (threads > max_threads) threads = max_threads;
+
+		gettimeofday(&start, NULL);
+		my_tree = bst_create_type(BST_AVL);
+		if (! bst_insert_bulk(my_tree, keys, n, threads)) exit(EXIT_FAILURE);
+		gettimeofday(&end, NULL);
+		if (bst_size(my_tree) != size) {
+			fprintf(stderr, "bulk insert disagrees with bst_insert\n");
+			exit(EXIT_FAILURE);
+		}
+		bst_destroy(my_tree);
+
+		elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+		if (threads == 1) single = elapsed;
+		printf("%zu BULK_THREADS %d %ld SPEEDUP %.2f\n", n, threads, elapsed,
+				elapsed ? (double) single / elapsed : 0.0);
+		fflush(stdout);
 
-	/* printf, continued */
-	printf("LINEAR %ld\n", elapsed);
+		if (threads == max_threads) break;
+	}
+
+	free(keys);
+}
+
+
+int main(int argc, char *argv[]) {
+	/* declare variables */
+	size_t n = N;
+	int search = 0;
+	int large = 0;
+	int threads = 0;
+	size_t batch = BATCH;
+
+	/* for getopt */
+	int opt;
+
+
+	/* process args */
+	while ((opt = getopt(argc, argv, "n:sb:lt:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				n = strtoull(optarg, NULL, 0);
+				break;
+			case 's':
+				search = 1;
+				break;
+			case 'b':
+				batch = strtoull(optarg, NULL, 0);
+				if (batch < 1) usage(argv[0]);
+				break;
+			case 'l':
+				large = 1;
+				break;
+			case 't':
+				threads = atoi(optarg);
+				if (threads < 1) usage(argv[0]);
+				break;
+			case 'h':
+			default: /* '?' */
+				usage(argv[0]);
+		}
+	}
+
+
+	/* large trees only? */
+	if (large) {
+		if (n < 1) usage(argv[0]);	// max - 1 would wrap in time_large()
+		time_large(n);
+		return(0);
+	}
+
+	/* bulk loading only? */
+	if (threads) {
+		time_bulk(n, threads);
+		return(0);
+	}
+
+	/* search tests only? */
+	if (search) {
+		time_searches(n, batch);
+		return(0);
+	}
+
+
+	/**********************************************************************/
+	/* PART1 - get timing for some random inserts */
+	/**********************************************************************/
+
+	printf("%zu RANDOM %ld ", n, time_inserts(BST_PLAIN, 1, n));
+
+
+	/**********************************************************************/
+	/* PART2 - get timing for linear inserts */
+	/**********************************************************************/
+
+	printf("LINEAR %ld ", time_inserts(BST_PLAIN, 0, n));
+
+
+	/**********************************************************************/
+	/* PART3 - the same again for a balanced (AVL) tree */
+	/**********************************************************************/
+
+	printf("AVL_RANDOM %ld ", time_inserts(BST_AVL, 1, n));
+	printf("AVL_LINEAR %ld ", time_inserts(BST_AVL, 0, n));
+
+
+	/**********************************************************************/
+	/* PART4 - get timing for bulk-loading the linear keys */
+	/**********************************************************************/
 
+	printf("SORTED %ld\n", time_sorted_build(n));
 
 
 	return(0);
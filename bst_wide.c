@@ -0,0 +1,790 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bst_wide.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BST_WIDE_X86 1
+#endif
+
+
+/*
+ * Helper functions:
+ * Count the keys in keys[0..n) that are less than 'data' - the index
+ * of the first key >= data, since the keys are sorted. Each version
+ * compares all 16 slots at once and masks off the unused ones.
+ */
+static int bst_wide_rank_scalar(const bst_key *keys, int n, bst_key data) {
+	int i, rank = 0;
+
+	for (i=0; i<n; i++) {
+		rank += (keys[i] < data);
+	}
+	return rank;
+}
+
+#ifdef BST_WIDE_X86
+#ifndef BST_KEY64
+__attribute__((target("sse2")))
+static int bst_wide_rank_sse2(const bst_key *keys, int n, bst_key data) {
+	__m128i x = _mm_set1_epi32(data);
+	int mask;
+
+	mask  = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(keys + 0)), x)));
+	mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(keys + 4)), x))) << 4;
+	mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(keys + 8)), x))) << 8;
+	mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(_mm_loadu_si128((const __m128i *)(keys + 12)), x))) << 12;
+
+	return __builtin_popcount(mask & ((1 << n) - 1));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int bst_wide_rank_avx2(const bst_key *keys, int n, bst_key data) {
+	__m256i x = _mm256_set1_epi32(data);
+	__m256i lo = _mm256_cmpgt_epi32(x, _mm256_loadu_si256((const __m256i *)(keys + 0)));
+	__m256i hi = _mm256_cmpgt_epi32(x, _mm256_loadu_si256((const __m256i *)(keys + 8)));
+	int mask;
+
+	mask  = _mm256_movemask_ps(_mm256_castsi256_ps(lo));
+	mask |= _mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+
+	return __builtin_popcount(mask & ((1 << n) - 1));
+}
+#else
+/* 64-bit keys: half as many per compare, and SSE2 has no 64-bit compare - SSE4.2 does */
+__attribute__((target("sse4.2,popcnt")))
+static int bst_wide_rank_sse2(const bst_key *keys, int n, bst_key data) {
+	__m128i x = _mm_set1_epi64x(data);
+	int i, mask = 0;
+
+	for (i=0; i<16; i+=2) {
+		mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(x, _mm_loadu_si128((const __m128i *)(keys + i))))) << i;
+	}
+
+	return __builtin_popcount(mask & ((1 << n) - 1));
+}
+
+__attribute__((target("avx2,popcnt")))
+static int bst_wide_rank_avx2(const bst_key *keys, int n, bst_key data) {
+	__m256i x = _mm256_set1_epi64x(data);
+	int i, mask = 0;
+
+	for (i=0; i<16; i+=4) {
+		mask |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, _mm256_loadu_si256((const __m256i *)(keys + i))))) << i;
+	}
+
+	return __builtin_popcount(mask & ((1 << n) - 1));
+}
+#endif
+#endif
+
+/* the node search in use - picked on first use by bst_wide_rank_detect() */
+static int bst_wide_rank_detect(const bst_key *keys, int n, bst_key data);
+static int (*bst_wide_rank)(const bst_key *keys, int n, bst_key data) = bst_wide_rank_detect;
+static int bst_wide_isa_current = -1;
+
+
+/*
+ ******************************************************************************
+ * Select the instruction set used to search within nodes,
+ * BST_WIDE_SCALAR, BST_WIDE_SSE2 or BST_WIDE_AVX2.
+ * Return 1 on success, 0 if this CPU does not support it.
+ ******************************************************************************
+ */
+int bst_wide_set_isa(int isa) {
+	switch (isa) {
+		case BST_WIDE_SCALAR:
+			bst_wide_rank = bst_wide_rank_scalar;
+			break;
+#ifdef BST_WIDE_X86
+		case BST_WIDE_SSE2:
+#ifndef BST_KEY64
+			if (! __builtin_cpu_supports("sse2")) return 0;
+#else
+			if (! __builtin_cpu_supports("sse4.2") || ! __builtin_cpu_supports("popcnt")) return 0;
+#endif
+			bst_wide_rank = bst_wide_rank_sse2;
+			break;
+		case BST_WIDE_AVX2:
+			if (! __builtin_cpu_supports("avx2") || ! __builtin_cpu_supports("popcnt")) return 0;
+			bst_wide_rank = bst_wide_rank_avx2;
+			break;
+#endif
+		default:
+			return 0;
+	}
+
+	bst_wide_isa_current = isa;
+	return 1;
+}
+
+
+/*
+ ******************************************************************************
+ * Return the instruction set used to search within nodes, choosing
+ * the best one this CPU supports if none has been chosen yet.
+ ******************************************************************************
+ */
+int bst_wide_isa(void) {
+	if (bst_wide_isa_current < 0) {
+		if (! bst_wide_set_isa(BST_WIDE_AVX2) && ! bst_wide_set_isa(BST_WIDE_SSE2)) {
+			bst_wide_set_isa(BST_WIDE_SCALAR);
+		}
+	}
+	return bst_wide_isa_current;
+}
+
+static int bst_wide_rank_detect(const bst_key *keys, int n, bst_key data) {
+	bst_wide_isa();
+	return bst_wide_rank(keys, n, data);
+}
+
+
+/*
+ ******************************************************************************
+ * Set up an empty BST_WIDE tree.
+ ******************************************************************************
+ */
+void bst_wide_init(bst *my_tree) {
+	my_tree->wroot = NULL;
+	bst_pool_init(&my_tree->pool, sizeof(struct bst_widenode_s));
+}
+
+/*
+ * Helper function:
+ * Allocate a node with no keys.
+ * Return NULL if out of memory.
+ */
+static struct bst_widenode_s *bst_wide_alloc(bst *my_tree, int leaf) {
+	struct bst_widenode_s *node;
+
+	if (! (node = (struct bst_widenode_s *) bst_pool_alloc(&my_tree->pool))) return NULL;
+	node->n = 0;
+	node->leaf = leaf;
+	node->count = 0;
+
+	return node;
+}
+
+
+/*
+ * Helper function:
+ * The search itself, counting the nodes it visits into '*visits'.
+ */
+static int bst_wide_find(struct bst_widenode_s *node, bst_key data, size_t *visits) {
+	int i;
+
+	while (node != NULL) {
+		++*visits;
+		i = bst_wide_rank(node->keys, node->n, data);
+		if (i < node->n && node->keys[i] == data) {
+			return 1;	// Found the value
+		}
+		node = node->leaf ? NULL : node->child[i];
+	}
+
+	return 0;
+}
+
+/*
+ ******************************************************************************
+ * Search for a value: find its position in each node on the way down.
+ * Return 1 for sucessful search, 0 for failure.
+ ******************************************************************************
+ */
+int bst_wide_search(bst *my_tree, bst_key data) {
+	size_t visits = 0;
+	int found = bst_wide_find(my_tree->wroot, data, &visits);
+
+	BST_COUNT(my_tree, searches, 1);
+	BST_COUNT(my_tree, search_visits, visits);
+	return found;
+}
+
+/*
+ * Helper function:
+ * Split the full child 'i' of 'parent' (which is not full) in two,
+ * moving its middle key up into the parent between the halves.
+ * Return 1 on success, 0 if out of memory.
+ */
+static int bst_wide_split_child(bst *my_tree, struct bst_widenode_s *parent, int i) {
+	struct bst_widenode_s *full = parent->child[i];
+	struct bst_widenode_s *half;
+	int j;
+
+	if (! (half = bst_wide_alloc(my_tree, full->leaf))) return 0;
+
+	// the top T-1 keys (and T children) move to the new node
+	half->n = BST_WIDE_MIN_KEYS;
+	half->count = BST_WIDE_MIN_KEYS;
+	memcpy(half->keys, full->keys + BST_WIDE_T, BST_WIDE_MIN_KEYS * sizeof(bst_key));
+	if (! full->leaf) {
+		memcpy(half->child, full->child + BST_WIDE_T, BST_WIDE_T * sizeof(half->child[0]));
+		for (j=0; j<BST_WIDE_T; j++) half->count += half->child[j]->count;
+	}
+	full->n = BST_WIDE_MIN_KEYS;
+	full->count -= half->count + 1;
+
+	// and the middle key goes up, with the new node to its right
+	memmove(parent->child + i + 2, parent->child + i + 1, (parent->n - i) * sizeof(parent->child[0]));
+	parent->child[i + 1] = half;
+	memmove(parent->keys + i + 1, parent->keys + i, (parent->n - i) * sizeof(bst_key));
+	parent->keys[i] = full->keys[BST_WIDE_MIN_KEYS];
+	parent->n++;
+
+	return 1;
+}
+
+/*
+ * Helper function:
+ * An insert ran out of memory at 'stop': take back the key each node
+ * above it, on the way down to 'data', was counted for.
+ */
+static void bst_wide_uncount(bst *my_tree, struct bst_widenode_s *stop, bst_key data) {
+	struct bst_widenode_s *node;
+
+	for (node = my_tree->wroot; node != stop; node = node->child[bst_wide_rank(node->keys, node->n, data)]) {
+		node->count--;
+	}
+}
+
+
+/*
+ ******************************************************************************
+ * Insert a (unique) value into the tree.
+ * Do not insert duplicate values.
+ * Full nodes are split on the way down, so the leaf reached always
+ * has room for the new key. If the root is full it is split first,
+ * which is the only way the tree grows taller. Every node on the way
+ * down gains a key in its subtree - and loses it again if a split
+ * runs out of memory, so the counts stay right.
+ * Return 1 for sucessful insert, 0 for failure.
+ ******************************************************************************
+ */
+int bst_wide_insert(bst *my_tree, bst_key data) {
+	struct bst_widenode_s *node = my_tree->wroot;
+	size_t visits = 0;
+	int i, found;
+
+	// duplicates? check first, rather than split nodes for nothing
+	found = bst_wide_find(node, data, &visits);
+	BST_COUNT(my_tree, inserts, 1);
+	BST_COUNT(my_tree, insert_visits, visits);
+	if (found) {
+		return 0;
+	}
+
+	// empty tree?
+	if (node == NULL) {
+		if (! (node = bst_wide_alloc(my_tree, 1))) return 0;
+		my_tree->wroot = node;
+	}
+
+	// full root? it becomes the only child of a new root
+	if (node->n == BST_WIDE_MAX_KEYS) {
+		struct bst_widenode_s *root;
+
+		if (! (root = bst_wide_alloc(my_tree, 0))) return 0;
+		root->child[0] = node;
+		root->count = node->count;
+		if (! bst_wide_split_child(my_tree, root, 0)) {
+			bst_pool_free(&my_tree->pool, root);
+			return 0;
+		}
+		my_tree->wroot = node = root;
+	}
+
+	while (! node->leaf) {
+		i = bst_wide_rank(node->keys, node->n, data);
+		if (node->child[i]->n == BST_WIDE_MAX_KEYS) {
+			if (! bst_wide_split_child(my_tree, node, i)) {
+				bst_wide_uncount(my_tree, node, data);
+				return 0;
+			}
+			if (data > node->keys[i]) i++;
+		}
+		node->count++;
+		node = node->child[i];
+	}
+
+	i = bst_wide_rank(node->keys, node->n, data);
+	memmove(node->keys + i + 1, node->keys + i, (node->n - i) * sizeof(bst_key));
+	node->keys[i] = data;
+	node->n++;
+	node->count++;
+	my_tree->size++;
+
+	return 1;
+}
+
+/*
+ * Helper function:
+ * Merge child 'i+1' of 'node', and the key between them, into child 'i'.
+ * Both children must hold T-1 keys, so the result is exactly full.
+ */
+static void bst_wide_merge(bst *my_tree, struct bst_widenode_s *node, int i) {
+	struct bst_widenode_s *left = node->child[i];
+	struct bst_widenode_s *right = node->child[i + 1];
+
+	left->keys[left->n] = node->keys[i];
+	memcpy(left->keys + left->n + 1, right->keys, right->n * sizeof(bst_key));
+	if (! left->leaf) {
+		memcpy(left->child + left->n + 1, right->child, (right->n + 1) * sizeof(left->child[0]));
+	}
+	left->n += 1 + right->n;
+	left->count += 1 + right->count;
+
+	memmove(node->keys + i, node->keys + i + 1, (node->n - i - 1) * sizeof(bst_key));
+	memmove(node->child + i + 1, node->child + i + 2, (node->n - i - 1) * sizeof(node->child[0]));
+	node->n--;
+
+	bst_pool_free(&my_tree->pool, right);
+}
+
+/*
+ * Helper function:
+ * Move a key from child 'i-1' of 'node', through 'node', into child 'i'.
+ */
+static void bst_wide_borrow_left(struct bst_widenode_s *node, int i) {
+	struct bst_widenode_s *child = node->child[i];
+	struct bst_widenode_s *left = node->child[i - 1];
+	size_t moved = 1 + (child->leaf ? 0 : left->child[left->n]->count);
+
+	memmove(child->keys + 1, child->keys, child->n * sizeof(bst_key));
+	child->keys[0] = node->keys[i - 1];
+	if (! child->leaf) {
+		memmove(child->child + 1, child->child, (child->n + 1) * sizeof(child->child[0]));
+		child->child[0] = left->child[left->n];
+	}
+	child->n++;
+	child->count += moved;
+
+	node->keys[i - 1] = left->keys[left->n - 1];
+	left->n--;
+	left->count -= moved;
+}
+
+/*
+ * Helper function:
+ * Move a key from child 'i+1' of 'node', through 'node', into child 'i'.
+ */
+static void bst_wide_borrow_right(struct bst_widenode_s *node, int i) {
+	struct bst_widenode_s *child = node->child[i];
+	struct bst_widenode_s *right = node->child[i + 1];
+	size_t moved = 1 + (child->leaf ? 0 : right->child[0]->count);
+
+	child->keys[child->n] = node->keys[i];
+	if (! child->leaf) {
+		child->child[child->n + 1] = right->child[0];
+		memmove(right->child, right->child + 1, right->n * sizeof(right->child[0]));
+	}
+	child->n++;
+	child->count += moved;
+
+	node->keys[i] = right->keys[0];
+	memmove(right->keys, right->keys + 1, (right->n - 1) * sizeof(bst_key));
+	right->n--;
+	right->count -= moved;
+}
+
+
+/*
+ ******************************************************************************
+ * Remove a value from the tree.
+ * Works top-down in a single pass: before stepping into a child with
+ * only T-1 keys, a key is borrowed from a sibling or the child is
+ * merged with one, so a key can always be taken out of the node
+ * reached. A key in an internal node is replaced by its predecessor or
+ * successor, which is then removed from below instead. Every node
+ * on the way down loses a key from its subtree.
+ * Return 1 for sucessful remove, 0 if the value is not present.
+ ******************************************************************************
+ */
+int bst_wide_remove(bst *my_tree, bst_key data) {
+	struct bst_widenode_s *node = my_tree->wroot;
+	struct bst_widenode_s *root;
+	size_t visits = 0;
+	int i, found;
+
+	// not present? check first, rather than merge nodes for nothing
+	found = bst_wide_find(node, data, &visits);
+	BST_COUNT(my_tree, removes, 1);
+	BST_COUNT(my_tree, remove_visits, visits);
+	if (! found) {
+		return 0;
+	}
+
+	for (;;) {
+		node->count--;
+		i = bst_wide_rank(node->keys, node->n, data);
+
+		if (i < node->n && node->keys[i] == data) {
+			if (node->leaf) {
+				// in a leaf - just take it out
+				memmove(node->keys + i, node->keys + i + 1, (node->n - i - 1) * sizeof(bst_key));
+				node->n--;
+				break;
+			} else if (node->child[i]->n > BST_WIDE_MIN_KEYS) {
+				// replace with the predecessor, and remove that instead
+				struct bst_widenode_s *pred = node->child[i];
+				while (! pred->leaf) pred = pred->child[pred->n];
+				data = node->keys[i] = pred->keys[pred->n - 1];
+				node = node->child[i];
+			} else if (node->child[i + 1]->n > BST_WIDE_MIN_KEYS) {
+				// replace with the successor, and remove that instead
+				struct bst_widenode_s *succ = node->child[i + 1];
+				while (! succ->leaf) succ = succ->child[0];
+				data = node->keys[i] = succ->keys[0];
+				node = node->child[i + 1];
+			} else {
+				// both neighbours minimal - merge them around the key
+				bst_wide_merge(my_tree, node, i);
+				node = node->child[i];
+			}
+		} else {
+			// make sure the child we step into can lose a key
+			if (node->child[i]->n == BST_WIDE_MIN_KEYS) {
+				if (i > 0 && node->child[i - 1]->n > BST_WIDE_MIN_KEYS) {
+					bst_wide_borrow_left(node, i);
+				} else if (i < node->n && node->child[i + 1]->n > BST_WIDE_MIN_KEYS) {
+					bst_wide_borrow_right(node, i);
+				} else if (i < node->n) {
+					bst_wide_merge(my_tree, node, i);
+				} else {
+					bst_wide_merge(my_tree, node, --i);
+				}
+			}
+			node = node->child[i];
+		}
+	}
+
+	// an empty root is replaced by its only child (or nothing)
+	root = my_tree->wroot;
+	if (root->n == 0) {
+		my_tree->wroot = root->leaf ? NULL : root->child[0];
+		bst_pool_free(&my_tree->pool, root);
+	}
+
+	my_tree->size--;
+	return 1;
+}
+
+
+/*
+ ******************************************************************************
+ * Count the keys less than 'data' (or equal to it too, if 'inclusive'
+ * is set): in each node on the way down, the keys before its position
+ * and the subtrees to their left.
+ ******************************************************************************
+ */
+size_t bst_wide_count_below(bst *my_tree, bst_key data, int inclusive) {
+	struct bst_widenode_s *node = my_tree->wroot;
+	size_t below = 0;
+	int i, j;
+
+	while (node != NULL) {
+		i = bst_wide_rank(node->keys, node->n, data);
+		below += i;
+		if (! node->leaf) {
+			for (j=0; j<i; j++) below += node->child[j]->count;
+		}
+		if (i < node->n && node->keys[i] == data) {
+			// everything in the subtree to its left is less
+			if (! node->leaf) below += node->child[i]->count;
+			return below + (inclusive ? 1 : 0);
+		}
+		node = node->leaf ? NULL : node->child[i];
+	}
+
+	return below;
+}
+
+/*
+ ******************************************************************************
+ * Return the k'th smallest key (counting from 0): in each node on the
+ * way down, skip whole subtrees, and the keys between them, until the
+ * one holding it. Default return value of 0 if there is no such key.
+ ******************************************************************************
+ */
+bst_key bst_wide_select(bst *my_tree, size_t k) {
+	struct bst_widenode_s *node = my_tree->wroot;
+	size_t c;
+	int j;
+
+	if (node == NULL || k >= node->count) return 0;
+
+	while (! node->leaf) {
+		for (j=0; j<=node->n; j++) {
+			c = node->child[j]->count;
+			if (k < c) break;	// in this subtree
+			k -= c;
+			if (k == 0) return node->keys[j];	// the key after it
+			k--;
+		}
+		node = node->child[j];
+	}
+
+	return node->keys[k];
+}
+
+
+/*
+ * Helper functions:
+ * Traverse a subtree in-order (child 0, key 0, child 1, ... key n-1,
+ * child n) or pre-order (all the keys of a node, then its children),
+ * appending each value to the writer 'w' / storing it at 'arr'. B-trees are
+ * shallow, so the recursion is only log_8(n) deep.
+ */
+static void bst_wide_inorder_write_recursive(struct bst_widenode_s *node, bst_writer *w) {
+	int i;
+
+	for (i=0; i<node->n; i++) {
+		if (! node->leaf) bst_wide_inorder_write_recursive(node->child[i], w);
+		bst_writer_int(w, node->keys[i]);
+	}
+	if (! node->leaf) bst_wide_inorder_write_recursive(node->child[node->n], w);
+}
+
+static void bst_wide_preorder_write_recursive(struct bst_widenode_s *node, bst_writer *w) {
+	int i;
+
+	for (i=0; i<node->n; i++) {
+		bst_writer_int(w, node->keys[i]);
+	}
+	if (! node->leaf) {
+		for (i=0; i<=node->n; i++) {
+			bst_wide_preorder_write_recursive(node->child[i], w);
+		}
+	}
+}
+
+static bst_key *bst_wide_inorder_toarray_recursive(struct bst_widenode_s *node, bst_key *arr) {
+	int i;
+
+	for (i=0; i<node->n; i++) {
+		if (! node->leaf) arr = bst_wide_inorder_toarray_recursive(node->child[i], arr);
+		*arr++ = node->keys[i];
+	}
+	if (! node->leaf) arr = bst_wide_inorder_toarray_recursive(node->child[node->n], arr);
+
+	return arr;
+}
+
+
+/*
+ ******************************************************************************
+ * The traversals behind bst_inorder_write(), bst_preorder_write()
+ * and bst_inorder_toarray(), with the same assumptions about space.
+ ******************************************************************************
+ */
+void bst_wide_inorder_write(bst *my_tree, bst_writer *w) {
+	if (my_tree->wroot) bst_wide_inorder_write_recursive(my_tree->wroot, w);
+}
+
+void bst_wide_preorder_write(bst *my_tree, bst_writer *w) {
+	if (my_tree->wroot) bst_wide_preorder_write_recursive(my_tree->wroot, w);
+}
+
+void bst_wide_inorder_toarray(bst *my_tree, bst_key *arr) {
+	if (my_tree->wroot) bst_wide_inorder_toarray_recursive(my_tree->wroot, arr);
+}
+
+
+/*
+ * Helper function:
+ * Visit the keys in [lo, hi] in the subtree under 'node', in order.
+ * Each node is entered at its first key >= lo, and left at its first
+ * key > hi, so only the nodes on the paths to lo and hi are visited
+ * besides those holding keys in the range.
+ * Return the number of keys visited.
+ */
+static size_t bst_wide_range_recursive(struct bst_widenode_s *node, bst_key lo, bst_key hi,
+		bst_visit visit, void *ctx) {
+	size_t k = 0;
+	int i;
+
+	for (i = bst_wide_rank(node->keys, node->n, lo); i < node->n; i++) {
+		if (! node->leaf) k += bst_wide_range_recursive(node->child[i], lo, hi, visit, ctx);
+		if (node->keys[i] > hi) return k;
+		if (visit) visit(node->keys[i], ctx);
+		k++;
+	}
+	if (! node->leaf) k += bst_wide_range_recursive(node->child[node->n], lo, hi, visit, ctx);
+
+	return k;
+}
+
+/*
+ ******************************************************************************
+ * The range walk behind bst_range_foreach() and bst_range_to_array().
+ ******************************************************************************
+ */
+size_t bst_wide_range_foreach(bst *my_tree, bst_key lo, bst_key hi, bst_visit visit, void *ctx) {
+	if (my_tree->wroot == NULL || lo > hi) return 0;
+
+	return bst_wide_range_recursive(my_tree->wroot, lo, hi, visit, ctx);
+}
+
+
+/*
+ * Helper function:
+ * Count the nodes below 'node', at 'depth', and sum the depths of
+ * their keys. All the leaves are at the same depth - the height.
+ */
+static void bst_wide_stats_recursive(struct bst_widenode_s *node, int depth, double *sum,
+		bst_stats_t *out) {
+	int i;
+
+	out->nodes++;
+	*sum += (double) node->n * depth;
+	if (node->leaf) {
+		out->height = depth;
+		return;
+	}
+	for (i=0; i<=node->n; i++) {
+		bst_wide_stats_recursive(node->child[i], depth + 1, sum, out);
+	}
+}
+
+/*
+ ******************************************************************************
+ * The shape of the tree for bst_stats(): the height, nodes and mean
+ * depth of a key.
+ ******************************************************************************
+ */
+void bst_wide_stats(bst *my_tree, bst_stats_t *out) {
+	double sum = 0;
+
+	if (my_tree->wroot == NULL) return;
+
+	bst_wide_stats_recursive(my_tree->wroot, 1, &sum, out);
+	out->avg_depth = sum / my_tree->size;
+}
+
+
+
+/*
+ * Helper functions:
+ * Cursor moves. The cursor's path holds each node from the root down
+ * to the one with the current key; in that node, index[] is the key,
+ * and in each node above it, the child taken. Coming back up from
+ * child i, the next key is key i and the one before is key i-1.
+ * The path is empty (depth 0) off the end.
+ */
+static int bst_wide_iter_push(bst_iter_t *it, struct bst_widenode_s *node, int i) {
+	it->path[it->depth] = node;
+	it->index[it->depth] = i;
+	it->depth++;
+	return 1;
+}
+
+// climb to the nearest node with a key after the child taken
+static int bst_wide_iter_up_next(bst_iter_t *it) {
+	while (--it->depth > 0) {
+		if (it->index[it->depth - 1] < it->path[it->depth - 1]->n) return 1;
+	}
+	return 0;
+}
+
+// climb to the nearest node with a key before the child taken
+static int bst_wide_iter_up_prev(bst_iter_t *it) {
+	while (--it->depth > 0) {
+		if (it->index[it->depth - 1] > 0) {
+			it->index[it->depth - 1]--;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// descend from 'node' to the first (last) key of its subtree
+static int bst_wide_iter_down_first(bst_iter_t *it, struct bst_widenode_s *node) {
+	while (! node->leaf) {
+		bst_wide_iter_push(it, node, 0);
+		node = node->child[0];
+	}
+	return bst_wide_iter_push(it, node, 0);
+}
+
+static int bst_wide_iter_down_last(bst_iter_t *it, struct bst_widenode_s *node) {
+	while (! node->leaf) {
+		bst_wide_iter_push(it, node, node->n);
+		node = node->child[node->n];
+	}
+	return bst_wide_iter_push(it, node, node->n - 1);
+}
+
+
+/*
+ ******************************************************************************
+ * The cursor moves behind bst_iter_lower_bound(), bst_iter_last(),
+ * bst_iter_next() and bst_iter_prev(). A step to a neighbouring key
+ * in the same leaf - most steps, with up to 15 keys a leaf - only
+ * moves the index.
+ ******************************************************************************
+ */
+int bst_wide_iter_lower_bound(bst_iter_t *it, bst_key key) {
+	struct bst_widenode_s *node = it->tree->wroot;
+	int i;
+
+	it->depth = 0;
+	if (node == NULL) return 0;
+
+	for (;;) {
+		i = bst_wide_rank(node->keys, node->n, key);
+		bst_wide_iter_push(it, node, i);
+		if (i < node->n && node->keys[i] == key) return 1;
+		if (node->leaf) break;
+		node = node->child[i];
+	}
+
+	// every key in the leaf is smaller - the bound is further up
+	if (i < node->n) return 1;
+	return bst_wide_iter_up_next(it);
+}
+
+int bst_wide_iter_last(bst_iter_t *it) {
+	it->depth = 0;
+	if (it->tree->wroot == NULL) return 0;
+
+	return bst_wide_iter_down_last(it, it->tree->wroot);
+}
+
+int bst_wide_iter_next(bst_iter_t *it) {
+	struct bst_widenode_s *node;
+	int i;
+
+	if (it->depth == 0) return 0;
+	node = it->path[it->depth - 1];
+	i = ++it->index[it->depth - 1];
+
+	// the first key of the subtree after the current key
+	if (! node->leaf) return bst_wide_iter_down_first(it, node->child[i]);
+
+	if (i < node->n) return 1;
+	return bst_wide_iter_up_next(it);
+}
+
+int bst_wide_iter_prev(bst_iter_t *it) {
+	struct bst_widenode_s *node;
+	int i;
+
+	if (it->depth == 0) return 0;
+	node = it->path[it->depth - 1];
+	i = it->index[it->depth - 1];
+
+	// the last key of the subtree before the current key
+	if (! node->leaf) return bst_wide_iter_down_last(it, node->child[i]);
+
+	if (i > 0) {
+		it->index[it->depth - 1]--;
+		return 1;
+	}
+	return bst_wide_iter_up_prev(it);
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,65 @@
+#ifndef __BST_WIDE_H
+#define __BST_WIDE_H
+
+#include<stdlib.h>
+
+#include "bst.h"
+
+/*
+ * The BST_WIDE variant: a B-tree of minimum degree BST_WIDE_T.
+ *
+ * Each node holds up to 2T-1 = 15 sorted keys (a 16th slot pads the
+ * array to one 64 byte cache line, or two with BST_KEY64) and, unless
+ * it is a leaf, one more child than keys. Nodes are aligned to a cache
+ * line and padded to a whole number of them (the pool's chunks start
+ * on one), so the keys never straddle a line boundary. All nodes but
+ * the root hold at least T-1 keys, and all leaves are at the same
+ * depth, so a tree of n keys is only about log_8(n) levels deep. The
+ * position of a key within a node is found with SIMD compares, so a
+ * whole node costs about as much to search as a single binary node -
+ * but replaces three or four levels of them.
+ */
+#define BST_WIDE_T 8
+#define BST_WIDE_MAX_KEYS (2 * BST_WIDE_T - 1)
+#define BST_WIDE_MIN_KEYS (BST_WIDE_T - 1)
+
+struct bst_widenode_s {
+	_Alignas(BST_POOL_ALIGN) bst_key keys[BST_WIDE_MAX_KEYS + 1];	// sorted, only the first 'n' are used
+	int n;		// number of keys
+	int leaf;	// 1 if there are no children
+	size_t count;	// number of keys in the subtree rooted here
+	struct bst_widenode_s *child[BST_WIDE_MAX_KEYS + 1];	// child[i] holds keys < keys[i]
+};
+
+/* the instruction sets used to search within a node */
+enum {
+	BST_WIDE_SCALAR,	// plain C - always available
+	BST_WIDE_SSE2,		// 4 keys per compare (2, and SSE4.2, with BST_KEY64)
+	BST_WIDE_AVX2,		// 8 keys per compare (4 with BST_KEY64)
+};
+
+int bst_wide_isa(void);
+int bst_wide_set_isa(int isa);
+
+/* the BST_WIDE implementations behind the bst_* functions */
+void bst_wide_init(bst *my_tree);
+int bst_wide_search(bst *my_tree, bst_key data);
+int bst_wide_insert(bst *my_tree, bst_key data);
+int bst_wide_remove(bst *my_tree, bst_key data);
+size_t bst_wide_count_below(bst *my_tree, bst_key data, int inclusive);
+bst_key bst_wide_select(bst *my_tree, size_t k);
+void bst_wide_inorder_write(bst *my_tree, bst_writer *w);
+void bst_wide_preorder_write(bst *my_tree, bst_writer *w);
+void bst_wide_inorder_toarray(bst *my_tree, bst_key *arr);
+int bst_wide_iter_lower_bound(bst_iter_t *it, bst_key key);
+int bst_wide_iter_last(bst_iter_t *it);
+int bst_wide_iter_next(bst_iter_t *it);
+int bst_wide_iter_prev(bst_iter_t *it);
+size_t bst_wide_range_foreach(bst *my_tree, bst_key lo, bst_key hi, bst_visit visit, void *ctx);
+void bst_wide_stats(bst *my_tree, bst_stats_t *out);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "bst_workload.h"
+
+/* a prime, so multiplying by it mod any smaller range is a permutation */
+#define BST_WL_SCATTER 2654435761u
+
+static const struct {
+	const char *name;
+	double param;	// the default
+} bst_wl_kinds[BST_WL_NKINDS] = {
+	{"uniform", 0},
+	{"zipf", 0.99},
+	{"sequential", 0},
+	{"reverse", 0},
+	{"sawtooth", 16},
+	{"nearly", 5},
+};
+
+
+/*
+ ******************************************************************************
+ * Read a workload from 'spec' - a name, then optionally ':' and a
+ * parameter - into 'w'.
+ * Return 1 on success, 0 for an unknown name or a parameter out of
+ * range.
+ ******************************************************************************
+ */
+int bst_workload_parse(bst_workload *w, const char *spec) {
+	const char *colon = strchr(spec, ':');
+	size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+	char *end;
+	int kind;
+
+	for (kind=0; kind<BST_WL_NKINDS; kind++) {
+		if (strlen(bst_wl_kinds[kind].name) == len && strncmp(spec, bst_wl_kinds[kind].name, len) == 0) {
+			break;
+		}
+	}
+	if (kind == BST_WL_NKINDS) return 0;
+
+	w->kind = kind;
+	w->param = bst_wl_kinds[kind].param;
+	if (colon) {
+		w->param = strtod(colon + 1, &end);
+		if (end == colon + 1 || *end != '\0') return 0;
+	}
+
+	switch (kind) {
+		case BST_WL_ZIPF:
+			return w->param > 0 && isfinite(w->param);
+		case BST_WL_SAWTOOTH:
+			return w->param >= 1;
+		case BST_WL_NEARLY_SORTED:
+			return w->param >= 0 && w->param <= 100;
+	}
+	return 1;
+}
+
+/*
+ ******************************************************************************
+ * Write the workload 'w' into 'buf' (of 'cap' bytes) as it would be
+ * parsed: the name, and its parameter if it has one.
+ ******************************************************************************
+ */
+void bst_workload_format(const bst_workload *w, char *buf, size_t cap) {
+	if (bst_wl_kinds[w->kind].param == 0) {
+		snprintf(buf, cap, "%s", bst_wl_kinds[w->kind].name);
+	} else {
+		snprintf(buf, cap, "%s:%g", bst_wl_kinds[w->kind].name, w->param);
+	}
+}
+
+
+/*
+ * Helper function:
+ * Swap keys[i] with a random one of keys[0..i], for i = n-1 down to 1
+ * - a Fisher-Yates shuffle.
+ */
+static void bst_wl_shuffle(bst_key *keys, size_t n, unsigned short seed[3]) {
+	size_t i, j;
+	bst_key tmp;
+
+	for (i=n; i>1; i--) {
+		j = (size_t)(i * erand48(seed));
+		tmp = keys[i - 1];
+		keys[i - 1] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+/*
+ ******************************************************************************
+ * Fill keys[0..n) with the keys 0..n-1, each once, in the order of
+ * workload 'w', using (and advancing) the erand48() state 'seed'.
+ * Return 1, or 0 for zipf, which isn't an order.
+ ******************************************************************************
+ */
+int bst_workload_order(const bst_workload *w, bst_key *keys, size_t n, unsigned short seed[3]) {
+	size_t i, j, k, teeth, swaps;
+	bst_key tmp;
+
+	switch (w->kind) {
+		case BST_WL_UNIFORM:
+			for (i=0; i<n; i++) keys[i] = (bst_key) i;
+			bst_wl_shuffle(keys, n, seed);
+			break;
+		case BST_WL_SEQUENTIAL:
+			for (i=0; i<n; i++) keys[i] = (bst_key) i;
+			break;
+		case BST_WL_REVERSE:
+			for (i=0; i<n; i++) keys[i] = (bst_key)(n - 1 - i);
+			break;
+		case BST_WL_SAWTOOTH:
+			// tooth t is t, t + teeth, t + 2 teeth ...
+			teeth = (size_t) w->param;
+			for (i=0, j=0; j<teeth; j++) {
+				for (k=j; k<n; k+=teeth) keys[i++] = (bst_key) k;
+			}
+			break;
+		case BST_WL_NEARLY_SORTED:
+			for (i=0; i<n; i++) keys[i] = (bst_key) i;
+			swaps = (size_t)(n * w->param / 200);	// each swap moves two keys
+			for (k=0; k<swaps; k++) {
+				i = (size_t)(n * erand48(seed));
+				j = (size_t)(n * erand48(seed));
+				tmp = keys[i];
+				keys[i] = keys[j];
+				keys[j] = tmp;
+			}
+			break;
+		default:
+			return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Helper functions:
+ * Rejection-inversion sampling of Zipf ranks, for a skew S >= 1, where
+ * the method of Gray et al below breaks down - W. Hormann and G.
+ * Derflinger, "Rejection-inversion to generate variates from monotone
+ * discrete distributions" (1996). A rank in 1..range is drawn by
+ * inverting H, the integral of h(x) = x^-S, and is rejected only near
+ * the bottom of its step, rarely, so a draw is O(1) with no table.
+ * helper1(x) = log(1+x)/x and helper2(x) = (e^x-1)/x are kept accurate
+ * near 0, which is where S = 1 lands.
+ */
+static double bst_wl_helper1(double x) {
+	return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double bst_wl_helper2(double x) {
+	return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double bst_wl_h(double theta, double x) {
+	return exp(-theta * log(x));
+}
+
+static double bst_wl_hint(double theta, double x) {
+	double lx = log(x);
+
+	return bst_wl_helper2((1 - theta) * lx) * lx;
+}
+
+static double bst_wl_hint_inverse(double theta, double x) {
+	double t = x * (1 - theta);
+
+	if (t < -1) t = -1;	// only rounding can take it past
+	return exp(bst_wl_helper1(t) * x);
+}
+
+static size_t bst_wl_zipf_rank(double theta, size_t range, double hx1, double hn, double sc,
+		unsigned short seed[3]) {
+	double u, x;
+	size_t k;
+
+	for (;;) {
+		u = hn + erand48(seed) * (hx1 - hn);
+		x = bst_wl_hint_inverse(theta, u);
+		k = (size_t)(x + 0.5);
+		if (k < 1) k = 1;
+		else if (k > range) k = range;
+		if (k - x <= sc || u >= bst_wl_hint(theta, k + 0.5) - bst_wl_h(theta, k)) {
+			return k - 1;
+		}
+	}
+}
+
+/*
+ * Helper function:
+ * Draw Zipf-distributed ranks in [0, range) - for S < 1 the method of
+ * Gray et al, "Quickly Generating Billion-Record Synthetic Databases"
+ * (SIGMOD 1994), which is O(1) a draw after an O(range) sum, and for
+ * S >= 1 rejection-inversion, above.
+ */
+static void bst_wl_zipf(double theta, bst_key *keys, size_t n, size_t range, unsigned short seed[3]) {
+	double zetan = 0, zeta2, alpha, eta, u, uz;
+	double hx1, hn, sc;
+	size_t i, rank;
+
+	if (theta >= 1) {
+		hx1 = bst_wl_hint(theta, 1.5) - 1;
+		hn = bst_wl_hint(theta, range + 0.5);
+		sc = 2 - bst_wl_hint_inverse(theta, bst_wl_hint(theta, 2.5) - bst_wl_h(theta, 2));
+		for (i=0; i<n; i++) {
+			rank = bst_wl_zipf_rank(theta, range, hx1, hn, sc, seed);
+			keys[i] = (bst_key)((uint64_t) rank * BST_WL_SCATTER % range);
+		}
+		return;
+	}
+
+	for (i=1; i<=range; i++) {
+		zetan += 1.0 / pow((double) i, theta);
+	}
+	zeta2 = 1.0 + pow(0.5, theta);
+	alpha = 1.0 / (1.0 - theta);
+	eta = (1.0 - pow(2.0 / range, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+
+	for (i=0; i<n; i++) {
+		u = erand48(seed);
+		uz = u * zetan;
+		if (uz < 1.0) {
+			rank = 0;
+		} else if (uz < zeta2) {
+			rank = 1;
+		} else {
+			rank = (size_t)(range * pow(eta * u - eta + 1.0, alpha));
+			if (rank >= range) rank = range - 1;
+		}
+		// scatter the ranks, so the hottest keys aren't all together
+		keys[i] = (bst_key)((uint64_t) rank * BST_WL_SCATTER % range);
+	}
+}
+
+/*
+ ******************************************************************************
+ * Fill keys[0..n) with keys drawn from [0, range) by workload 'w',
+ * using (and advancing) the erand48() state 'seed'. The ordered
+ * workloads repeat their order of the whole range as often as needed.
+ * Return 1, or 0 if out of memory.
+ ******************************************************************************
+ */
+int bst_workload_draw(const bst_workload *w, bst_key *keys, size_t n, size_t range,
+		unsigned short seed[3]) {
+	bst_key *order;
+	size_t i;
+
+	if (range == 0) return n == 0;
+
+	switch (w->kind) {
+		case BST_WL_UNIFORM:
+			for (i=0; i<n; i++) keys[i] = (bst_key)(range * erand48(seed));
+			return 1;
+		case BST_WL_ZIPF:
+			bst_wl_zipf(w->param, keys, n, range, seed);
+			return 1;
+	}
+
+	if (! (order = (bst_key *) malloc(range * sizeof(bst_key)))) return 0;
+	bst_workload_order(w, order, range, seed);
+	for (i=0; i<n; i++) {
+		keys[i] = order[i % range];
+	}
+	free(order);
+
+	return 1;
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,56 @@
+#ifndef __BST_WORKLOAD_H
+#define __BST_WORKLOAD_H
+
+#include<stdlib.h>
+
+#include "bst.h"
+
+/*
+ * Workload generators for the benchmarks: the orders keys arrive in,
+ * and how often each key is asked for. A workload is written as a
+ * name and an optional parameter, such as "zipf:0.99" or "nearly:5":
+ *
+ *   uniform       every key equally likely - a random order
+ *   zipf:S        the rank r key drawn with probability ~ 1/r^S, for a
+ *                 skew S > 0 (default 0.99; from 1 up, a few keys take
+ *                 most of the draws); the ranks are scattered over the
+ *                 keys, so the hot ones aren't neighbours
+ *   sequential    ascending
+ *   reverse       descending
+ *   sawtooth:T    T ascending runs (default 16), each across the whole
+ *                 range of keys, offset by one from the last
+ *   nearly:K      ascending, but with K% of the keys (default 5)
+ *                 swapped with others anywhere in the range
+ *
+ * bst_workload_order() arranges the keys 0..n-1 in a workload's order,
+ * for loading a tree - every workload but zipf is an order. And
+ * bst_workload_draw() draws any number of keys from a range, for the
+ * lookups and updates that follow: independently for uniform and
+ * zipf, the others repeat their order over the range.
+ */
+enum {
+	BST_WL_UNIFORM,
+	BST_WL_ZIPF,
+	BST_WL_SEQUENTIAL,
+	BST_WL_REVERSE,
+	BST_WL_SAWTOOTH,
+	BST_WL_NEARLY_SORTED,
+	BST_WL_NKINDS
+};
+
+typedef struct bst_workload_s {
+	int kind;
+	double param;	// the skew, the number of teeth, or the % out of place
+} bst_workload;
+
+int bst_workload_parse(bst_workload *w, const char *spec);
+void bst_workload_format(const bst_workload *w, char *buf, size_t cap);
+int bst_workload_order(const bst_workload *w, bst_key *keys, size_t n, unsigned short seed[3]);
+int bst_workload_draw(const bst_workload *w, bst_key *keys, size_t n, size_t range,
+		unsigned short seed[3]);
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,186 @@
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "bst_writer.h"
+
+const char bst_writer_digits[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+
+/*
+ ******************************************************************************
+ * Start writing into the caller's buffer 'buf', of 'cap' bytes
+ * including the '\0'. A 'cap' of 0 only counts the output.
+ ******************************************************************************
+ */
+void bst_writer_init_buf(bst_writer *w, char *buf, size_t cap) {
+	w->buf = cap ? buf : w->chunk;
+	w->len = 0;
+	w->cap = cap ? cap - 1 : 0;
+	w->total = 0;
+	w->grow = 0;
+	w->fp = NULL;
+	w->fd = -1;
+	w->error = 0;
+	w->buf[0] = '\0';
+}
+
+/*
+ ******************************************************************************
+ * Start writing into a buffer of 'cap' bytes (at least), allocated
+ * here and doubled whenever it fills.
+ * Return 1 on success, 0 if out of memory.
+ ******************************************************************************
+ */
+int bst_writer_init_grow(bst_writer *w, size_t cap) {
+	if (cap < 16) cap = 16;
+	bst_writer_init_buf(w, w->chunk, 1);
+	if (! (w->buf = (char *) malloc(cap))) {
+		w->buf = w->chunk;
+		w->error = 1;
+		return 0;
+	}
+	w->cap = cap - 1;
+	w->grow = 1;
+	w->buf[0] = '\0';
+
+	return 1;
+}
+
+/*
+ ******************************************************************************
+ * Start writing to a stream or a file descriptor, through the
+ * writer's own chunk buffer. Call bst_writer_flush() at the end.
+ ******************************************************************************
+ */
+void bst_writer_init_file(bst_writer *w, FILE *fp) {
+	bst_writer_init_buf(w, w->chunk, sizeof(w->chunk));
+	w->fp = fp;
+}
+
+void bst_writer_init_fd(bst_writer *w, int fd) {
+	bst_writer_init_buf(w, w->chunk, sizeof(w->chunk));
+	w->fd = fd;
+}
+
+
+/*
+ ******************************************************************************
+ * Write out what has been buffered, for a FILE * or fd writer.
+ * Does nothing to a buffer writer.
+ ******************************************************************************
+ */
+void bst_writer_flush(bst_writer *w) {
+	size_t done = 0;
+	ssize_t n;
+
+	if (w->fp) {
+		if (fwrite(w->buf, 1, w->len, w->fp) != w->len) w->error = 1;
+	} else if (w->fd != -1) {
+		while (done < w->len) {
+			n = write(w->fd, w->buf + done, w->len - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				w->error = 1;
+				break;
+			}
+			done += n;
+		}
+	} else {
+		return;
+	}
+	w->len = 0;
+	w->buf[0] = '\0';
+}
+
+/*
+ * Helper function:
+ * Make room for 'n' more bytes (see bst_writer.h).
+ */
+int bst_writer_reserve(bst_writer *w, size_t n) {
+	if (w->cap - w->len >= n) return 1;
+
+	if (w->fp || w->fd != -1) {
+		bst_writer_flush(w);
+		return w->cap >= n;
+	}
+
+	if (w->grow) {
+		size_t cap = w->cap + 1;
+		char *buf;
+
+		while (cap - 1 - w->len < n) cap *= 2;
+		if (! (buf = (char *) realloc(w->buf, cap))) return 0;
+		w->buf = buf;
+		w->cap = cap - 1;
+		return 1;
+	}
+
+	// a fixed buffer - stop here, so the output is a prefix of the whole
+	w->cap = w->len;
+	return 0;
+}
+
+
+/*
+ ******************************************************************************
+ * Append a string. A fixed buffer takes all of it or, like a value
+ * from bst_writer_int(), none; a stream writer may take it a chunk at
+ * a time.
+ ******************************************************************************
+ */
+void bst_writer_str(bst_writer *w, const char *str) {
+	size_t n = strlen(str), room;
+
+	w->total += n;
+	if (! w->grow && ! w->fp && w->fd == -1 && ! bst_writer_reserve(w, n)) {
+		w->error = 1;
+		return;
+	}
+	while (n > 0) {
+		bst_writer_reserve(w, n);
+		room = w->cap - w->len < n ? w->cap - w->len : n;
+		if (room == 0) {
+			w->error = 1;
+			break;
+		}
+		memcpy(w->buf + w->len, str, room);
+		w->len += room;
+		str += room;
+		n -= room;
+	}
+	w->buf[w->len] = '\0';
+}
+
+
+/*
+ ******************************************************************************
+ * Finish writing: flush a FILE * or fd writer, and hand back a
+ * grown buffer, which the caller must free(). A fixed buffer is
+ * returned as it was passed in.
+ * Return the buffer, or NULL for FILE * and fd writers.
+ ******************************************************************************
+ */
+char *bst_writer_finish(bst_writer *w) {
+	if (w->fp || w->fd != -1) {
+		bst_writer_flush(w);
+		if (w->fp) fflush(w->fp);
+		return NULL;
+	}
+	return w->buf == w->chunk && w->cap == 0 ? NULL : w->buf;
+}
+
+
+/*
+ * vim:ts=4:sw=4
+ */
@@ -0,0 +1,97 @@
+#ifndef __BST_WRITER_H
+#define __BST_WRITER_H
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+
+/* bytes buffered before a FILE * or fd writer flushes */
+#define BST_WRITER_CHUNK 4096
+
+/*
+ * An output cursor for dumping trees as text. Values are appended at
+ * the cursor, never by searching for the end of the string, so a
+ * dump is linear in its length. A writer has one of four sinks:
+ *
+ *   - a caller's buffer of fixed capacity: output stops at the first
+ *     value that doesn't fit, but 'total' still counts the rest, as
+ *     snprintf() does
+ *   - a malloc()ed buffer that doubles as it fills, handed to the
+ *     caller by bst_writer_finish()
+ *   - a FILE * or a file descriptor, written a chunk at a time from
+ *     the writer's own buffer
+ *
+ * The buffer sinks are always '\0' terminated.
+ */
+typedef struct bst_writer_s {
+	char *buf;
+	size_t len;	// bytes in buf
+	size_t cap;	// size of buf, less one for the '\0'
+	size_t total;	// bytes written, or that would have been
+	int grow;	// buf is ours to realloc()
+	FILE *fp;	// flush to here...
+	int fd;	// ...or here, if not -1
+	int error;	// set once output has been dropped
+	char chunk[BST_WRITER_CHUNK];
+} bst_writer;
+
+
+void bst_writer_init_buf(bst_writer *w, char *buf, size_t cap);
+int bst_writer_init_grow(bst_writer *w, size_t cap);
+void bst_writer_init_file(bst_writer *w, FILE *fp);
+void bst_writer_init_fd(bst_writer *w, int fd);
+void bst_writer_str(bst_writer *w, const char *str);
+void bst_writer_flush(bst_writer *w);
+char *bst_writer_finish(bst_writer *w);
+
+/*
+ * Helper function:
+ * Make room for 'n' more bytes, flushing or growing the buffer.
+ * Return 0 if there is no room (fixed buffer full, or out of memory).
+ */
+int bst_writer_reserve(bst_writer *w, size_t n);
+
+/* two digits at a time for bst_writer_int() */
+extern const char bst_writer_digits[200];
+
+/*
+ * Append 'value' and a space - the format of the tostring traversals.
+ * Takes any key, 32 or 64 bit. Inline, as a dump is mostly this.
+ */
+static inline void bst_writer_int(bst_writer *w, int64_t value) {
+	char tmp[22], *p = tmp + sizeof(tmp);
+	uint64_t u = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+	size_t n;
+
+	*--p = ' ';
+	while (u >= 100) {
+		unsigned int r = u % 100;
+		u /= 100;
+		p -= 2;
+		p[0] = bst_writer_digits[2 * r];
+		p[1] = bst_writer_digits[2 * r + 1];
+	}
+	if (u >= 10) {
+		p -= 2;
+		p[0] = bst_writer_digits[2 * u];
+		p[1] = bst_writer_digits[2 * u + 1];
+	} else {
+		*--p = '0' + u;
+	}
+	if (value < 0) *--p = '-';
+
+	n = tmp + sizeof(tmp) - p;
+	w->total += n;
+	if (w->cap - w->len < n && ! bst_writer_reserve(w, n)) {
+		w->error = 1;
+		return;
+	}
+	while (p < tmp + sizeof(tmp)) w->buf[w->len++] = *p++;
+	w->buf[w->len] = '\0';
+}
+
+#endif
+
+/*
+ * vim:ts=4:sw=4
+ */
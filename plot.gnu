@@ -1,7 +1,24 @@
-set title "Plot Of Search Duration Vs Binary Tree Size For Ordered And Random Insert Regimes"
+set title "Median Time Per Operation Vs Binary Tree Size For Random, Ordered And Mixed Workloads"
 set xlabel "Tree Size"
-set ylabel "Duration (ms)"
+set ylabel "Duration (ns per call)"
 set logscale y
 set key left
 
-plot "bench.dat" using 1:2 title "Random", "bench.dat" using 1:3 title "Ordered"
+# bench.dat: the tree size, then the median of each series bench.sh picks
+plot "bench.dat" using 1:2 title "Random Insert", \
+     "bench.dat" using 1:3 title "Ordered Insert", \
+     "bench.dat" using 1:4 title "AVL Random Insert", \
+     "bench.dat" using 1:5 title "AVL Ordered Insert", \
+     "bench.dat" using 1:6 title "Wide Random Insert", \
+     "bench.dat" using 1:7 title "AVL Search Hit", \
+     "bench.dat" using 1:8 title "AVL Search Miss", \
+     "bench.dat" using 1:9 title "Wide Search Hit", \
+     "bench.dat" using 1:10 title "AVL Zipf 95/5 Mix", \
+     "bench.dat" using 1:11 title "Wide Zipf 95/5 Mix", \
+     "bench.dat" using 1:12 title "Splay Search Hit", \
+     "bench.dat" using 1:13 title "Splay Zipf 95/5 Mix", \
+     "bench.dat" using 1:14 title "AVL Ordered 95/5 Mix", \
+     "bench.dat" using 1:15 title "Splay Ordered 95/5 Mix", \
+     "bench.dat" using 1:16 title "Zipf 1.2 95/5 Mix", \
+     "bench.dat" using 1:17 title "AVL Zipf 1.2 95/5 Mix", \
+     "bench.dat" using 1:18 title "Splay Zipf 1.2 95/5 Mix"
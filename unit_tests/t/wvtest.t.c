@@ -3,7 +3,18 @@
 
 /* EDIT HERE: add your code include(s) */
 #include "../bst.h"
+#include "../bst_frozen.h"
+#include "../bst_wide.h"
+#include "../bst_lockfree.h"
+#include "../bst_snapshot.h"
+#include "../bst_map.h"
 #include "stdio.h"
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/stat.h>
 
 /* EDIT HERE: write your tests */
 #define N_TESTS 10000
@@ -347,6 +358,1921 @@ WVTEST_MAIN("binary search tree tests - insert/sizes")
 	bst_destroy(my_tree);
 }
 
+/*
+ * Check the AVL property below 'node': ordered keys, correct stored
+ * heights and children heights differing by at most one.
+ * Return the subtree height, or -1 if the property is violated.
+ */
+int avl_check(struct bstnode_s *node, long lo, long hi)
+{
+	int hl, hr;
+
+	if (node == NULL)
+		return 0;
+	if (node->data <= lo || node->data >= hi)
+		return -1;
+
+	hl = avl_check(node->left, lo, node->data);
+	hr = avl_check(node->right, node->data, hi);
+	if (hl < 0 || hr < 0 || hl - hr > 1 || hr - hl > 1)
+		return -1;
+	if (node->height != 1 + (hl > hr ? hl : hr))
+		return -1;
+
+	return node->height;
+}
+
+WVTEST_MAIN("binary search tree tests - AVL balance under ordered insert/remove")
+{
+	bst *my_tree = NULL;
+	my_tree = bst_create_type(BST_AVL);
+	WVPASSEQ(bst_size(my_tree), 0);
+	WVFAIL(bst_create_type(42));
+
+	int i;
+	for (i=0; i<N_TESTS; i++) {
+		bst_insert(my_tree, i);
+	}
+	WVPASSEQ(bst_size(my_tree), N_TESTS);
+
+	/* no duplicates */
+	WVFAIL(bst_insert(my_tree, N_TESTS/2));
+	WVPASSEQ(bst_size(my_tree), N_TESTS);
+
+	/* 10000 keys fit in height 1.44 * log2(10000) ~= 19 */
+	WVPASSLT(avl_check(my_tree->root, -1, N_TESTS), 20);
+	WVPASSLT(0, avl_check(my_tree->root, -1, N_TESTS));
+
+	WVPASS(bst_search(my_tree, N_TESTS/4));
+	WVPASS(bst_search(my_tree, N_TESTS/3));
+	WVFAIL(bst_search(my_tree, 2 * N_TESTS));
+	WVPASSEQ(bst_find_min(my_tree), 0);
+	WVPASSEQ(bst_find_max(my_tree), N_TESTS - 1);
+
+	/* remove every other key and one end of the range */
+	for (i=0; i<N_TESTS; i+=2) {
+		WVPASSEQ(bst_remove(my_tree, i), 1);
+	}
+	for (i=N_TESTS/2 + 1; i<N_TESTS; i+=2) {
+		WVPASSEQ(bst_remove(my_tree, i), 1);
+	}
+	WVPASSEQ(bst_remove(my_tree, 0), 0);
+	WVPASSEQ(bst_size(my_tree), N_TESTS/4);
+	WVPASSLT(0, avl_check(my_tree->root, -1, N_TESTS));
+	WVPASS(bst_search(my_tree, 1));
+	WVFAIL(bst_search(my_tree, 2));
+	WVPASSEQ(bst_find_max(my_tree), N_TESTS/2 - 1);
+
+	/* and empty it completely */
+	for (i=0; i<N_TESTS; i++) {
+		bst_remove(my_tree, i);
+	}
+	WVPASSEQ(bst_size(my_tree), 0);
+	WVPASS(my_tree->root == NULL);
+
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - AVL in-order traversal")
+{
+	bst *my_tree = NULL;
+	my_tree = bst_create_type(BST_AVL);
+
+	bst_insert(my_tree, 7);
+	bst_insert(my_tree, 2);
+	bst_insert(my_tree, 11);
+	bst_insert(my_tree, 9);
+	bst_insert(my_tree, 1);
+	bst_insert(my_tree, 53);
+	bst_insert(my_tree, 99);
+	bst_insert(my_tree, 17);
+	bst_insert(my_tree, 3);
+	bst_insert(my_tree, 4);
+
+	char *str = (char *) malloc(bst_size(my_tree) * 2 * 4 * sizeof(char));
+
+	bst_inorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "1 2 3 4 7 9 11 17 53 99 ");
+
+	/* this insert order happens to need no rotations */
+	bst_preorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "7 2 1 3 4 11 9 53 17 99 ");
+	bst_destroy(my_tree);
+
+	/* ascending inserts are rotated into a complete tree */
+	my_tree = bst_create_type(BST_AVL);
+	int i;
+	for (i=1; i<=7; i++) {
+		bst_insert(my_tree, i);
+	}
+	bst_preorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "4 2 1 3 6 5 7 ");
+
+	bst_destroy(my_tree);
+	free(str);
+}
+
+/*
+ * Build, search, empty and destroy a degenerate (linked list) tree.
+ * Run on a thread with a tiny stack: one stack frame per level
+ * would overflow it long before the bottom of the tree.
+ */
+#define DEEP_NODES 20000
+#define SMALL_STACK (64 * 1024)
+
+void *deep_tree_worker(void *arg)
+{
+	int *results = (int *) arg;
+	bst *my_tree = bst_create();
+	int i;
+
+	for (i=0; i<DEEP_NODES; i++) {
+		bst_insert(my_tree, i);
+	}
+	results[0] = bst_search(my_tree, DEEP_NODES - 1);
+	results[1] = bst_find_max(my_tree);
+	results[2] = bst_remove(my_tree, DEEP_NODES - 1);
+	results[3] = bst_search(my_tree, DEEP_NODES - 1);
+	for (i=0; i<DEEP_NODES/2; i++) {
+		bst_remove(my_tree, i);
+	}
+	results[4] = bst_size(my_tree);
+
+	bst_destroy(my_tree);
+	return NULL;
+}
+
+WVTEST_MAIN("binary search tree tests - deep trees in constant stack space")
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	int results[5] = { 0 };
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SMALL_STACK);
+	WVPASSEQ(pthread_create(&thread, &attr, deep_tree_worker, results), 0);
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	WVPASSEQ(results[0], 1);
+	WVPASSEQ(results[1], DEEP_NODES - 1);
+	WVPASSEQ(results[2], 1);
+	WVPASSEQ(results[3], 0);
+	WVPASSEQ(results[4], DEEP_NODES/2 - 1);
+}
+
+WVTEST_MAIN("binary search tree tests - node pool reuse")
+{
+	bst *my_tree = NULL;
+	my_tree = bst_create_type(BST_AVL);
+
+	/* nothing is allocated for an empty tree */
+	WVPASSEQ(my_tree->pool.nchunks, 0);
+
+	int i;
+	for (i=0; i<N_TESTS; i++) {
+		bst_insert(my_tree, i);
+	}
+
+	/* chunks double in size, so 10000 nodes need only a few */
+	size_t nchunks = my_tree->pool.nchunks;
+	WVPASSLT(0, nchunks);
+	WVPASSLT(nchunks, 10);
+
+	/* removed nodes are reused rather than new chunks allocated */
+	int removed = 0;
+	for (i=0; i<N_TESTS; i++) {
+		removed += bst_remove(my_tree, i);
+	}
+	WVPASSEQ(removed, N_TESTS);
+	for (i=0; i<N_TESTS; i++) {
+		bst_insert(my_tree, -i);
+	}
+	WVPASSEQ(my_tree->pool.nchunks, nchunks);
+	WVPASSEQ(bst_size(my_tree), N_TESTS);
+	WVPASSEQ(bst_find_min(my_tree), 1 - N_TESTS);
+
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - bulk load from sorted and unsorted arrays")
+{
+	bst *my_tree = NULL;
+	bst_key keys[N_TESTS];
+	int i;
+
+	for (i=0; i<N_TESTS; i++) {
+		keys[i] = 3 * i;
+	}
+	my_tree = bst_create_from_sorted(keys, N_TESTS);
+	WVPASSEQ(bst_size(my_tree), N_TESTS);
+
+	/* minimum height: 10000 keys need 14 levels, and one chunk */
+	WVPASSEQ(avl_check(my_tree->root, -1, 3 * N_TESTS), 14);
+	WVPASSEQ(my_tree->pool.nchunks, 1);
+	WVPASS(bst_search(my_tree, 3 * 1234));
+	WVFAIL(bst_search(my_tree, 3 * 1234 + 1));
+	WVPASSEQ(bst_find_max(my_tree), 3 * (N_TESTS - 1));
+
+	/* it is an ordinary AVL tree afterwards */
+	for (i=0; i<N_TESTS; i+=2) {
+		bst_remove(my_tree, 3 * i);
+	}
+	for (i=0; i<N_TESTS; i++) {
+		bst_insert(my_tree, 3 * N_TESTS + i);
+	}
+	WVPASSEQ(bst_size(my_tree), N_TESTS + N_TESTS/2);
+	WVPASSLT(0, avl_check(my_tree->root, -1, 4 * N_TESTS));
+	bst_destroy(my_tree);
+
+	/* unsorted or duplicate keys are rejected */
+	keys[10] = keys[11];
+	WVFAIL(bst_create_from_sorted(keys, N_TESTS));
+	keys[10] = keys[12] + 1;
+	WVFAIL(bst_create_from_sorted(keys, N_TESTS));
+
+	/* ... but can be sorted and de-duplicated first */
+	bst_key unsorted[] = { 7, 2, 11, 9, 2, 1, 53, 99, 17, 7, 3, 4 };
+	char str[64];
+	my_tree = bst_create_from_array(unsorted, sizeof(unsorted) / sizeof(unsorted[0]));
+	WVPASSEQ(bst_size(my_tree), 10);
+	bst_inorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "1 2 3 4 7 9 11 17 53 99 ");
+	bst_preorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "9 3 2 1 7 4 53 17 11 99 ");
+	bst_destroy(my_tree);
+
+	/* empty input gives an empty tree */
+	my_tree = bst_create_from_sorted(keys, 0);
+	WVPASSEQ(bst_size(my_tree), 0);
+	WVPASS(bst_insert(my_tree, 5));
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - freeze and thaw")
+{
+	bst *my_tree = NULL;
+	bst *thawed = NULL;
+	bst_frozen *frozen = NULL;
+	int i, n, errors = 0;
+
+	/* every tree size up to a few levels, with every hit and miss */
+	for (n=0; n<70; n++) {
+		my_tree = bst_create();
+		for (i=0; i<n; i++) {
+			bst_insert(my_tree, 2 * ((i * 7919) % n));
+		}
+		frozen = bst_freeze(my_tree);
+		if (bst_frozen_size(frozen) != n) errors++;
+		for (i=-2; i<=2*n; i++) {
+			if (bst_frozen_search(frozen, i) != bst_search(my_tree, i)) errors++;
+		}
+		bst_frozen_destroy(frozen);
+		bst_destroy(my_tree);
+	}
+	WVPASSEQ(errors, 0);
+
+	/* breadth-first layout of a complete tree */
+	bst_key keys[] = { 1, 2, 3, 4, 5, 6, 7 };
+	frozen = bst_frozen_create_from_sorted(keys, 7);
+	WVPASSEQ(frozen->keys[1], 4);
+	WVPASSEQ(frozen->keys[2], 2);
+	WVPASSEQ(frozen->keys[3], 6);
+	WVPASSEQ(frozen->keys[7], 7);
+
+	/* and thawed back into a mutable tree */
+	char str[64];
+	thawed = bst_thaw(frozen);
+	WVPASSEQ(bst_size(thawed), 7);
+	bst_preorder_tostring(thawed, str);
+	WVPASSEQSTR(str, "4 2 1 3 6 5 7 ");
+	WVPASS(bst_insert(thawed, 8));
+	WVPASSEQ(bst_find_max(thawed), 8);
+	WVFAIL(bst_frozen_search(frozen, 8));
+
+	bst_destroy(thawed);
+	bst_frozen_destroy(frozen);
+
+	/* extreme keys */
+	my_tree = bst_create();
+	bst_insert(my_tree, 2147483647);
+	bst_insert(my_tree, -2147483647 - 1);
+	bst_insert(my_tree, 0);
+	frozen = bst_freeze(my_tree);
+	WVPASS(bst_frozen_search(frozen, 2147483647));
+	WVPASS(bst_frozen_search(frozen, -2147483647 - 1));
+	WVFAIL(bst_frozen_search(frozen, 1));
+	bst_frozen_destroy(frozen);
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - batched search")
+{
+	bst *my_tree = NULL;
+	bst_key keys[1000];
+	uint8_t found[1000];
+	int i, errors = 0;
+
+	/* an empty tree finds nothing */
+	my_tree = bst_create();
+	for (i=0; i<1000; i++) {
+		keys[i] = i;
+		found[i] = 1;
+	}
+	WVPASSEQ(bst_search_batch(my_tree, keys, 1000, found), 0);
+	WVPASSEQ(found[0], 0);
+	WVPASSEQ(found[999], 0);
+	WVPASSEQ(bst_search_batch(my_tree, keys, 0, found), 0);
+
+	/* every third key present, lookups in a scattered order */
+	for (i=0; i<1000; i+=3) {
+		bst_insert(my_tree, i);
+	}
+	for (i=0; i<1000; i++) {
+		keys[i] = (i * 7919) % 1000;
+	}
+	WVPASSEQ(bst_search_batch(my_tree, keys, 1000, found), 334);
+	for (i=0; i<1000; i++) {
+		if (found[i] != bst_search(my_tree, keys[i])) errors++;
+	}
+	WVPASSEQ(errors, 0);
+
+	/* fewer lookups than lanes, and no result array */
+	WVPASSEQ(bst_search_batch(my_tree, keys, 5, NULL), 1);
+
+	bst_destroy(my_tree);
+}
+
+/*
+ * Check the B-tree properties below 'node': ordered keys within
+ * (lo, hi), key counts within bounds, all leaves at 'depth', the
+ * right subtree counts, and every node on a cache line boundary.
+ * Return the number of keys in the subtree, or -1 on a violation.
+ */
+long wide_check(struct bst_widenode_s *node, long lo, long hi, int is_root, int depth)
+{
+	long total = 0, sub;
+	int i;
+
+	if (node->n > BST_WIDE_MAX_KEYS || node->n < (is_root ? 1 : BST_WIDE_MIN_KEYS))
+		return -1;
+	if ((uintptr_t) node % BST_POOL_ALIGN != 0)
+		return -1;
+	for (i=0; i<node->n; i++) {
+		if (node->keys[i] <= (i ? node->keys[i-1] : lo) || node->keys[i] >= hi)
+			return -1;
+	}
+	if (node->leaf)
+		return depth == 1 && node->count == (size_t) node->n ? node->n : -1;
+
+	for (i=0; i<=node->n; i++) {
+		sub = wide_check(node->child[i], i ? node->keys[i-1] : lo,
+				i < node->n ? node->keys[i] : hi, 0, depth - 1);
+		if (sub < 0)
+			return -1;
+		total += sub;
+	}
+	if (node->count != (size_t)(total + node->n))
+		return -1;
+	return total + node->n;
+}
+
+int wide_depth(struct bst_widenode_s *node)
+{
+	int depth = 1;
+
+	while (! node->leaf) {
+		node = node->child[0];
+		depth++;
+	}
+	return depth;
+}
+
+WVTEST_MAIN("binary search tree tests - wide (B-tree) nodes, every instruction set")
+{
+	bst *my_tree = NULL;
+	char present[4 * N_TESTS];
+	int isa, i, k, errors;
+
+	WVPASS(bst_wide_set_isa(BST_WIDE_SCALAR));
+	for (isa = BST_WIDE_SCALAR; isa <= BST_WIDE_AVX2; isa++) {
+		if (! bst_wide_set_isa(isa))
+			continue;	// not on this CPU
+		WVPASSEQ(bst_wide_isa(), isa);
+
+		my_tree = bst_create_type(BST_WIDE);
+		memset(present, 0, sizeof(present));
+		srand48(SEED);
+		errors = 0;
+
+		/* random inserts and removes, mirrored in 'present' */
+		for (i=0; i<8 * N_TESTS; i++) {
+			k = (int)(4 * N_TESTS * drand48());
+			if (drand48() < 0.6) {
+				if (bst_insert(my_tree, k) == present[k]) errors++;
+				present[k] = 1;
+			} else {
+				if (bst_remove(my_tree, k) != present[k]) errors++;
+				present[k] = 0;
+			}
+		}
+		for (k=0; k<4 * N_TESTS; k++) {
+			if (bst_search(my_tree, k) != present[k]) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(wide_check(my_tree->wroot, -1, 4 * N_TESTS, 1, wide_depth(my_tree->wroot)), bst_size(my_tree));
+
+		/* 16-way nodes: a few thousand keys are only 4 or 5 levels deep */
+		WVPASSLT(wide_depth(my_tree->wroot), 6);
+
+		/* ascending keys, then empty it again */
+		bst_destroy(my_tree);
+		my_tree = bst_create_type(BST_WIDE);
+		for (i=0; i<N_TESTS; i++) {
+			bst_insert(my_tree, i);
+		}
+		WVPASSEQ(wide_check(my_tree->wroot, -1, N_TESTS, 1, wide_depth(my_tree->wroot)), N_TESTS);
+		WVPASSEQ(bst_find_min(my_tree), 0);
+		WVPASSEQ(bst_find_max(my_tree), N_TESTS - 1);
+		for (i=0; i<N_TESTS; i++) {
+			if (! bst_remove(my_tree, (i * 7919) % N_TESTS)) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(bst_size(my_tree), 0);
+		WVPASS(my_tree->wroot == NULL);
+		WVPASSEQ(bst_find_min(my_tree), 0);
+		bst_destroy(my_tree);
+	}
+
+	/* extreme keys survive the SIMD compares */
+	my_tree = bst_create_type(BST_WIDE);
+	bst_insert(my_tree, 2147483647);
+	bst_insert(my_tree, -2147483647 - 1);
+	WVPASS(bst_search(my_tree, 2147483647));
+	WVPASS(bst_search(my_tree, -2147483647 - 1));
+	WVFAIL(bst_search(my_tree, 0));
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - wide (B-tree) traversals")
+{
+	bst *my_tree = NULL;
+	my_tree = bst_create_type(BST_WIDE);
+
+	int i;
+	for (i=20; i>=1; i--) {
+		bst_insert(my_tree, i);
+	}
+
+	char *str = (char *) malloc(bst_size(my_tree) * 2 * 4 * sizeof(char));
+
+	bst_inorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 ");
+
+	/* 15 keys fill the root, which splits around its middle key 13 */
+	bst_preorder_tostring(my_tree, str);
+	WVPASSEQSTR(str, "13 1 2 3 4 5 6 7 8 9 10 11 12 14 15 16 17 18 19 20 ");
+
+	bst_key arr[20];
+	bst_inorder_toarray(my_tree, arr);
+	WVPASSEQ(arr[0], 1);
+	WVPASSEQ(arr[19], 20);
+
+	bst_destroy(my_tree);
+	free(str);
+}
+
+/*
+ * Shared-tree stress test: writers churn their own range of odd keys
+ * while readers check that the even keys, which are never touched,
+ * are always found and keys outside the ranges never are.
+ */
+#define STRESS_READERS 4
+#define STRESS_WRITERS 2
+#define STRESS_KEYS 2000
+#define STRESS_ROUNDS 21000	// an odd number of passes, ending on inserts
+
+struct stress_arg {
+	bst *tree;
+	int id;
+	int errors;
+};
+
+void *stress_reader(void *p)
+{
+	struct stress_arg *arg = (struct stress_arg *) p;
+	int i, k;
+
+	for (i=0; i<STRESS_ROUNDS; i++) {
+		k = 2 * ((i * 7919 + arg->id) % STRESS_KEYS);
+		if (! bst_search(arg->tree, k)) arg->errors++;
+		if (bst_search(arg->tree, -1 - k)) arg->errors++;
+	}
+	return NULL;
+}
+
+void *stress_writer(void *p)
+{
+	struct stress_arg *arg = (struct stress_arg *) p;
+	int i, k;
+
+	for (i=0; i<STRESS_ROUNDS; i++) {
+		/* writer 'id' owns the odd keys k with k % (2 * STRESS_WRITERS) == 2 * id + 1 */
+		k = 2 * STRESS_WRITERS * (i % (STRESS_KEYS / STRESS_WRITERS)) + 2 * arg->id + 1;
+		if (i / (STRESS_KEYS / STRESS_WRITERS) % 2 == 0) {
+			if (! bst_insert(arg->tree, k)) arg->errors++;
+		} else {
+			if (! bst_remove(arg->tree, k)) arg->errors++;
+		}
+	}
+	return NULL;
+}
+
+WVTEST_MAIN("binary search tree tests - concurrent readers and writers")
+{
+	pthread_t threads[STRESS_READERS + STRESS_WRITERS];
+	struct stress_arg args[STRESS_READERS + STRESS_WRITERS];
+	int types[] = { BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY };
+	int t, i, k, errors;
+
+	WVFAIL(bst_create_type(42 | BST_THREADSAFE));
+
+	for (t=0; t<4; t++) {
+		bst *my_tree = bst_create_type(types[t] | BST_THREADSAFE);
+		WVPASS(my_tree != NULL);
+
+		/* the even keys are always there */
+		for (i=0; i<STRESS_KEYS; i++) {
+			bst_insert(my_tree, 2 * ((i * 7919) % STRESS_KEYS));
+		}
+
+		for (i=0; i<STRESS_READERS + STRESS_WRITERS; i++) {
+			args[i].tree = my_tree;
+			args[i].id = i < STRESS_READERS ? i : i - STRESS_READERS;
+			args[i].errors = 0;
+			pthread_create(&threads[i], NULL,
+					i < STRESS_READERS ? stress_reader : stress_writer, &args[i]);
+		}
+		errors = 0;
+		for (i=0; i<STRESS_READERS + STRESS_WRITERS; i++) {
+			pthread_join(threads[i], NULL);
+			errors += args[i].errors;
+		}
+		WVPASSEQ(errors, 0);
+
+		/* every writer ended on an insert pass */
+		WVPASSEQ(bst_size(my_tree), 2 * STRESS_KEYS);
+		for (k=0; k<2 * STRESS_KEYS; k++) {
+			if (! bst_search(my_tree, k)) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		if (types[t] == BST_AVL) {
+			WVPASSLT(0, avl_check(my_tree->root, -1, 2 * STRESS_KEYS));
+		}
+
+		bst_destroy(my_tree);
+	}
+}
+
+WVTEST_MAIN("binary search tree tests - buffered serializer")
+{
+	int keys[] = { INT_MIN, -100, -7, 0, 9, 10, 99, 12345, INT_MAX };
+	int types[] = { BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY };
+	char expected[] = "-2147483648 -100 -7 0 9 10 99 12345 2147483647 ";
+	char str[64], *grown;
+	bst_writer w;
+	FILE *fp;
+	int t, i;
+
+	for (t=0; t<4; t++) {
+		bst *my_tree = bst_create_type(types[t]);
+		for (i=0; i<9; i++) {
+			bst_insert(my_tree, keys[(i * 5) % 9]);
+		}
+
+		/* an explicit capacity: the full length is returned, what fits is kept */
+		WVPASSEQ(bst_inorder_tostring_n(my_tree, str, sizeof(str)), strlen(expected));
+		WVPASSEQSTR(str, expected);
+		WVPASSEQ(bst_inorder_tostring_n(my_tree, str, 20), strlen(expected));
+		WVPASSEQSTR(str, "-2147483648 -100 ");
+		WVPASSEQ(bst_preorder_tostring_n(my_tree, NULL, 0), strlen(expected));
+
+		/* a buffer that grows */
+		WVPASS(bst_writer_init_grow(&w, 1));
+		bst_inorder_write(my_tree, &w);
+		grown = bst_writer_finish(&w);
+		WVPASSEQSTR(grown, expected);
+		WVFAIL(w.error);
+		free(grown);
+
+		/* a stream */
+		fp = tmpfile();
+		bst_writer_init_file(&w, fp);
+		bst_inorder_write(my_tree, &w);
+		bst_writer_finish(&w);
+		rewind(fp);
+		WVPASS(fgets(str, sizeof(str), fp) != NULL);
+		WVPASSEQSTR(str, expected);
+		fclose(fp);
+
+		bst_destroy(my_tree);
+	}
+
+	/* a fixed buffer that ends mid-string keeps none of that string,
+	 * nor anything after it, but counts it all */
+	bst_writer_init_buf(&w, str, 10);
+	bst_writer_str(&w, "abc ");
+	bst_writer_str(&w, "defgh ");
+	bst_writer_str(&w, "i");
+	WVPASSEQSTR(bst_writer_finish(&w), "abc ");
+	WVPASSEQ(w.total, 11);
+	WVPASS(w.error);
+	bst_writer_init_buf(&w, str, 11);
+	bst_writer_str(&w, "abc ");
+	bst_writer_str(&w, "defgh ");
+	WVPASSEQSTR(bst_writer_finish(&w), "abc defgh ");
+	WVFAIL(w.error);
+
+	/* more than a chunk, through a file descriptor */
+	{
+		bst *my_tree = bst_create_type(BST_AVL);
+		char *direct = NULL;
+		size_t len;
+
+		for (i=0; i<N_TESTS; i++) {
+			bst_insert(my_tree, (i * 7919) % N_TESTS - N_TESTS / 2);
+		}
+		len = bst_preorder_tostring_n(my_tree, NULL, 0);
+		WVPASSLT(BST_WRITER_CHUNK, len);
+		direct = (char *) malloc(len + 1);
+		bst_preorder_tostring(my_tree, direct);
+
+		fp = tmpfile();
+		bst_writer_init_fd(&w, fileno(fp));
+		bst_preorder_write(my_tree, &w);
+		bst_writer_finish(&w);
+		WVFAIL(w.error);
+		grown = (char *) malloc(len + 1);
+		rewind(fp);
+		WVPASSEQ(fread(grown, 1, len + 1, fp), len);
+		grown[len] = '\0';
+		WVPASSEQSTR(grown, direct);
+		fclose(fp);
+
+		free(grown);
+		free(direct);
+		bst_destroy(my_tree);
+	}
+}
+
+WVTEST_MAIN("binary search tree tests - snapshot save and mmap load")
+{
+	const char *path = "t/snapshot.tmp";
+	struct bst_snapshot_header header;
+	bst_frozen *loaded;
+	bst *my_tree;
+	FILE *fp;
+	int i, k, errors = 0;
+
+	my_tree = bst_create_type(BST_AVL);
+	for (i=0; i<N_TESTS; i++) {
+		bst_insert(my_tree, 3 * ((i * 7919) % N_TESTS) - N_TESTS);
+	}
+	WVPASS(bst_save(my_tree, path));
+
+	/* readable by all, and no temporary file left behind */
+	{
+		struct stat st;
+		glob_t g;
+
+		WVPASSEQ(stat(path, &st), 0);
+		WVPASSEQ(st.st_mode & 0777, 0644);
+		WVPASSEQ(glob("t/snapshot.tmp.*", 0, NULL, &g), GLOB_NOMATCH);
+		globfree(&g);
+	}
+	WVFAIL(bst_save(my_tree, "t/no-such-dir/snapshot.tmp"));
+
+	loaded = bst_load_mmap(path);
+	WVPASS(loaded != NULL);
+	WVPASSEQ(bst_frozen_size(loaded), N_TESTS);
+	for (k=-N_TESTS - 3; k<2 * N_TESTS + 3; k++) {
+		if (bst_frozen_search(loaded, k) != bst_search(my_tree, k)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+
+	/* thawing copies the keys out of the mapping */
+	{
+		bst *thawed = bst_thaw(loaded);
+		bst_frozen_destroy(loaded);
+		WVPASSEQ(bst_size(thawed), N_TESTS);
+		WVPASS(bst_search(thawed, -N_TESTS));
+		bst_destroy(thawed);
+	}
+
+	/* flip a bit in the last key: only the checked load notices */
+	fp = fopen(path, "r+b");
+	fseek(fp, -1, SEEK_END);
+	k = fgetc(fp);
+	fseek(fp, -1, SEEK_END);
+	fputc(k ^ 1, fp);
+	fclose(fp);
+	WVFAIL(bst_load_mmap(path));
+	loaded = bst_load_mmap_unchecked(path);
+	WVPASS(loaded != NULL);
+	bst_frozen_destroy(loaded);
+
+	/* a different version, and a truncated file, are refused */
+	WVPASS(bst_save(my_tree, path));
+	fp = fopen(path, "r+b");
+	WVPASSEQ(fread(&header, sizeof(header), 1, fp), 1);
+	header.version++;
+	rewind(fp);
+	fwrite(&header, sizeof(header), 1, fp);
+	fclose(fp);
+	WVFAIL(bst_load_mmap_unchecked(path));
+
+	WVPASS(bst_save(my_tree, path));
+	WVPASSEQ(truncate(path, sizeof(header) + N_TESTS * sizeof(int)), 0);
+	WVFAIL(bst_load_mmap_unchecked(path));
+
+	/* empty trees round trip too */
+	bst_destroy(my_tree);
+	my_tree = bst_create();
+	WVPASS(bst_save(my_tree, path));
+	loaded = bst_load_mmap(path);
+	WVPASS(loaded != NULL);
+	WVPASSEQ(bst_frozen_size(loaded), 0);
+	WVFAIL(bst_frozen_search(loaded, 0));
+	bst_frozen_destroy(loaded);
+
+	unlink(path);
+	WVFAIL(bst_load_mmap(path));
+	bst_destroy(my_tree);
+}
+
+/*
+ * Check the links of a map's AVL tree: parent pointers, heights and
+ * balance. Return the height, or -1 if anything is wrong.
+ */
+int link_check(struct bst_link *node, struct bst_link *parent)
+{
+	int l, r;
+
+	if (node == NULL) return 0;
+	if (node->parent != parent) return -1;
+	l = link_check(node->left, node);
+	r = link_check(node->right, node);
+	if (l < 0 || r < 0 || l - r > 1 || r - l > 1) return -1;
+	if (node->height != 1 + (l > r ? l : r)) return -1;
+	return node->height;
+}
+
+int cmp_int_ptr(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+WVTEST_MAIN("binary search tree tests - generic key/value maps")
+{
+	static int ints[N_TESTS];
+	bst_map_i64 *i64 = bst_map_i64_create();
+	bst_map_u64 *u64 = bst_map_u64_create();
+	bst_map_f64 *f64 = bst_map_f64_create();
+	bst_map_str *str = bst_map_str_create();
+	bst_map_ptr *ptr = bst_map_ptr_create(cmp_int_ptr);
+	char name[BST_MAP_STRLEN];
+	void *value;
+	int i, k, errors = 0;
+
+	/* the same keys in every map, each mapped to its own index */
+	for (i=0; i<N_TESTS; i++) {
+		k = (i * 7919) % N_TESTS;
+		ints[k] = k - N_TESTS / 2;
+		sprintf(name, "key%05d", k);
+		if (! bst_map_i64_insert(i64, (int64_t) ints[k] << 32, &ints[k])) errors++;
+		if (! bst_map_u64_insert(u64, UINT64_MAX - k, &ints[k])) errors++;
+		if (! bst_map_f64_insert(f64, ints[k] / 8.0, &ints[k])) errors++;
+		if (! bst_map_str_insert(str, bst_mapstr_make(name), &ints[k])) errors++;
+		if (! bst_map_ptr_insert(ptr, &ints[k], &ints[k])) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVFAIL(bst_map_i64_insert(i64, 0, NULL));
+	WVFAIL(bst_map_str_insert(str, bst_mapstr_make("key00000"), NULL));
+	WVPASSEQ(bst_map_f64_size(f64), N_TESTS);
+	WVPASSEQ(bst_map_str_size(str), N_TESTS);
+
+	for (k=0; k<N_TESTS; k++) {
+		sprintf(name, "key%05d", k);
+		if (*bst_map_i64_get(i64, (int64_t) ints[k] << 32) != &ints[k]) errors++;
+		if (*bst_map_u64_get(u64, UINT64_MAX - k) != &ints[k]) errors++;
+		if (*bst_map_f64_get(f64, ints[k] / 8.0) != &ints[k]) errors++;
+		if (*bst_map_str_get(str, bst_mapstr_make(name)) != &ints[k]) errors++;
+		if (*bst_map_ptr_get(ptr, &ints[k]) != &ints[k]) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVFAIL(bst_map_i64_get(i64, 1));
+	WVFAIL(bst_map_f64_get(f64, 0.0625));
+	WVFAIL(bst_map_str_get(str, bst_mapstr_make("key")));
+
+	/* values can be changed in place */
+	*bst_map_u64_get(u64, UINT64_MAX) = NULL;
+	WVPASS(*bst_map_u64_get(u64, UINT64_MAX) == NULL);
+
+	/* remove every other key, in ascending order - the worst case for rebalancing */
+	for (k=0; k<N_TESTS; k+=2) {
+		sprintf(name, "key%05d", k);
+		if (! bst_map_i64_remove(i64, (int64_t) ints[k] << 32, &value) || value != &ints[k]) errors++;
+		if (! bst_map_u64_remove(u64, UINT64_MAX - k, NULL)) errors++;
+		if (! bst_map_f64_remove(f64, ints[k] / 8.0, NULL)) errors++;
+		if (! bst_map_str_remove(str, bst_mapstr_make(name), NULL)) errors++;
+		if (! bst_map_ptr_remove(ptr, &ints[k], NULL)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVFAIL(bst_map_ptr_remove(ptr, &ints[0], NULL));
+	WVPASSEQ(bst_map_i64_size(i64), N_TESTS / 2);
+	for (k=0; k<N_TESTS; k++) {
+		if ((bst_map_ptr_get(ptr, &ints[k]) == NULL) != (k % 2 == 0)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+
+	WVPASSLT(0, link_check(i64->root, NULL));
+	WVPASSLT(0, link_check(u64->root, NULL));
+	WVPASSLT(0, link_check(f64->root, NULL));
+	WVPASSLT(0, link_check(str->root, NULL));
+	WVPASSLT(0, link_check(ptr->root, NULL));
+
+	bst_map_i64_destroy(i64);
+	bst_map_u64_destroy(u64);
+	bst_map_f64_destroy(f64);
+	bst_map_str_destroy(str);
+	bst_map_ptr_destroy(ptr);
+
+	// a pointer map cannot be made without its comparator
+	WVPASS(bst_map_ptr_create(NULL) == NULL);
+}
+
+#ifdef BST_KEY64
+WVTEST_MAIN("binary search tree tests - 64-bit keys")
+{
+	int types[] = { BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY };
+	bst_key keys[64], arr[64];
+	bst_frozen *frozen;
+	char str[1500];
+	int t, i, errors = 0;
+
+	/* keys far outside the range of an int, and the extremes */
+	for (i=0; i<64; i++) {
+		keys[i] = (bst_key)(i - 32) << 40 | i;
+	}
+	keys[0] = BST_KEY_MIN;
+	keys[63] = BST_KEY_MAX;
+
+	for (t=0; t<4; t++) {
+		bst *my_tree = bst_create_type(types[t]);
+		for (i=0; i<64; i++) {
+			if (! bst_insert(my_tree, keys[(i * 37) % 64])) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(bst_size(my_tree), 64);
+		for (i=0; i<64; i++) {
+			/* keys that only differ in their top or bottom 32 bits */
+			if (! bst_search(my_tree, keys[i])) errors++;
+			if (i > 0 && i < 63 && bst_search(my_tree, keys[i] ^ ((bst_key) 1 << 40))) errors++;
+			if (i > 0 && i < 63 && bst_search(my_tree, keys[i] + 64)) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASS(bst_find_min(my_tree) == BST_KEY_MIN);
+		WVPASS(bst_find_max(my_tree) == BST_KEY_MAX);
+
+		bst_inorder_toarray(my_tree, arr);
+		WVPASS(memcmp(arr, keys, sizeof(keys)) == 0);
+		bst_inorder_tostring(my_tree, str);
+		WVPASS(strncmp(str, "-9223372036854775808 -34084860461055 ", 37) == 0);
+
+		bst_destroy(my_tree);
+	}
+
+	frozen = bst_frozen_create_from_sorted(keys, 64);
+	for (i=0; i<64; i++) {
+		if (! bst_frozen_search(frozen, keys[i])) errors++;
+		if (i > 0 && bst_frozen_search(frozen, keys[i] - 1)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	bst_frozen_destroy(frozen);
+}
+#endif
+
+/*
+ * Check the subtree count of every node below 'node'.
+ * Return the number of nodes in the subtree, or -1 on a wrong count.
+ */
+long count_check(struct bstnode_s *node)
+{
+	long l, r;
+
+	if (node == NULL)
+		return 0;
+	l = count_check(node->left);
+	r = count_check(node->right);
+	if (l < 0 || r < 0 || node->count != (size_t)(l + r + 1))
+		return -1;
+	return l + r + 1;
+}
+
+/* a bst_visit that checks the keys arrive in order, and sums them */
+struct range_sum {
+	bst_key last;
+	long sum;
+	int errors;
+};
+
+void range_sum_visit(bst_key key, void *ctx)
+{
+	struct range_sum *rs = (struct range_sum *) ctx;
+
+	if (key <= rs->last) rs->errors++;
+	rs->last = key;
+	rs->sum += key;
+}
+
+WVTEST_MAIN("binary search tree tests - range queries")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY};
+	bst *my_tree = NULL;
+	bst_key keys[2000], out[100];
+	struct range_sum rs;
+	int i, j, t, lo, hi, expect, errors = 0;
+	long sum;
+
+	for (t=0; t<4; t++) {
+		my_tree = bst_create_type(types[t]);
+
+		/* empty tree, empty ranges */
+		WVPASSEQ(bst_range_count(my_tree, BST_KEY_MIN, BST_KEY_MAX), 0);
+		WVPASSEQ(bst_range_to_array(my_tree, 0, 10, out, 100), 0);
+
+		/* the even keys 0..3998, inserted in a scattered order */
+		for (i=0; i<2000; i++) {
+			bst_insert(my_tree, 2 * ((i * 7919) % 2000));
+		}
+		WVPASSEQ(bst_range_count(my_tree, BST_KEY_MIN, BST_KEY_MAX), 2000);
+		WVPASSEQ(bst_range_count(my_tree, 10, 9), 0);
+		WVPASSEQ(bst_range_count(my_tree, 11, 11), 0);
+		WVPASSEQ(bst_range_count(my_tree, 3998, BST_KEY_MAX), 1);
+		WVPASSEQ(bst_range_count(my_tree, BST_KEY_MIN, -1), 0);
+
+		/* against the brute force answer, with and without room */
+		for (i=0; i<500; i++) {
+			lo = (i * 104729) % 4100 - 50;
+			hi = lo + (i % 7) * 37;
+			expect = 0;
+			for (j=0; j<4000; j+=2) {
+				if (j >= lo && j <= hi) expect++;
+			}
+			if (bst_range_count(my_tree, lo, hi) != (size_t) expect) errors++;
+			if (bst_range_to_array(my_tree, lo, hi, out, 10) != (size_t) expect) errors++;
+			if (bst_range_to_array(my_tree, lo, hi, out, 100) != (size_t) expect) errors++;
+			for (j=0; j<expect && j<100; j++) {
+				if (out[j] != (lo > 0 ? 2 * ((lo + 1) / 2) : 0) + 2 * j) errors++;
+			}
+		}
+		WVPASSEQ(errors, 0);
+
+		/* visit in order, and count the same */
+		rs.last = BST_KEY_MIN;
+		rs.sum = 0;
+		rs.errors = 0;
+		WVPASSEQ(bst_range_foreach(my_tree, 1000, 1999, range_sum_visit, &rs), 500);
+		WVPASSEQ(rs.errors, 0);
+		for (sum=0, j=1000; j<2000; j+=2) sum += j;
+		WVPASSEQ(rs.sum, sum);
+		WVPASSEQ(bst_range_foreach(my_tree, 1000, 1999, NULL, NULL), 500);
+
+		/* counts stay right through removes and rotations */
+		for (i=0; i<2000; i+=3) {
+			bst_remove(my_tree, 2 * i);
+		}
+		WVPASSEQ(bst_range_count(my_tree, BST_KEY_MIN, BST_KEY_MAX), bst_size(my_tree));
+		WVPASSEQ(bst_range_count(my_tree, 0, 17), 6);
+		if (types[t] != BST_WIDE) {
+			WVPASSEQ(count_check(my_tree->root), (long) bst_size(my_tree));
+		}
+
+		bst_destroy(my_tree);
+	}
+
+	/* bulk loaded trees get their counts too */
+	for (i=0; i<2000; i++) {
+		keys[i] = 3 * i;
+	}
+	my_tree = bst_create_from_sorted(keys, 2000);
+	WVPASSEQ(count_check(my_tree->root), 2000);
+	WVPASSEQ(bst_range_count(my_tree, 3, 300), 100);
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - rank, select and percentiles")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY};
+	bst *my_tree = NULL;
+	int i, t, errors = 0;
+
+	for (t=0; t<4; t++) {
+		my_tree = bst_create_type(types[t]);
+
+		/* an empty tree */
+		WVPASSEQ(bst_rank(my_tree, 5), 0);
+		WVPASSEQ(bst_select(my_tree, 0), 0);
+		WVPASSEQ(bst_percentile(my_tree, 50), 0);
+
+		/* the keys 10, 20, ... 10000, inserted in a scattered order */
+		for (i=0; i<1000; i++) {
+			bst_insert(my_tree, 10 * ((i * 7919) % 1000 + 1));
+		}
+		for (i=0; i<1000; i++) {
+			if (bst_select(my_tree, i) != 10 * (i + 1)) errors++;
+			if (bst_rank(my_tree, 10 * (i + 1)) != (size_t) i) errors++;
+			if (bst_rank(my_tree, 10 * (i + 1) + 5) != (size_t) i + 1) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(bst_rank(my_tree, BST_KEY_MIN), 0);
+		WVPASSEQ(bst_rank(my_tree, BST_KEY_MAX), 1000);
+		WVPASSEQ(bst_select(my_tree, 1000), 0);
+
+		/* nearest-rank percentiles */
+		WVPASSEQ(bst_percentile(my_tree, 0), 10);
+		WVPASSEQ(bst_percentile(my_tree, 50), 5000);
+		WVPASSEQ(bst_percentile(my_tree, 99), 9900);
+		WVPASSEQ(bst_percentile(my_tree, 99.95), 10000);
+		WVPASSEQ(bst_percentile(my_tree, 100), 10000);
+		WVPASSEQ(bst_percentile(my_tree, -1), 0);
+		WVPASSEQ(bst_percentile(my_tree, 100.5), 0);
+		WVPASSEQ(bst_percentile(my_tree, 0.0 / 0.0), 0);
+		WVPASSEQ(bst_percentile(my_tree, 1.0 / 0.0), 0);
+
+		/* still right after removes, and min/max agree */
+		for (i=1; i<=1000; i+=2) {
+			bst_remove(my_tree, 10 * i);
+		}
+		WVPASSEQ(bst_select(my_tree, 0), 20);
+		WVPASSEQ(bst_select(my_tree, 499), 10000);
+		WVPASSEQ(bst_rank(my_tree, 5000), 249);
+		WVPASSEQ(bst_find_min(my_tree), 20);
+		WVPASSEQ(bst_find_max(my_tree), 10000);
+
+		bst_destroy(my_tree);
+	}
+
+	/* inserts that run out of memory part way leave the counts alone */
+	for (t=0; t<4; t++) {
+		size_t n, chunk_nodes;
+
+		my_tree = bst_create_type(types[t]);
+		for (i=0; i<1000; i++) {
+			bst_insert(my_tree, 2 * ((i * 7919) % 1000));
+		}
+		chunk_nodes = my_tree->pool.chunk_nodes;
+		my_tree->pool.free_list = NULL;	// no nodes left, and no chunk big enough
+		my_tree->pool.next = my_tree->pool.end;
+		my_tree->pool.chunk_nodes = (size_t) -1 / my_tree->pool.node_size;
+		n = 1000;
+		for (i=0; i<1000; i++) {
+			n += bst_insert(my_tree, 2 * i + 1);
+		}
+		WVPASS(n < 2000);
+		WVPASSEQ(bst_size(my_tree), n);
+		for (i=0; i<(int) n; i++) {
+			if (bst_rank(my_tree, bst_select(my_tree, i)) != (size_t) i) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(bst_range_count(my_tree, BST_KEY_MIN, BST_KEY_MAX), n);
+		WVPASSEQ(bst_select(my_tree, 0), 0);
+		WVPASSEQ(bst_select(my_tree, n - 1), bst_find_max(my_tree));
+		my_tree->pool.chunk_nodes = chunk_nodes;
+		bst_destroy(my_tree);
+	}
+}
+
+WVTEST_MAIN("binary search tree tests - cursors")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY};
+	bst *my_tree = NULL;
+	bst_iter_t it;
+	bst_key *keys;
+	int i, t, n = 20000, errors = 0;
+
+	keys = (bst_key *) malloc(n * sizeof(bst_key));
+	for (t=0; t<4; t++) {
+		my_tree = bst_create_type(types[t]);
+
+		/* an empty tree has nothing to point at */
+		WVPASSEQ(bst_iter_first(&it, my_tree), 0);
+		WVPASSEQ(bst_iter_last(&it, my_tree), 0);
+		WVPASSEQ(bst_iter_valid(&it), 0);
+		WVPASSEQ(bst_iter_next(&it), 0);
+
+		/* odd keys 1..2n-1, deep enough for a few wide levels */
+		for (i=0; i<n; i++) {
+			bst_insert(my_tree, 2 * ((i * 7919) % n) + 1);
+		}
+		bst_inorder_toarray(my_tree, keys);
+
+		/* all the way forwards, then all the way back */
+		i = 0;
+		for (bst_iter_first(&it, my_tree); bst_iter_valid(&it); bst_iter_next(&it)) {
+			if (i >= n || bst_iter_key(&it) != keys[i]) errors++;
+			i++;
+		}
+		WVPASSEQ(i, n);
+		WVPASSEQ(bst_iter_next(&it), 0);
+		for (bst_iter_last(&it, my_tree); bst_iter_valid(&it); bst_iter_prev(&it)) {
+			i--;
+			if (i < 0 || bst_iter_key(&it) != keys[i]) errors++;
+		}
+		WVPASSEQ(i, 0);
+		WVPASSEQ(errors, 0);
+
+		/* lower bounds on and between keys, then a step each way */
+		for (i=0; i<n; i+=7) {
+			if (! bst_iter_lower_bound(&it, my_tree, 2 * i)) errors++;
+			if (bst_iter_key(&it) != 2 * i + 1) errors++;
+			if (! bst_iter_lower_bound(&it, my_tree, 2 * i + 1)) errors++;
+			if (bst_iter_key(&it) != 2 * i + 1) errors++;
+			if (bst_iter_next(&it) != (i < n - 1)) errors++;
+			if (i < n - 1 && bst_iter_key(&it) != 2 * i + 3) errors++;
+			bst_iter_lower_bound(&it, my_tree, 2 * i + 1);
+			if (bst_iter_prev(&it) != (i > 0)) errors++;
+			if (i > 0 && bst_iter_key(&it) != 2 * i - 1) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		WVPASSEQ(bst_iter_lower_bound(&it, my_tree, 2 * n), 0);
+		WVPASSEQ(bst_iter_lower_bound(&it, my_tree, BST_KEY_MIN), 1);
+		WVPASSEQ(bst_iter_key(&it), 1);
+
+		bst_destroy(my_tree);
+	}
+	free(keys);
+}
+
+/*
+ * Check that 'my_tree' holds exactly the keys below 'n' for which
+ * 'in(key)' is set, and is balanced. Return the number of errors.
+ */
+int set_check(bst *my_tree, int n, int (*in)(int))
+{
+	int key, errors = 0;
+	size_t size = 0;
+
+	for (key=0; key<n; key++) {
+		if (bst_search(my_tree, key) != in(key)) errors++;
+		size += in(key);
+	}
+	if (bst_size(my_tree) != size) errors++;
+	if (my_tree->root && my_tree->root->height > 2 * 11) errors++;
+	return errors;
+}
+
+/* below 6000, A holds the multiples of 2, B the multiples of 3 (or of 300) */
+int set_union(int key) { return key % 2 == 0 || key % 3 == 0; }
+int set_intersect(int key) { return key % 6 == 0; }
+int set_difference(int key) { return key % 2 == 0 && key % 3 != 0; }
+int set_reverse_difference(int key) { return key % 3 == 0 && key % 2 != 0; }
+int set_small_intersect(int key) { return key % 300 == 0; }
+int set_small_difference(int key) { return key % 2 == 0 && key % 300 != 0; }
+int set_small_reverse(int key) { return key % 300 == 0 && key % 2 != 0; }
+
+WVTEST_MAIN("binary search tree tests - union, intersection and difference")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY};
+	bst *a, *b, *small, *result;
+	int i, t;
+
+	for (t=0; t<4; t++) {
+		a = bst_create_type(types[t]);
+		b = bst_create_type(types[(t + 1) % 4]);
+		small = bst_create_type(types[t]);
+		for (i=0; i<3000; i++) {
+			bst_insert(a, (i * 7919) % 3000 * 2);
+			bst_insert(b, (i * 7919) % 2000 * 3);
+		}
+		for (i=0; i<6000; i+=300) {
+			bst_insert(small, i);
+		}
+
+		/* similar sizes: merged */
+		result = bst_union(a, b);
+		WVPASSEQ(set_check(result, 6000, set_union), 0);
+		bst_destroy(result);
+		result = bst_intersect(a, b);
+		WVPASSEQ(set_check(result, 6000, set_intersect), 0);
+		bst_destroy(result);
+		result = bst_difference(a, b);
+		WVPASSEQ(set_check(result, 6000, set_difference), 0);
+		bst_destroy(result);
+		result = bst_difference(b, a);
+		WVPASSEQ(set_check(result, 6000, set_reverse_difference), 0);
+		bst_destroy(result);
+
+		/* one tree much smaller: looked up */
+		result = bst_intersect(a, small);
+		WVPASSEQ(set_check(result, 6000, set_small_intersect), 0);
+		bst_destroy(result);
+		result = bst_intersect(small, a);
+		WVPASSEQ(set_check(result, 6000, set_small_intersect), 0);
+		bst_destroy(result);
+		result = bst_difference(a, small);
+		WVPASSEQ(set_check(result, 6000, set_small_difference), 0);
+		bst_destroy(result);
+		result = bst_difference(small, a);
+		WVPASSEQ(set_check(result, 6000, set_small_reverse), 0);
+		bst_destroy(result);
+
+		/* a tree with itself */
+		result = bst_intersect(a, a);
+		WVPASSEQ(bst_size(result), 3000);
+		bst_destroy(result);
+		result = bst_difference(a, a);
+		WVPASSEQ(bst_size(result), 0);
+		bst_destroy(result);
+
+		bst_destroy(a);
+		bst_destroy(b);
+		bst_destroy(small);
+	}
+}
+
+#define SET_ROUNDS 20000
+
+struct set_arg {
+	bst *a, *b;
+	int rounds;
+	int errors;
+};
+
+/* union a with b, again and again: each result holds the shared keys */
+void *set_worker(void *p)
+{
+	struct set_arg *arg = (struct set_arg *) p;
+	bst *result;
+	int i;
+
+	for (i=0; i<arg->rounds; i++) {
+		result = bst_union(arg->a, arg->b);
+		if (result == NULL || bst_size(result) < 100) arg->errors++;
+		bst_destroy(result);
+	}
+	return NULL;
+}
+
+/* insert and remove a key above the shared ones, write locking each time */
+void *set_writer(void *p)
+{
+	struct set_arg *arg = (struct set_arg *) p;
+	int i;
+
+	for (i=0; i<arg->rounds; i++) {
+		if (! bst_insert(arg->a, 1000)) arg->errors++;
+		if (! bst_remove(arg->a, 1000)) arg->errors++;
+	}
+	return NULL;
+}
+
+WVTEST_MAIN("binary search tree tests - set operations each way round, with writers")
+{
+	bst *a = bst_create_type(BST_AVL | BST_THREADSAFE);
+	bst *b = bst_create_type(BST_AVL | BST_THREADSAFE);
+	bst *lo = a < b ? a : b, *hi = a < b ? b : a;
+	struct set_arg args[4] = {
+		{a, b, SET_ROUNDS, 0}, {b, a, SET_ROUNDS, 0}, {a, NULL, SET_ROUNDS, 0}, {b, NULL, SET_ROUNDS, 0}
+	};
+	pthread_t threads[4];
+	int i, errors = 0;
+
+	for (i=0; i<100; i++) {
+		bst_insert(a, i);
+		bst_insert(b, i);
+	}
+
+	/* the two unions name the trees in opposite orders, while a
+	 * writer queues on each - this must not deadlock */
+	for (i=0; i<2; i++) {
+		pthread_create(&threads[i], NULL, set_worker, &args[i]);
+	}
+	for (i=2; i<4; i++) {
+		pthread_create(&threads[i], NULL, set_writer, &args[i]);
+	}
+	for (i=0; i<4; i++) {
+		pthread_join(threads[i], NULL);
+		errors += args[i].errors;
+	}
+	WVPASSEQ(errors, 0);
+	WVPASSEQ(bst_size(a), 100);
+	WVPASSEQ(bst_size(b), 100);
+
+	/* which is because, either way round, a union waiting for the
+	 * lower tree's lock holds nothing on the higher one */
+	for (i=0; i<2; i++) {
+		args[i].rounds = 1;
+		pthread_rwlock_wrlock(&lo->lock);
+		pthread_create(&threads[i], NULL, set_worker, &args[i]);
+		usleep(50000);
+		if (pthread_rwlock_trywrlock(&hi->lock) == 0) {
+			pthread_rwlock_unlock(&hi->lock);
+		} else {
+			errors++;
+		}
+		pthread_rwlock_unlock(&lo->lock);
+		pthread_join(threads[i], NULL);
+		errors += args[i].errors;
+	}
+	WVPASSEQ(errors, 0);
+
+	bst_destroy(a);
+	bst_destroy(b);
+}
+
+/*
+ * Check that 'my_tree' is a sound AVL tree: balanced, counted, with
+ * parent pointers that match. Return the number of errors.
+ */
+int split_check(bst *my_tree)
+{
+	struct bstnode_s *node;
+	int errors = 0;
+
+	if (avl_check(my_tree->root, LONG_MIN, LONG_MAX) < 0) errors++;
+	if (count_check(my_tree->root) != (long) my_tree->size) errors++;
+	if (my_tree->root && my_tree->root->parent != NULL) errors++;
+	for (node = my_tree->root ? bst_min_node(my_tree->root) : NULL; node; node = bst_next_node(node)) {
+		if (node->left && node->left->parent != node) errors++;
+		if (node->right && node->right->parent != node) errors++;
+	}
+	return errors;
+}
+
+WVTEST_MAIN("binary search tree tests - split and join")
+{
+	bst *my_tree, *lo, *hi, *other;
+	int i, cut, errors = 0;
+
+	/* split at every sort of point, and join back */
+	for (cut=-10; cut<=1010; cut+=37) {
+		my_tree = bst_create_type(BST_AVL);
+		for (i=0; i<1000; i++) {
+			bst_insert(my_tree, (i * 7919) % 1000);
+		}
+
+		if (! bst_split(my_tree, cut, &lo, &hi)) errors++;
+		if (lo != my_tree) errors++;
+		errors += split_check(lo) + split_check(hi);
+		i = cut < 0 ? 0 : (cut > 1000 ? 1000 : cut);
+		if (bst_size(lo) != (size_t) i || bst_size(hi) != (size_t)(1000 - i)) errors++;
+		if (i > 0 && bst_find_max(lo) != i - 1) errors++;
+		if (i < 1000 && bst_find_min(hi) != i) errors++;
+
+		my_tree = bst_join(lo, hi);
+		if (my_tree != lo) errors++;
+		errors += split_check(my_tree);
+		if (bst_size(my_tree) != 1000 || bst_rank(my_tree, 500) != 500) errors++;
+		bst_destroy(my_tree);
+	}
+	WVPASSEQ(errors, 0);
+
+	/* the halves live on separately, in either order */
+	my_tree = bst_create_type(BST_AVL);
+	for (i=0; i<10000; i++) {
+		bst_insert(my_tree, i);
+	}
+	WVPASS(bst_split(my_tree, 2500, &lo, &hi));
+	for (i=0; i<10000; i+=2) {
+		if (i < 2500) bst_remove(lo, i); else bst_remove(hi, i);
+	}
+	for (i=20000; i<30000; i++) {
+		bst_insert(hi, i);
+	}
+	WVPASSEQ(split_check(lo) + split_check(hi), 0);
+	WVPASSEQ(bst_size(lo), 1250);
+	WVPASSEQ(bst_size(hi), 13750);
+	bst_destroy(lo);
+	WVPASS(bst_search(hi, 29999));
+	WVPASS(bst_search(hi, 2501));
+
+	/* a tall tree joined onto a short one, and onto an empty one */
+	other = bst_create_type(BST_AVL);
+	bst_insert(other, -5);
+	other = bst_join(other, hi);
+	WVPASSEQ(split_check(other), 0);
+	WVPASSEQ(bst_size(other), 13751);
+	hi = bst_create_type(BST_AVL);
+	hi = bst_join(hi, other);
+	WVPASSEQ(split_check(hi), 0);
+	WVPASSEQ(bst_find_min(hi), -5);
+
+	/* overlapping keys, and trees of other types, are refused */
+	other = bst_create_type(BST_AVL);
+	bst_insert(other, 100);
+	WVPASS(bst_join(hi, other) == NULL);
+	WVPASSEQ(bst_size(hi), 13751);
+	bst_destroy(other);
+	other = bst_create_type(BST_WIDE);
+	WVPASSEQ(bst_split(other, 0, &lo, &hi), 0);
+	bst_destroy(other);
+
+	bst_destroy(hi);
+
+	/* thread-safe trees too - the rebalancing is counted in the tree split */
+	my_tree = bst_create_type(BST_AVL | BST_THREADSAFE);
+	for (i=0; i<10000; i++) {
+		bst_insert(my_tree, (i * 7919) % 10000);
+	}
+#ifdef BST_STATS
+	{
+		bst_stats_t before, after;
+
+		bst_stats(my_tree, &before);
+		WVPASS(bst_split(my_tree, 3333, &lo, &hi));
+		bst_stats(lo, &after);
+		WVPASS(after.ops.rotations > before.ops.rotations);
+	}
+#else
+	WVPASS(bst_split(my_tree, 3333, &lo, &hi));
+#endif
+	WVPASSEQ(split_check(lo) + split_check(hi), 0);
+	my_tree = bst_join(lo, hi);
+	WVPASS(my_tree == lo);
+	WVPASSEQ(split_check(my_tree), 0);
+	WVPASSEQ(bst_size(my_tree), 10000);
+	bst_destroy(my_tree);
+}
+
+WVTEST_MAIN("binary search tree tests - parallel bulk insert")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY};
+	bst *my_tree, *serial;
+	bst_key *keys, *got, *want;
+	int i, t, threads, n = 200000, errors = 0;
+
+	keys = (bst_key *) malloc(n * sizeof(bst_key));
+	got = (bst_key *) malloc(2 * n * sizeof(bst_key));
+	want = (bst_key *) malloc(2 * n * sizeof(bst_key));
+
+	/* random keys, negative ones and duplicates among them */
+	srand48(SEED);
+	for (i=0; i<n; i++) {
+		keys[i] = (bst_key)(n * drand48()) - n / 2;
+	}
+	serial = bst_create_type(BST_AVL);
+	for (i=0; i<n; i++) {
+		bst_insert(serial, keys[i]);
+	}
+	bst_inorder_toarray(serial, want);
+
+	for (t=0; t<4; t++) {
+		for (threads=1; threads<=4; threads+=3) {
+			/* into an empty tree */
+			my_tree = bst_create_type(types[t]);
+			WVPASS(bst_insert_bulk(my_tree, keys, n, threads));
+			WVPASSEQ(bst_size(my_tree), bst_size(serial));
+#ifdef BST_STATS
+			{
+				bst_stats_t stats;
+
+				/* every key counts as an insert, duplicates too */
+				bst_stats(my_tree, &stats);
+				WVPASSEQ(stats.ops.inserts, n);
+				if (types[t] != BST_WIDE) {
+					WVPASSEQ(stats.ops.insert_visits, bst_size(serial));
+				}
+			}
+#endif
+			bst_inorder_toarray(my_tree, got);
+			WVPASSEQ(memcmp(got, want, bst_size(serial) * sizeof(bst_key)), 0);
+			if (types[t] != BST_WIDE) {
+				WVPASSEQ(split_check(my_tree), 0);
+			}
+
+			/* and again on top, plus some new keys above */
+			for (i=0; i<1000; i++) {
+				keys[i] += n;
+			}
+			WVPASS(bst_insert_bulk(my_tree, keys, n, threads));
+			for (i=0; i<1000; i++) {
+				keys[i] -= n;
+				if (! bst_search(my_tree, keys[i] + n)) errors++;
+			}
+			WVPASSEQ(errors, 0);
+			if (types[t] == BST_SPLAY) {
+				/* the searches splayed it, so it is no longer balanced */
+				WVPASSEQ(count_check(my_tree->root), (long) bst_size(my_tree));
+			} else if (types[t] != BST_WIDE) {
+				WVPASSEQ(split_check(my_tree), 0);
+			}
+
+			/* nothing, and a few, change nothing or a little */
+			WVPASS(bst_insert_bulk(my_tree, keys, 0, threads));
+			WVPASS(bst_insert_bulk(my_tree, keys, 10, threads));
+			bst_destroy(my_tree);
+		}
+	}
+
+	bst_destroy(serial);
+	free(keys);
+	free(got);
+	free(want);
+}
+
+/*
+ * Helper functions:
+ * A reduction that sums, counts and takes the maximum of the keys at
+ * once, to check bst_parallel_reduce() against.
+ */
+struct reduce_acc {
+	long long sum;
+	size_t count;
+	bst_key max;
+};
+
+static void reduce_map(bst_key key, void *acc, void *ctx) {
+	struct reduce_acc *a = (struct reduce_acc *) acc;
+
+	a->sum += key;
+	a->count++;
+	if (key > a->max) a->max = key;
+}
+
+static void reduce_fold(void *acc, const void *other, void *ctx) {
+	struct reduce_acc *a = (struct reduce_acc *) acc;
+	const struct reduce_acc *b = (const struct reduce_acc *) other;
+
+	a->sum += b->sum;
+	a->count += b->count;
+	if (b->max > a->max) a->max = b->max;
+}
+
+WVTEST_MAIN("binary search tree tests - parallel reduce")
+{
+	int types[] = {BST_PLAIN, BST_AVL, BST_WIDE, BST_SPLAY, BST_AVL | BST_THREADSAFE};
+	struct reduce_acc acc, want;
+	bst *my_tree;
+	bst_key key;
+	int i, t, threads, n = 100000, errors = 0;
+
+	for (t=0; t<5; t++) {
+		my_tree = bst_create_type(types[t]);
+
+		/* an empty tree maps nothing */
+		acc.sum = 0, acc.count = 0, acc.max = BST_KEY_MIN;
+		WVPASSEQ(bst_parallel_reduce(my_tree, reduce_map, reduce_fold, NULL, 4, &acc, sizeof(acc)), 0);
+		WVPASSEQ(acc.count, 0);
+
+		/* random keys, negative ones among them */
+		srand48(SEED);
+		want.sum = 0, want.count = 0, want.max = BST_KEY_MIN;
+		for (i=0; i<n; i++) {
+			key = (bst_key)(4.0 * n * drand48()) - n;
+			if (bst_insert(my_tree, key)) reduce_map(key, &want, NULL);
+		}
+
+		for (threads=1; threads<=4; threads+=3) {
+			acc.sum = 0, acc.count = 0, acc.max = BST_KEY_MIN;
+			if (bst_parallel_reduce(my_tree, reduce_map, reduce_fold, NULL, threads, &acc, sizeof(acc))
+					!= want.count) errors++;
+			if (acc.sum != want.sum || acc.count != want.count || acc.max != want.max) errors++;
+		}
+		WVPASSEQ(errors, 0);
+		bst_destroy(my_tree);
+	}
+
+	/* a plain tree built from sorted keys is a list - one long thin task */
+	my_tree = bst_create_type(BST_PLAIN);
+	for (i=0; i<10000; i++) {
+		bst_insert(my_tree, i);
+	}
+	acc.sum = 0, acc.count = 0, acc.max = BST_KEY_MIN;
+	WVPASSEQ(bst_parallel_reduce(my_tree, reduce_map, reduce_fold, NULL, 4, &acc, sizeof(acc)), 10000);
+	WVPASSEQ(acc.count, 10000);
+	WVPASSEQ(acc.sum, 10000LL * 9999 / 2);
+	WVPASSEQ(acc.max, 9999);
+	bst_destroy(my_tree);
+}
+
+
+WVTEST_MAIN("binary search tree tests - statistics")
+{
+	bst_key sorted[7] = {1, 2, 3, 4, 5, 6, 7};
+	bst_stats_t st;
+	bst *my_tree;
+	int i;
+
+	/* empty */
+	my_tree = bst_create_type(BST_AVL);
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.size, 0);
+	WVPASSEQ(st.height, 0);
+	WVPASSEQ(st.min_height, 0);
+	WVPASSEQ(st.nodes, 0);
+	bst_destroy(my_tree);
+
+	/* ascending keys in a plain tree - the degenerate, LINEAR case */
+	my_tree = bst_create_type(BST_PLAIN);
+	for (i=0; i<100; i++) {
+		bst_insert(my_tree, i);
+	}
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.size, 100);
+	WVPASSEQ(st.height, 100);
+	WVPASSEQ(st.min_height, 7);
+	WVPASS(st.avg_depth == 50.5);
+	WVPASSEQ(st.nodes, 100);
+	WVPASSEQ(st.node_bytes, 100 * sizeof(struct bstnode_s));
+	WVPASS(st.pool_chunks >= 1);
+	WVPASS(st.pool_bytes >= st.node_bytes);
+#ifdef BST_STATS
+	WVPASSEQ(st.counting, 1);
+	WVPASSEQ(st.ops.inserts, 100);
+	WVPASSEQ(st.ops.insert_visits, 99 * 100 / 2);	// 0 + 1 + ... + 99
+	bst_search(my_tree, 0);
+	bst_search(my_tree, 99);
+	bst_remove(my_tree, 99);
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.ops.searches, 2);
+	WVPASSEQ(st.ops.search_visits, 1 + 100);
+	WVPASSEQ(st.ops.removes, 1);
+	WVPASSEQ(st.ops.remove_visits, 100);
+	WVPASSEQ(st.ops.rotations, 0);
+#else
+	WVPASSEQ(st.counting, 0);
+	WVPASSEQ(st.ops.inserts, 0);
+#endif
+	bst_destroy(my_tree);
+
+	/* a perfect tree: depths 1, 2, 2, 3, 3, 3, 3 */
+	my_tree = bst_create_from_sorted(sorted, 7);
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.height, 3);
+	WVPASSEQ(st.min_height, 3);
+	WVPASSEQ((int)(st.avg_depth * 7 + 0.5), 17);
+	bst_destroy(my_tree);
+
+	/* the same ascending keys stay balanced in an AVL tree */
+	my_tree = bst_create_type(BST_AVL);
+	for (i=0; i<1000; i++) {
+		bst_insert(my_tree, i);
+	}
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.min_height, 10);
+	WVPASS(st.height >= 10 && st.height <= 14);
+	WVPASS(st.avg_depth < st.height);
+#ifdef BST_STATS
+	WVPASS(st.ops.rotations > 0);
+	WVPASS(st.ops.insert_visits < 1000 * 14);
+#endif
+	bst_destroy(my_tree);
+
+	/* and a wide tree is only a few levels of many keys each */
+	my_tree = bst_create_type(BST_WIDE);
+	for (i=0; i<1000; i++) {
+		bst_insert(my_tree, i);
+	}
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.size, 1000);
+	WVPASSEQ(st.min_height, 3);
+	WVPASS(st.height >= 3 && st.height <= 4);
+	WVPASS(st.nodes >= 1000 / BST_WIDE_MAX_KEYS && st.nodes < 1000 / BST_WIDE_MIN_KEYS + 1);
+	WVPASS(st.avg_depth > 1 && st.avg_depth <= st.height);
+	WVPASSEQ(st.node_bytes, st.nodes * sizeof(struct bst_widenode_s));
+#ifdef BST_STATS
+	WVPASSEQ(st.ops.inserts, 1000);
+	WVPASS(st.ops.insert_visits <= 1000 * 4);
+#endif
+	bst_destroy(my_tree);
+}
+
+
+/* depth of 'key' in a node tree - the root is 0 - or -1 if it isn't there */
+int node_depth(struct bstnode_s *node, bst_key key)
+{
+	int depth = 0;
+
+	for (; node != NULL; depth++) {
+		if (key == node->data) return depth;
+		node = key > node->data ? node->right : node->left;
+	}
+	return -1;
+}
+
+WVTEST_MAIN("binary search tree tests - splay trees")
+{
+	bst_key arr[1000], want[1000];
+	bst_stats_t st;
+	bst *my_tree;
+	int i, k, before, errors = 0;
+
+	my_tree = bst_create_type(BST_SPLAY | BST_THREADSAFE);
+	WVPASS(my_tree != NULL);
+	bst_destroy(my_tree);
+
+	my_tree = bst_create_type(BST_SPLAY);
+	for (i=0; i<1000; i++) {
+		if (! bst_insert(my_tree, (i * 7919) % 1000)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVPASSEQ(bst_size(my_tree), 1000);
+	for (i=0; i<1000; i++) {
+		want[i] = i;
+	}
+
+	/* every search takes its key about halfway up */
+	for (i=0; i<1000; i++) {
+		k = (i * 31) % 1000;
+		before = node_depth(my_tree->root, k);
+		if (! bst_search(my_tree, k)) errors++;
+		if (node_depth(my_tree->root, k) > before / 2 + 1) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVFAIL(bst_search(my_tree, 5000));
+	WVFAIL(bst_search(my_tree, -5));
+	WVFAIL(bst_insert(my_tree, 500));
+
+	/* ... without losing anything or breaking the links */
+	WVPASSEQ(my_tree->root->parent == NULL, 1);
+	WVPASSEQ(count_check(my_tree->root), 1000);
+	bst_inorder_toarray(my_tree, arr);
+	WVPASSEQ(memcmp(arr, want, sizeof(arr)), 0);
+	WVPASSEQ(bst_rank(my_tree, 250), 250);
+
+	/* a key asked for again and again ends up on top, found at once */
+	for (i=0; i<20; i++) {
+		bst_search(my_tree, 123);
+	}
+	WVPASSEQ(my_tree->root->data, 123);
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.size, 1000);
+#ifdef BST_STATS
+	WVPASS(st.ops.rotations > 0);
+	i = st.ops.search_visits;
+	bst_search(my_tree, 123);
+	bst_stats(my_tree, &st);
+	WVPASSEQ(st.ops.search_visits - i, 1);
+#endif
+
+	/* removes: the odd keys go */
+	for (i=1; i<1000; i+=2) {
+		if (! bst_remove(my_tree, i)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVFAIL(bst_remove(my_tree, 1));
+	WVPASSEQ(bst_size(my_tree), 500);
+	WVPASSEQ(count_check(my_tree->root), 500);
+	bst_inorder_toarray(my_tree, arr);
+	for (i=0; i<500; i++) {
+		if (arr[i] != 2 * i) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	bst_destroy(my_tree);
+
+	/* ascending inserts leave a path, but the searches don't recurse down it */
+	my_tree = bst_create_type(BST_SPLAY);
+	for (i=0; i<100000; i++) {
+		bst_insert(my_tree, i);
+	}
+	for (i=0; i<100000; i++) {
+		if (! bst_search(my_tree, i)) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	WVPASSEQ(bst_size(my_tree), 100000);
+	WVPASSEQ(bst_find_max(my_tree), 99999);
+	bst_destroy(my_tree);
+}
+
+
+/*
+ * Lock-free stress test: every thread owns a range of keys, where the
+ * result of each operation is known in advance, and all of them fight
+ * over a small set of shared keys. For a shared key, the successful
+ * inserts minus the successful removes, over all threads, must say
+ * whether it ends up in the tree.
+ */
+#define LF_THREADS 4
+#define LF_OWN_KEYS 2000
+#define LF_SHARED_KEYS 32
+#define LF_ROUNDS 40000
+
+struct lf_arg {
+	bst_lf *tree;
+	int id;
+	int errors;
+	int inserted[LF_SHARED_KEYS];
+	int removed[LF_SHARED_KEYS];
+};
+
+void *lf_worker(void *p)
+{
+	struct lf_arg *arg = (struct lf_arg *) p;
+	bst_lf_thread *me = bst_lf_register(arg->tree);
+	unsigned short seed[3] = { SEED, arg->id, 0 };
+	int i, k, pass;
+
+	for (i=0; i<LF_ROUNDS; i++) {
+		/* own keys, above the shared ones: insert them all, then remove them all, ... */
+		k = LF_SHARED_KEYS + LF_THREADS * ((i * 7919) % LF_OWN_KEYS) + arg->id;
+		pass = i / LF_OWN_KEYS % 2;
+		if (bst_lf_search(me, k) != pass) arg->errors++;
+		if (pass == 0) {
+			if (! bst_lf_insert(me, k)) arg->errors++;
+			if (bst_lf_insert(me, k)) arg->errors++;
+		} else {
+			if (! bst_lf_remove(me, k)) arg->errors++;
+			if (bst_lf_remove(me, k)) arg->errors++;
+		}
+		if (bst_lf_search(me, k) == pass) arg->errors++;
+
+		/* shared keys */
+		k = (int)(LF_SHARED_KEYS * erand48(seed));
+		if (erand48(seed) < 0.5) {
+			arg->inserted[k] += bst_lf_insert(me, k);
+		} else {
+			arg->removed[k] += bst_lf_remove(me, k);
+		}
+	}
+
+	bst_lf_unregister(me);
+	return NULL;
+}
+
+WVTEST_MAIN("binary search tree tests - lock-free tree")
+{
+	pthread_t threads[LF_THREADS];
+	struct lf_arg args[LF_THREADS];
+	int arr[LF_SHARED_KEYS + LF_THREADS * LF_OWN_KEYS];
+	int i, k, net, present, errors = 0;
+	bst_lf_thread *me;
+	bst_lf *my_tree;
+
+	/* single-threaded first */
+	my_tree = bst_lf_create();
+	WVPASS(my_tree != NULL);
+	me = bst_lf_register(my_tree);
+	WVPASS(me != NULL);
+	for (i=0; i<N_TESTS; i++) {
+		WVPASS(bst_lf_insert(me, (i * 7919) % N_TESTS - N_TESTS / 2));
+	}
+	WVFAIL(bst_lf_insert(me, 0));
+	WVPASSEQ(bst_lf_size(my_tree), N_TESTS);
+	for (i=0; i<N_TESTS; i+=2) {
+		WVPASS(bst_lf_remove(me, i - N_TESTS / 2));
+	}
+	WVFAIL(bst_lf_remove(me, 0));
+	WVPASSEQ(bst_lf_size(my_tree), N_TESTS / 2);
+	for (i=0; i<N_TESTS; i++) {
+		if (bst_lf_search(me, i - N_TESTS / 2) != i % 2) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	bst_lf_inorder_toarray(my_tree, arr);
+	for (i=0; i<N_TESTS / 2; i++) {
+		if (arr[i] != 2 * i + 1 - N_TESTS / 2) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	bst_lf_unregister(me);
+	bst_lf_destroy(my_tree);
+
+	/* then all at once */
+	my_tree = bst_lf_create();
+	for (i=0; i<LF_THREADS; i++) {
+		memset(&args[i], 0, sizeof(args[i]));
+		args[i].tree = my_tree;
+		args[i].id = i;
+		pthread_create(&threads[i], NULL, lf_worker, &args[i]);
+	}
+	for (i=0; i<LF_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		errors += args[i].errors;
+	}
+	WVPASSEQ(errors, 0);
+
+	me = bst_lf_register(my_tree);
+	present = 0;
+	for (k=0; k<LF_SHARED_KEYS; k++) {
+		net = 0;
+		for (i=0; i<LF_THREADS; i++) {
+			net += args[i].inserted[k] - args[i].removed[k];
+		}
+		if (net != bst_lf_search(me, k)) errors++;
+		present += net;
+	}
+	WVPASSEQ(errors, 0);
+
+	/* the own keys all ended on a remove pass */
+	WVPASSEQ(bst_lf_size(my_tree), present);
+	bst_lf_inorder_toarray(my_tree, arr);
+	for (i=1; i<present; i++) {
+		if (arr[i - 1] >= arr[i] || arr[i] >= LF_SHARED_KEYS) errors++;
+	}
+	WVPASSEQ(errors, 0);
+	bst_lf_unregister(me);
+	bst_lf_destroy(my_tree);
+}
+
 WVTEST_MAIN("binary search tree tests - create/destroy")
 {
 	/* init the hash table */